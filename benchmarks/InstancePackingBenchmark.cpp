@@ -0,0 +1,135 @@
+
+#include "VkRay/AccelStruct.h"
+
+#include <chrono>
+#include <cstdio>
+#include <new>
+#include <random>
+
+// FORWARD DECLARATIONS ================================================================================================
+
+namespace vr::bench {
+
+    // CONSTANTS =======================================================================================================
+
+    static constexpr uint32_t INSTANCE_COUNT = 500'000;
+    static constexpr uint32_t WARMUP_RUNS = 3;
+    static constexpr uint32_t TIMED_RUNS = 20;
+
+    // MACROS ==========================================================================================================
+
+    // TYPES ===========================================================================================================
+
+    // the structure of arrays the kernels read, filled with random data so nothing can be folded away
+    struct instance_data {
+
+        std::vector<float>                                      Transforms;
+        std::vector<uint64_t>                                   BLASReferences;
+        std::vector<uint32_t>                                   SBTOffsets;
+        std::vector<uint8_t>                                    Masks;
+    };
+
+    struct bench_case {
+
+        const char*                                             Name;
+        bool                                                    ForceScalar;
+        bool                                                    NonTemporalStores;
+    };
+
+    // STATIC VARIABLES ================================================================================================
+
+    // FUNCTION IMPLEMENTATION =========================================================================================
+
+    static instance_data make_instance_data(uint32_t count) {
+
+        std::mt19937 rng(1234);
+        std::uniform_real_distribution<float> floats(-100.0f, 100.0f);
+
+        instance_data outData = {};
+        outData.Transforms.resize((size_t)count * 16);
+        outData.BLASReferences.resize(count);
+        outData.SBTOffsets.resize(count);
+        outData.Masks.resize(count);
+
+        for (auto &value : outData.Transforms)
+            value = floats(rng);
+
+        for (uint32_t i = 0; i < count; i++) {
+
+            outData.BLASReferences[i] = 0x100000ull + (uint64_t)(rng() % 4096) * 256;
+            outData.SBTOffsets[i] = rng() % 64;
+            outData.Masks[i] = (uint8_t)rng();
+        }
+
+        return outData;
+    }
+
+
+    // best of the timed runs in milliseconds, the best run is the least disturbed by the rest of the system
+    static double run_case(const bench_case &benchCase, const instance_data &data, vk::AccelerationStructureInstanceKHR *dst) {
+
+        InstancePackInfo info = {};
+        info.Count = INSTANCE_COUNT;
+        info.Transforms = data.Transforms.data();
+        info.BLASReferences = data.BLASReferences.data();
+        info.SBTOffsets = data.SBTOffsets.data();
+        info.Masks = data.Masks.data();
+        info.NonTemporalStores = benchCase.NonTemporalStores;
+        info.ForceScalar = benchCase.ForceScalar;
+
+        for (uint32_t run = 0; run < WARMUP_RUNS; run++)
+            PackInstances(info, dst);
+
+        double bestMs = 1e30;
+        for (uint32_t run = 0; run < TIMED_RUNS; run++) {
+
+            auto start = std::chrono::steady_clock::now();
+            PackInstances(info, dst);
+            auto end = std::chrono::steady_clock::now();
+
+            bestMs = std::min(bestMs, std::chrono::duration<double, std::milli>(end - start).count());
+        }
+
+        return bestMs;
+    }
+
+}
+
+
+int main() {
+
+    using namespace vr::bench;
+
+    const instance_data data = make_instance_data(INSTANCE_COUNT);
+
+    // 64 byte aligned like a VMA allocation, so the streaming stores are used
+    const size_t dstSize = (size_t)INSTANCE_COUNT * sizeof(vk::AccelerationStructureInstanceKHR);
+    auto *dst = static_cast<vk::AccelerationStructureInstanceKHR *>(::operator new(dstSize, std::align_val_t(64)));
+
+#if defined(VR_SIMD_SSE2)
+    const char *simdName = "SSE2";
+#elif defined(VR_SIMD_NEON)
+    const char *simdName = "NEON";
+#else
+    const char *simdName = "none, scalar fallback";
+#endif
+
+    const bench_case cases[] = {
+        { "scalar",                     true,  false },             // ignores NonTemporalStores
+        { "SIMD",                       false, false },
+        { "SIMD, non-temporal",         false, true },
+    };
+
+    std::printf("PackInstances, %u instances, SIMD: %s, best of %u runs\n", INSTANCE_COUNT, simdName, TIMED_RUNS);
+    std::printf("Note: the destination is cached host memory, non-temporal stores gain more on write-combined mappings\n");
+
+    for (const auto &benchCase : cases) {
+
+        double ms = run_case(benchCase, data, dst);
+        double gbPerSecond = (double)dstSize / (ms * 1e-3) / 1e9;
+        std::printf("  %-24s %8.3f ms  %6.2f ns/instance  %6.2f GB/s written\n", benchCase.Name, ms, ms * 1e6 / INSTANCE_COUNT, gbPerSecond);
+    }
+
+    ::operator delete(dst, std::align_val_t(64));
+    return 0;
+}
@@ -0,0 +1,171 @@
+#pragma once
+
+#include "../../src/pch.h"
+
+#include "VkRay/AccelStruct.h"
+#include "VkRay/Buffer.h"
+#include "VkRay/UploadManager.h"
+#include "VkRay/builders/builders.h"
+
+// FORWARD DECLARATIONS ================================================================================================
+
+namespace vr {
+
+    class vk_ray_device;
+
+    // CONSTANTS =======================================================================================================
+
+    // MACROS ==========================================================================================================
+
+    // TYPES ===========================================================================================================
+
+    struct AccelBuildQueueCreateInfo {
+
+        vk::Queue               ComputeQueue = nullptr;                 // @brief The queue the builds are submitted to
+        uint32_t                ComputeFamily = ~0U;                    // @brief The queue family of ComputeQueue
+        uint32_t                GraphicsFamily = ~0U;                   // @brief The queue family that traces the built acceleration structures
+
+        // @brief Fills the queues from the queues the vulkan_builder created
+        // @param queues The return value of vulkan_builder::GetQueues()
+        void SetQueues(const CommandQueues &queues) {
+
+            ComputeQueue = queues.ComputeQueue;
+            ComputeFamily = queues.ComputeIndex;
+            GraphicsFamily = queues.GraphicsIndex;
+        }
+    };
+
+    // STATIC VARIABLES ================================================================================================
+
+    // FUNCTION DECLARATION ============================================================================================
+
+    // TEMPLATE DECLARATION ============================================================================================
+
+    // CLASS DECLARATION ===============================================================================================
+
+    // @brief Builds acceleration structures asynchronously on the compute queue
+    // @note Builds can be enqueued from any thread. BLAS builds are recorded right away into a command buffer of the
+    // calling thread, every thread has its own command pool. Submit() submits the command buffers of all the threads
+    // in one batch, followed by the TLAS builds, and signals a timeline semaphore that the graphics queue waits on.
+    // This way streaming BLAS builds overlap the ray dispatches of the frame instead of serializing with them.
+    // Typical use:
+    //      device.SetAccelStructQueueFamilies({ queues.ComputeIndex, queues.GraphicsIndex });  // before creating any BLAS
+    //      buildQueue.AddUploadWait(uploader, uploader.Submit());     // if the vertices are uploaded on the transfer queue
+    //      uint64_t built = buildQueue.EnqueueBLAS(buildInfos);       // from any thread
+    //      buildQueue.Submit();                                       // once per frame
+    //      graph.AddWait(FrameGraphQueue::Graphics, buildQueue.GetTimelineSemaphore(), built, vk::PipelineStageFlagBits2::eRayTracingShaderKHR);
+    // @warning The acceleration structures are used on the compute and the graphics queue without a queue family
+    // ownership transfer. If the families differ, call vk_ray_device::SetAccelStructQueueFamilies(...) with both of
+    // them before creating the acceleration structures and arenas, so their buffers are shared concurrently.
+    class accel_build_queue {
+    public:
+
+        // @brief Creates the timeline semaphore, the command pools are created per thread on first use
+        // @param device The VkRay device, it must outlive the build queue
+        // @param info The settings, the compute queue is required
+        // @note The device must have the timelineSemaphore feature enabled (vulkan_builder enables it)
+        accel_build_queue(vk_ray_device &device, const AccelBuildQueueCreateInfo &info);
+
+        // @brief Waits for all the submitted builds and destroys the command pools and scratch buffers
+        ~accel_build_queue();
+
+        accel_build_queue(const accel_build_queue&) = delete;
+        accel_build_queue& operator=(const accel_build_queue&) = delete;
+
+        // @brief Get the timeline semaphore that is signaled with the values returned by EnqueueBLAS(...) and co.
+        vk::Semaphore GetTimelineSemaphore() const                                                          { return m_timeline; }
+
+        // @brief Records BLAS builds into the command buffer of the calling thread
+        // @param buildInfos The build infos, this should be the return value of CreateBLAS(...). A scratch buffer is
+        // created for them and destroyed once the builds are done.
+        // @return The timeline value the builds are finished with, it is signaled by the next Submit()
+        // @note This function is thread safe
+        uint64_t EnqueueBLAS(std::vector<BLASBuildInfo> buildInfos);
+
+        // @brief Queues a TLAS build, it is recorded by the next Submit() after all the BLAS builds of the batch
+        // @param buildInfo The build info, this should be the return value of CreateTLAS(...)
+        // @param instanceBuffer The instances, they must not change until the returned value is reached
+        // @param instanceCount The number of instances in instanceBuffer
+        // @return The timeline value the build is finished with
+        // @note This function is thread safe
+        uint64_t EnqueueTLAS(const TLASBuildInfo &buildInfo, const allocated_buffer &instanceBuffer, uint32_t instanceCount);
+
+        // @brief Makes the next Submit() wait on a semaphore, e.g. on the upload of the vertex buffers
+        // @param semaphore A timeline semaphore, e.g. upload_manager::GetTimelineSemaphore()
+        // @param value The timeline value that is waited for
+        // @note This function is thread safe
+        void AddWait(vk::Semaphore semaphore, uint64_t value);
+
+        // @brief Makes the next Submit() wait on an upload batch and acquire the uploaded buffers before the builds
+        // @param uploader The upload manager, its UploadManagerCreateInfo::DstFamily must be the compute family
+        // @param batch The return value of uploader.Submit()
+        // @note This function is thread safe. The acquire barriers are recorded into a command buffer that runs before
+        // all the builds of the batch.
+        void AddUploadWait(const upload_manager &uploader, const UploadBatch &batch);
+
+        // @brief Submits all the enqueued builds to the compute queue in one batch
+        // @return The timeline value the batch signals, 0 if nothing was enqueued
+        // @note This function is thread safe. It also frees the scratch buffers of the finished batches.
+        uint64_t Submit();
+
+        // @brief Get the last timeline value the compute queue has finished
+        uint64_t GetCompletedValue() const;
+
+        // @brief Blocks until the compute queue has finished the builds
+        // @param value The timeline value of the builds
+        // @param timeout The timeout in nanoseconds
+        // @return True if the builds are finished, false on timeout
+        bool Wait(uint64_t value, uint64_t timeout = UINT64_MAX);
+
+    private:
+
+        // the command pool of one thread, its command buffers are only recorded by that thread
+        struct thread_recorder {
+
+            std::mutex                          Mutex;                  // Submit() ends the open command buffer from another thread
+            vk::CommandPool                     Pool = nullptr;
+            vk::CommandBuffer                   Open = nullptr;         // the command buffer of the next batch
+            uint64_t                            OpenValue = 0;          // the timeline value of the next batch
+            std::vector<vk::CommandBuffer>      Free;
+            std::vector<allocated_buffer>       Scratch;                // the scratch buffers of the open command buffer
+        };
+
+        struct pending_tlas {
+
+            TLASBuildInfo                       BuildInfo = {};
+            allocated_buffer                    InstanceBuffer = {};
+            uint32_t                            InstanceCount = 0;
+        };
+
+        struct in_flight_batch {
+
+            uint64_t                                                    TimelineValue = 0;
+            std::vector<std::pair<thread_recorder*, vk::CommandBuffer>> CommandBuffers;
+            std::vector<allocated_buffer>                               Scratch;
+        };
+
+        thread_recorder& get_recorder();
+
+        void create_pool(thread_recorder &recorder);
+
+        vk::CommandBuffer get_command_buffer(thread_recorder &recorder);
+
+        void reclaim_finished();
+
+        vk_ray_device&                                          m_vr_device;
+        AccelBuildQueueCreateInfo                               m_info;
+        std::mutex                                              m_mutex;
+
+        std::unordered_map<std::thread::id, std::unique_ptr<thread_recorder>> m_recorders;
+        std::vector<pending_tlas>                               m_pending_tlas;
+        std::vector<vk::SemaphoreSubmitInfo>                    m_waits;
+        std::vector<vk::BufferMemoryBarrier>                    m_acquire_barriers;         // of the uploads the next batch waits on
+        std::deque<in_flight_batch>                             m_in_flight;
+
+        thread_recorder                                         m_tlas_recorder;            // records the acquire barriers and TLAS builds in Submit()
+
+        vk::Semaphore                                           m_timeline = nullptr;
+        uint64_t                                                m_next_value = 1;
+    };
+
+}
@@ -23,10 +23,24 @@ namespace vr
         vk::DeviceAddress       TransformDevAddress = {};   // Buffer containing the transform for the geometry, if this is null, the geometry will use the identity matrix
     };
 
+    /// @brief Contains the host pointers to the geometry data, only used when the BLAS is built on the host
+    struct GeometryHostAddress
+    {
+        union {
+
+            const void*         VertexData = nullptr;
+            const void*         AABBData;
+        };
+
+        const void*             IndexData = nullptr;        // Host pointer to the index data, only used for triangles
+        const void*             TransformData = nullptr;    // Host pointer to the transform, if this is null, the geometry will use the identity matrix
+    };
+
     struct GeometryData
     {
         vk::GeometryTypeKHR     Type = vk::GeometryTypeKHR::eTriangles;         // Type of geometry, either triangles or AABBs
         GeometryDeviceAddress   DataAddresses = {};                             // Buffer containing the vertices, only used for triangles
+        GeometryHostAddress     HostAddresses = {};                             // Host pointers to the data, used instead of DataAddresses for host builds
         vk::IndexType           IndexFormat = vk::IndexType::eUint32;           // Format of the index buffer, only used for triangles
         vk::Format              VertexFormat = vk::Format::eR32G32B32Sfloat;    // Format of the vertex buffer, only used for triangles
         uint32_t                Stride = 0;                                     // Stride of each element in the vertex buffer or AABB buffer
@@ -34,6 +48,64 @@ namespace vr
         vk::GeometryFlagsKHR    Flags = vk::GeometryFlagBitsKHR::eOpaque;       // Flags for the geometry, Default is eOpaque
     };
 
+    //--------------------------------------------------------------------------------------
+    // ARENA STRUCTURES
+    //--------------------------------------------------------------------------------------
+
+    /// @brief A big acceleration structure storage buffer, whose memory is handed out by a VMA virtual block
+    struct AccelStructArenaBlock
+    {
+        /// @brief Buffer that contains all the acceleration structures of the block
+        allocated_buffer Buffer = {};
+
+        /// @brief Keeps track of the used ranges of the buffer, null if the block was released
+        VmaVirtualBlock VirtualBlock = nullptr;
+    };
+
+    /// @brief Sub-allocates acceleration structures from a few big buffers, instead of one buffer per acceleration
+    /// structure
+    /// @note Create it with CreateAccelStructArena(...) and set BLASCreateInfo::Arena to allocate the BLASes from it.
+    /// Allocating and freeing from the arena is thread safe.
+    struct AccelStructArena
+    {
+        /// @brief All the blocks of the arena, AccelStructArenaAllocation::BlockIndex indexes into this vector
+        std::vector<AccelStructArenaBlock> Blocks = {};
+
+        /// @brief Size of a regular block, acceleration structures bigger than this get a block of their own
+        vk::DeviceSize BlockSize = 0;
+
+        std::mutex Mutex;
+    };
+
+    /// @brief Location of an acceleration structure inside an AccelStructArena
+    struct AccelStructArenaAllocation
+    {
+        /// @brief The arena the acceleration structure was allocated from, null if it has its own buffer
+        AccelStructArena *Arena = nullptr;
+
+        VmaVirtualAllocation Allocation = nullptr;
+
+        uint32_t BlockIndex = 0;
+
+        /// @brief Offset of the acceleration structure in the buffer of the block
+        vk::DeviceSize Offset = 0;
+    };
+
+    struct AccelStructArenaStats
+    {
+        /// @brief Number of blocks that are currently allocated
+        uint32_t BlockCount = 0;
+
+        /// @brief Number of acceleration structures in the arena
+        uint32_t AllocationCount = 0;
+
+        /// @brief Bytes of all the blocks combined
+        vk::DeviceSize TotalBytes = 0;
+
+        /// @brief Bytes that are used by acceleration structures
+        vk::DeviceSize UsedBytes = 0;
+    };
+
     //--------------------------------------------------------------------------------------
     // BLAS STRUCTURES
     //--------------------------------------------------------------------------------------
@@ -47,6 +119,14 @@ namespace vr
         /// @brief Flags for the acceleration structure, Default is ePreferFastTrace
         /// @note The flags must be appropriately set for future use, e.g., compaction, update, etc.
         vk::BuildAccelerationStructureFlagsKHR      Flags = vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace;
+
+        /// @brief Arena the BLAS will be allocated from, if this is null, the BLAS gets its own buffer
+        /// @note Ignored for host builds, they need a host visible buffer of their own
+        AccelStructArena                           *Arena = nullptr;
+
+        /// @brief Whether the BLAS is built by the device or on the host, see BuildBLASOnHost(...)
+        /// @note Host builds read GeometryData::HostAddresses and require the accelerationStructureHostCommands feature
+        vk::AccelerationStructureBuildTypeKHR       BuildType = vk::AccelerationStructureBuildTypeKHR::eDevice;
     };
 
     struct BLASBuildInfo
@@ -70,6 +150,9 @@ namespace vr
         std::shared_ptr<vk::AccelerationStructureBuildRangeInfoKHR[]> Ranges = nullptr;
 
         uint32_t RangesCount = 0;
+
+        /// @brief Whether the BLAS is built by the device or on the host
+        vk::AccelerationStructureBuildTypeKHR BuildType = vk::AccelerationStructureBuildTypeKHR::eDevice;
     };
 
     struct BLASHandle
@@ -78,7 +161,12 @@ namespace vr
         vk::AccelerationStructureKHR AccelerationStructure = nullptr;
 
         /// @brief Buffer containing the acceleration structure
+        /// @note If the BLAS is allocated from an arena, this is the buffer of the arena block, which is shared with
+        /// other acceleration structures. DevAddress and Size are the ones of the BLAS.
         allocated_buffer Buffer = {};
+
+        /// @brief Location of the BLAS in its arena, ArenaAllocation.Arena is null if the BLAS has its own buffer
+        AccelStructArenaAllocation ArenaAllocation = {};
     };
 
     struct BLASUpdateInfo
@@ -106,6 +194,62 @@ namespace vr
         std::vector<vk::AccelerationStructureKHR> SourceBLAS = {};
     };
 
+    /// @brief State of the automatic compaction pipeline, see QueueCompaction(...) and ProcessCompactions(...)
+    /// @note The pipeline owns query pools, so it must be destroyed with DestroyCompactionPipeline(...)
+    struct CompactionPipeline
+    {
+        struct PendingCompaction
+        {
+            /// @brief The request whose compacted sizes are queried
+            CompactionRequest Request = {};
+
+            /// @brief The BLASes that will be replaced with their compacted versions, in the order of the request
+            std::vector<BLASHandle *> Targets = {};
+        };
+
+        /// @brief Compactions whose compacted sizes are not read back yet
+        std::vector<PendingCompaction> Pending = {};
+
+        /// @brief Number of BLASes that were compacted by the pipeline so far
+        uint64_t CompactedCount = 0;
+
+        /// @brief Number of bytes of acceleration structure memory that were freed by the compactions so far
+        uint64_t BytesSaved = 0;
+    };
+
+    /// @brief Statistics of a single batch recorded by BuildBLASBatched(...)
+    struct BLASBatchStats
+    {
+        /// @brief Index of the first build info of the batch in the vector given to BuildBLASBatched(...)
+        uint32_t FirstBuildInfo = 0;
+
+        /// @brief Number of consecutive build infos in the batch, starting from FirstBuildInfo
+        /// @note Build infos in BLASBatchBuildResult::SkippedBuildInfos are left out of the batches and not counted,
+        /// so a batch can span more than BuildInfoCount indices of the supplied vector
+        uint32_t BuildInfoCount = 0;
+
+        /// @brief Number of primitives (triangles or AABBs) that are built in the batch
+        uint64_t PrimitiveCount = 0;
+
+        /// @brief Scratch memory in bytes that the batch uses, including the alignment between the build infos
+        vk::DeviceSize ScratchSize = 0;
+    };
+
+    struct BLASBatchBuildResult
+    {
+        /// @brief Scratch buffer that is shared by all the batches
+        /// @note If the scratch buffer was created by BuildBLASBatched(...), the user must destroy it AFTER the command
+        /// buffer execution. If the user supplied the scratch buffer, this is a copy of it.
+        allocated_buffer ScratchBuffer = {};
+
+        /// @brief One entry per batch, in the order the batches were recorded, every entry is one build command
+        std::vector<BLASBatchStats> Batches = {};
+
+        /// @brief Indices of the build infos that were not recorded, because they alone need more scratch memory than
+        /// the supplied scratch buffer has
+        std::vector<uint32_t> SkippedBuildInfos = {};
+    };
+
     //--------------------------------------------------------------------------------------
     // TLAS STRUCTUES
     //--------------------------------------------------------------------------------------
@@ -120,6 +264,9 @@ namespace vr
 
         /// @brief Flags for the acceleration structure, Default is ePreferFastTrace
         vk::BuildAccelerationStructureFlagsKHR Flags = vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace;
+
+        /// @brief Whether the TLAS is built by the device or on the host, see BuildTLASOnHost(...)
+        vk::AccelerationStructureBuildTypeKHR BuildType = vk::AccelerationStructureBuildTypeKHR::eDevice;
     };
 
     struct TLASBuildInfo
@@ -138,6 +285,9 @@ namespace vr
 
         /// @brief Max number of instances that can be added to the TLAS
         uint32_t MaxInstanceCount = 0;
+
+        /// @brief Whether the TLAS is built by the device or on the host
+        vk::AccelerationStructureBuildTypeKHR BuildType = vk::AccelerationStructureBuildTypeKHR::eDevice;
     };
 
     struct TLASHandle
@@ -149,6 +299,200 @@ namespace vr
         allocated_buffer Buffer = {};
     };
 
-    vk::AccelerationStructureGeometryDataKHR ConvertToVulkanGeometry(const GeometryData &geom);
+    /// @brief One slice of an InstanceRing, that the instances of a single frame are written to
+    struct InstanceRingSlice
+    {
+        /// @brief View of the slice in the ring buffer, it doesn't own the allocation
+        /// @note DevAddress and Size are the ones of the slice
+        allocated_buffer Buffer = {};
+
+        /// @brief Persistently mapped pointer to the instances of the slice, null if acquiring the slice failed
+        vk::AccelerationStructureInstanceKHR *Instances = nullptr;
+
+        /// @brief Number of instances that fit into the slice
+        uint32_t Capacity = 0;
+
+        /// @brief Index of the slice in the ring
+        uint32_t Index = 0;
+
+        /// @brief Offset of the slice in the ring buffer in bytes
+        vk::DeviceSize Offset = 0;
+
+        /// @brief Allocation of the whole ring, used to flush the written instances
+        VmaAllocation RingAllocation = nullptr;
+    };
+
+    /// @brief Tells when the GPU is done reading a slice of an InstanceRing, either a fence or a timeline semaphore
+    /// value
+    struct InstanceRingGuard
+    {
+        vk::Fence Fence = nullptr;
+
+        vk::Semaphore TimelineSemaphore = nullptr;
+
+        uint64_t TimelineValue = 0;
+    };
+
+    /// @brief Frames in flight ring of instance buffers, all slices are in one persistently mapped allocation
+    /// @note Acquire a slice with AcquireInstanceSlice(...), write the instances, build the TLAS from the slice and
+    /// guard the slice with the fence or timeline value of the submission. The CPU can then write the next frame's
+    /// slice, while the GPU still builds from the previous one.
+    struct InstanceRing
+    {
+        allocated_buffer Buffer = {};
+
+        /// @brief Persistently mapped pointer to the start of the ring buffer
+        uint8_t *MappedData = nullptr;
+
+        uint32_t SliceCount = 0;
+
+        /// @brief Number of instances per slice
+        uint32_t SliceCapacity = 0;
+
+        /// @brief Index of the slice that is acquired next
+        uint32_t Cursor = 0;
+
+        /// @brief One guard per slice, set by GuardInstanceSlice(...)
+        std::vector<InstanceRingGuard> Guards = {};
+    };
+
+    /// @brief Structure of arrays of instances, that PackInstances(...) packs into vk::AccelerationStructureInstanceKHR
+    /// records
+    struct InstancePackInfo
+    {
+        /// @brief Number of instances in the arrays
+        uint32_t Count = 0;
+
+        /// @brief Count 4x4 world matrices, 16 floats each. The last row is ignored
+        const float *Transforms = nullptr;
+
+        /// @brief True if the matrices are column major (e.g. glm::mat4), false if they are row major
+        bool ColumnMajorTransforms = true;
+
+        /// @brief Count device addresses of the BLASes, or vk::AccelerationStructureKHR handles for host builds
+        const uint64_t *BLASReferences = nullptr;
+
+        /// @brief Optional, Count 24 bit custom indices. If null, the index of the instance in the arrays is used
+        const uint32_t *CustomIndices = nullptr;
+
+        /// @brief Optional, Count 8 bit masks. If null, DefaultMask is used
+        const uint8_t *Masks = nullptr;
+
+        /// @brief Optional, Count 24 bit SBT record offsets. If null, DefaultSBTOffset is used
+        const uint32_t *SBTOffsets = nullptr;
+
+        /// @brief Optional, Count 8 bit vk::GeometryInstanceFlagsKHR. If null, DefaultFlags is used
+        const uint8_t *Flags = nullptr;
+
+        uint8_t DefaultMask = 0xFF;
+
+        uint32_t DefaultSBTOffset = 0;
+
+        vk::GeometryInstanceFlagsKHR DefaultFlags = {};
+
+        /// @brief Write with non-temporal stores, that bypass the cache. This is a lot faster for write-combined
+        /// mappings such as instance buffers, but slower if the destination is read back from cached memory soon
+        bool NonTemporalStores = true;
+
+        /// @brief Pack with the scalar loop even if SIMD is available, e.g. to compare the kernels
+        bool ForceScalar = false;
+    };
+
+    /// @brief Writes the instances [first, first + count) of instances, see vk_ray_device::WriteInstances(...)
+    using InstanceWriter = std::function<void(vk::AccelerationStructureInstanceKHR *instances, uint32_t first, uint32_t count)>;
+
+    //--------------------------------------------------------------------------------------
+    // MANAGED TLAS STRUCTURES
+    //--------------------------------------------------------------------------------------
+
+    /// @brief What BuildManagedTLAS(...) recorded
+    enum class TLASBuildMode : uint8_t
+    {
+        /// @brief Nothing changed, so nothing was recorded
+        None = 0,
+
+        /// @brief The TLAS was refit in eUpdate mode
+        Refit = 1,
+
+        /// @brief The TLAS was rebuilt from scratch
+        Rebuild = 2
+    };
+
+    struct ManagedTLASCreateInfo
+    {
+        /// @brief Number of instances the TLAS has space for initially, it grows geometrically when it is full
+        uint32_t InitialCapacity = 1024;
+
+        /// @brief Flags for the acceleration structure, eAllowUpdate is always added
+        vk::BuildAccelerationStructureFlagsKHR Flags = vk::BuildAccelerationStructureFlagBitsKHR::ePreferFastTrace;
+
+        /// @brief The TLAS is rebuilt when more than this fraction of the instances changed since the last rebuild
+        float RebuildChangedFraction = 0.25f;
+
+        /// @brief The TLAS is rebuilt when the transform deltas accumulated since the last rebuild, averaged over all
+        /// instances, exceed this value. The delta of a transform change is the biggest absolute difference of its
+        /// 3x4 matrix elements, so it is in scene units for translations. 0 disables the heuristic.
+        float RebuildMeanTransformDelta = 0.0f;
+
+        /// @brief The TLAS is rebuilt after this many refits in a row, because every refit degrades the trace quality
+        uint32_t MaxRefits = 120;
+    };
+
+    /// @brief A TLAS that keeps track of its instances, see CreateManagedTLAS(...)
+    /// @note Each frame, BuildManagedTLAS(...) uploads only the changed instances and picks between a refit and a
+    /// rebuild. The members are managed by VkRay and should only be read.
+    struct ManagedTLAS
+    {
+        TLASHandle TLAS = {};
+
+        TLASBuildInfo BuildInfo = {};
+
+        /// @brief Device local copy of Instances, that the TLAS is built from
+        allocated_buffer InstanceBuffer = {};
+
+        /// @brief Scratch buffer that is big enough for builds and updates
+        allocated_buffer ScratchBuffer = {};
+
+        /// @brief Host copy of the instances, indexed by the instance ID, removed instances have a mask of 0
+        std::vector<vk::AccelerationStructureInstanceKHR> Instances = {};
+
+        /// @brief IDs of removed instances, that are reused by AddTLASInstance(...)
+        std::vector<uint32_t> FreeIDs = {};
+
+        /// @brief Instances that changed since the last BuildManagedTLAS(...), in instances, not bytes
+        dirty_ranges DirtyInstances = {};
+
+        ManagedTLASCreateInfo Settings = {};
+
+        /// @brief Number of instance slots the TLAS was built with the last time it was rebuilt
+        uint32_t BuiltInstanceCount = 0;
+
+        /// @brief Number of instance changes since the last rebuild
+        uint32_t ChangesSinceRebuild = 0;
+
+        /// @brief Sum of the transform deltas since the last rebuild
+        double TransformDeltaSinceRebuild = 0.0;
+
+        uint32_t RefitsSinceRebuild = 0;
+
+        /// @brief Set when the TLAS can't be refit, e.g. after it was recreated with a bigger capacity
+        bool NeedsRebuild = true;
+    };
+
+    /// @brief Packs the instances into vk::AccelerationStructureInstanceKHR records, e.g. straight into a mapped
+    /// instance buffer or an InstanceRingSlice
+    /// @param info The instances in structure of arrays layout
+    /// @param dst The destination of the instance at index 0 of the arrays
+    /// @param first The first instance that is packed
+    /// @param count The number of instances that are packed, clamped to the end of the arrays
+    /// @note Uses SSE2 or NEON when the target supports them, with a scalar fallback. The non-temporal stores need a
+    /// 16 byte aligned dst, unaligned destinations are written with regular stores.
+    void PackInstances(const InstancePackInfo &info, vk::AccelerationStructureInstanceKHR *dst, uint32_t first = 0,
+                       uint32_t count = UINT32_MAX);
+
+    /// @brief Converts the geometry to the vulkan format
+    /// @param buildType For host builds the host pointers of the geometry are used, else the device addresses
+    vk::AccelerationStructureGeometryDataKHR ConvertToVulkanGeometry(
+        const GeometryData &geom, vk::AccelerationStructureBuildTypeKHR buildType = vk::AccelerationStructureBuildTypeKHR::eDevice);
 
 }
@@ -0,0 +1,123 @@
+#pragma once
+
+#include "../../src/pch.h"
+
+// FORWARD DECLARATIONS ================================================================================================
+
+namespace vr {
+
+    // CONSTANTS =======================================================================================================
+
+    // MACROS ==========================================================================================================
+
+    // TYPES ===========================================================================================================
+
+    // @brief How a resource is accessed, every access maps to the exact synchronization2 stage, access and image layout,
+    // so barriers never have to fall back to eAllCommands
+    enum class ResourceAccess : uint8_t {
+
+        None = 0,                       // @brief Nothing accessed the resource yet, e.g. a new image, its content is discarded
+        AccelStructBuildInput,          // @brief Vertex, index, transform, AABB or instance buffers read by an AS build
+        AccelStructBuildWrite,          // @brief The acceleration structure that is built or updated, and the scratch memory
+        AccelStructBuildRead,           // @brief A BLAS read by a TLAS build, or the source of an AS copy
+        AccelStructTraceRead,           // @brief An acceleration structure traced against by DispatchRays(...)
+        AccelStructComputeRead,         // @brief An acceleration structure traced against by ray queries in compute
+        RayTracingShaderRead,           // @brief A storage image or buffer read by ray tracing shaders
+        RayTracingShaderWrite,          // @brief A storage image or buffer written by ray tracing shaders
+        ShaderBindingTableRead,         // @brief The shader binding table read by DispatchRays(...)
+        ComputeShaderRead,              // @brief A storage image or buffer read by a compute shader, e.g. a denoiser
+        ComputeShaderWrite,             // @brief A storage image or buffer written by a compute shader
+        FragmentShaderSampled,          // @brief An image sampled in a fragment shader, e.g. to display the result
+        TransferRead,                   // @brief The source of a copy
+        TransferWrite,                  // @brief The destination of a copy, e.g. an upload
+        HostWrite,                      // @brief Memory written by the CPU through a mapping before the submit
+        Present,                        // @brief A swapchain image that is presented
+    };
+
+    struct ResourceAccessInfo {
+
+        vk::PipelineStageFlags2 Stages = {};
+        vk::AccessFlags2        Access = {};
+        vk::AccessFlags2        WriteAccess = {};                       // @brief The part of Access that writes, it has to be made available
+        vk::ImageLayout         Layout = vk::ImageLayout::eUndefined;   // @brief Undefined for accesses that don't need a layout
+    };
+
+    // STATIC VARIABLES ================================================================================================
+
+    // FUNCTION DECLARATION ============================================================================================
+
+    // @brief Get the stages, accesses and image layout of a resource access
+    ResourceAccessInfo GetAccessInfo(ResourceAccess access);
+
+    // TEMPLATE DECLARATION ============================================================================================
+
+    // CLASS DECLARATION ===============================================================================================
+
+    // @brief Collects memory, buffer and image barriers over a recording window and records them as one
+    // vkCmdPipelineBarrier2
+    // @note Memory barriers are merged into a single global barrier, and barriers of the same buffer range or image
+    // subresources with the same layouts are merged too. Buffer barriers are only needed for queue family ownership
+    // transfers, everything else is cheaper as a memory barrier.
+    // Typical use:
+    //      barrier_batch barriers;
+    //      barriers.AddMemoryBarrier(ResourceAccess::AccelStructBuildWrite, ResourceAccess::AccelStructTraceRead);
+    //      barriers.AddImageBarrier(outputImage, ResourceAccess::None, ResourceAccess::RayTracingShaderWrite);
+    //      barriers.Flush(cmdBuf);
+    class barrier_batch {
+    public:
+
+        // @param detectRedundant If true, barriers that don't protect against any hazard are logged as warnings when
+        // they are added or flushed, and counted by GetRedundantCount(). Meant for debug builds.
+        barrier_batch(bool detectRedundant = false) : m_detect_redundant(detectRedundant) {}
+
+        // @brief Adds a global memory barrier between two accesses
+        void AddMemoryBarrier(ResourceAccess src, ResourceAccess dst);
+
+        // @brief Adds a global memory barrier with explicit masks
+        void AddMemoryBarrier(vk::PipelineStageFlags2 srcStages, vk::AccessFlags2 srcAccess, vk::PipelineStageFlags2 dstStages,
+            vk::AccessFlags2 dstAccess);
+
+        // @brief Adds a barrier for a range of a buffer between two accesses
+        void AddBufferBarrier(vk::Buffer buffer, ResourceAccess src, ResourceAccess dst, vk::DeviceSize offset = 0,
+            vk::DeviceSize size = VK_WHOLE_SIZE);
+
+        // @brief Adds a buffer barrier, e.g. one half of a queue family ownership transfer
+        void AddBufferBarrier(const vk::BufferMemoryBarrier2 &barrier);
+
+        // @brief Adds a barrier for an image between two accesses, the layout is transitioned from the one of src to the
+        // one of dst
+        // @note With ResourceAccess::None as src the image content is discarded
+        void AddImageBarrier(vk::Image image, ResourceAccess src, ResourceAccess dst,
+            const vk::ImageSubresourceRange &range = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1));
+
+        // @brief Adds an image barrier with explicit masks and layouts
+        void AddImageBarrier(const vk::ImageMemoryBarrier2 &barrier);
+
+        // @brief Records all the collected barriers as one vkCmdPipelineBarrier2 and clears the batch
+        // @note Nothing is recorded if the batch is empty
+        void Flush(vk::CommandBuffer cmdBuf);
+
+        // @brief Drops all the collected barriers without recording them
+        void Clear();
+
+        // @brief True if no barrier was added since the last Flush()
+        bool IsEmpty() const;
+
+        // @brief Get the number of redundant barriers detected since the batch was created, 0 if detection is off
+        uint32_t GetRedundantCount() const                                                                  { return m_redundant_count; }
+
+    private:
+
+        void report_redundant(const char *reason);
+
+        void check_flushed_barriers();
+
+        vk::MemoryBarrier2                                      m_memory_barrier = {};
+        std::vector<vk::BufferMemoryBarrier2>                   m_buffer_barriers;
+        std::vector<vk::ImageMemoryBarrier2>                    m_image_barriers;
+
+        bool                                                    m_detect_redundant = false;
+        uint32_t                                                m_redundant_count = 0;
+    };
+
+}
@@ -22,6 +22,11 @@ namespace vr {
         vk::Buffer              Buffer = nullptr;                       // @brief The raw buffer handle
         vk::DeviceAddress       DevAddress = 0;                         // @brief The device address of the buffer
         uint64_t                Size = 0;                               // @brief The size of the buffer, without any alignment
+
+        // @brief The persistent mapping, only set if the buffer was created with VMA_ALLOCATION_CREATE_MAPPED_BIT
+        // @note MapBuffer(...) returns it without mapping the memory again
+        void*                   MappedData = nullptr;
+        bool                    HostCoherent = false;                   // @brief If true, writes don't need to be flushed
     };
 
     struct AllocatedTexelBuffer {
@@ -72,4 +77,42 @@ namespace vr {
 
     // CLASS DECLARATION ===============================================================================================
 
+    // @brief A range of a buffer, the unit (bytes or elements) is up to the user
+    struct BufferRange {
+
+        uint64_t                Offset = 0;
+        uint64_t                Size = 0;
+    };
+
+    // @brief Collects the ranges of a buffer that were changed, so only those need to be uploaded
+    // @note Overlapping and adjacent ranges are merged lazily, when the ranges are read
+    class dirty_ranges {
+    public:
+
+        // @brief Marks a range as dirty
+        // @param offset The start of the range
+        // @param size The size of the range, empty ranges are ignored
+        void Add(uint64_t offset, uint64_t size);
+
+        // @brief Removes all the ranges, call after uploading them
+        void Clear()                                                                                        { m_ranges.clear(); m_merged = true; }
+
+        // @brief Returns true if nothing is dirty
+        bool IsEmpty() const                                                                                { return m_ranges.empty(); }
+
+        // @brief Returns the dirty ranges sorted by offset, without overlaps
+        // @param mergeGap Ranges that are at most this far apart are merged into one, which trades uploading a few
+        // clean bytes for fewer copy regions
+        const std::vector<BufferRange>& GetRanges(uint64_t mergeGap = 0);
+
+        // @brief Returns the combined size of the dirty ranges
+        uint64_t GetTotalSize(uint64_t mergeGap = 0);
+
+    private:
+
+        std::vector<BufferRange>                                m_ranges;
+        bool                                                    m_merged = true;
+        uint64_t                                                m_merge_gap = 0;
+    };
+
 }
@@ -0,0 +1,126 @@
+#pragma once
+
+#include "../../src/pch.h"
+
+// FORWARD DECLARATIONS ================================================================================================
+
+namespace vr {
+
+    // CONSTANTS =======================================================================================================
+
+    // MACROS ==========================================================================================================
+
+    // TYPES ===========================================================================================================
+
+    struct CommandAllocatorCreateInfo {
+
+        uint32_t                QueueFamily = ~0U;                      // @brief The queue family the command buffers are submitted to
+        uint32_t                FramesInFlight = 2;                     // @brief Number of frames the command buffers are buffered for
+    };
+
+    // STATIC VARIABLES ================================================================================================
+
+    // FUNCTION DECLARATION ============================================================================================
+
+    // TEMPLATE DECLARATION ============================================================================================
+
+    // CLASS DECLARATION ===============================================================================================
+
+    // @brief Allocates command buffers from one command pool per thread and frame, so threads can record in parallel
+    // without locking
+    // @note A thread gets its pools on its first allocation. All the command buffers of a frame slot are reset with
+    // one vkResetCommandPool per thread when the slot is reused by BeginFrame(), they are never freed one by one.
+    // The primary command buffers that threads add with Enqueue(...) are submitted together by one Submit(...).
+    // Typical frame, with the recording split over the worker threads:
+    //      allocator.BeginFrame();
+    //      // on every worker thread:
+    //      vk::CommandBuffer cmdBuf = allocator.AllocatePrimary();
+    //      cmdBuf.begin(...); device.BuildBLAS(tileBuildInfos, cmdBuf); cmdBuf.end();
+    //      allocator.Enqueue(cmdBuf);
+    //      // on the main thread, after the workers are done:
+    //      allocator.Submit(computeQueue, waits, signals);
+    // @warning BeginFrame() must not run while other threads allocate or record command buffers of the allocator
+    class command_allocator {
+    public:
+
+        // @brief Creates an empty allocator, the command pools are created per thread on first use
+        // @param device The Vulkan device
+        // @param info The queue family and the number of frames in flight
+        command_allocator(vk::Device device, const CommandAllocatorCreateInfo &info);
+
+        // @brief Destroys the command pools of all the threads
+        // @warning The GPU must be done with all the command buffers
+        ~command_allocator();
+
+        command_allocator(const command_allocator&) = delete;
+        command_allocator& operator=(const command_allocator&) = delete;
+
+        // @brief Advances to the next frame slot and resets the command pools of all the threads for it
+        // @note Call this once per frame, after waiting for the frame that was submitted FramesInFlight frames ago,
+        // like vk_ray_device::AdvanceFrame()
+        void BeginFrame();
+
+        // @brief Get a primary command buffer from the pool of the calling thread, it is valid until the frame slot is
+        // reused
+        // @note This function is thread safe, and lock free after the first call of a thread
+        vk::CommandBuffer AllocatePrimary();
+
+        // @brief Get a secondary command buffer from the pool of the calling thread
+        // @note This function is thread safe. Secondary command buffers that are used outside of a render pass, e.g.
+        // for builds and ray dispatches, are begun with an empty vk::CommandBufferInheritanceInfo.
+        vk::CommandBuffer AllocateSecondary();
+
+        // @brief Records secondary command buffers, e.g. recorded on several threads, into a new primary command buffer
+        // @param secondaries The ended secondary command buffers, they are executed in this order
+        // @return The ended primary command buffer, it can be passed to Enqueue(...)
+        vk::CommandBuffer ExecuteSecondaries(const std::vector<vk::CommandBuffer> &secondaries);
+
+        // @brief Adds an ended primary command buffer to the next Submit(...)
+        // @note This function is thread safe. The command buffers of different threads are submitted in the order
+        // they were enqueued, so they must not depend on each other without barriers.
+        void Enqueue(vk::CommandBuffer cmdBuf);
+
+        // @brief Submits all the enqueued command buffers in one vkQueueSubmit2
+        // @param queue The queue, it must be of the queue family of the allocator
+        // @param waits The semaphores the command buffers wait on
+        // @param signals The semaphores that are signaled when the command buffers are done
+        // @param fence The fence that is signaled when the command buffers are done, can be nullptr
+        // @note The wait and signal semaphores are used even if nothing was enqueued
+        void Submit(vk::Queue queue, const std::vector<vk::SemaphoreSubmitInfo> &waits = {},
+            const std::vector<vk::SemaphoreSubmitInfo> &signals = {}, vk::Fence fence = nullptr);
+
+        // @brief Get the number of threads that allocated command buffers
+        uint32_t GetThreadCount() const;
+
+    private:
+
+        // the command buffers of one thread in one frame slot
+        struct frame_pool {
+
+            vk::CommandPool                     Pool = nullptr;
+            std::vector<vk::CommandBuffer>      Primaries;
+            std::vector<vk::CommandBuffer>      Secondaries;
+            uint32_t                            UsedPrimaries = 0;
+            uint32_t                            UsedSecondaries = 0;
+        };
+
+        struct thread_pools {
+
+            std::vector<frame_pool>             Frames;
+        };
+
+        thread_pools& get_thread_pools();
+
+        vk::CommandBuffer allocate(vk::CommandBufferLevel level);
+
+        vk::Device                                              m_device;
+        CommandAllocatorCreateInfo                              m_info;
+        uint64_t                                                m_id = 0;                   // key of the thread local lookup
+        uint32_t                                                m_frame_slot = 0;
+
+        mutable std::mutex                                      m_mutex;
+        std::vector<std::unique_ptr<thread_pools>>              m_threads;
+        std::vector<vk::CommandBuffer>                          m_enqueued;
+    };
+
+}
@@ -0,0 +1,249 @@
+#pragma once
+
+#include "../../src/pch.h"
+
+#include "VkRay/Barriers.h"
+#include "VkRay/builders/builders.h"
+
+// FORWARD DECLARATIONS ================================================================================================
+
+namespace vr {
+
+    // CONSTANTS =======================================================================================================
+
+    // MACROS ==========================================================================================================
+
+    // TYPES ===========================================================================================================
+
+    // @brief The queues a frame graph pass can run on
+    enum class FrameGraphQueue : uint8_t {
+
+        Graphics = 0,
+        Compute = 1,
+        Transfer = 2,
+    };
+
+    struct FrameGraphQueueInfo {
+
+        vk::Queue               Queue = nullptr;
+        uint32_t                Family = ~0U;
+    };
+
+    struct FrameGraphCreateInfo {
+
+        // @brief Passes on a queue that isn't set run on the graphics queue. If two of them are the same vk::Queue, the
+        // passes are ordered with barriers instead of semaphores.
+        FrameGraphQueueInfo     Graphics = {};
+        FrameGraphQueueInfo     Compute = {};
+        FrameGraphQueueInfo     Transfer = {};
+
+        // @brief Number of frames the command buffers of the graph are buffered for
+        uint32_t                FramesInFlight = 2;
+
+        // @brief Fills the queues from the queues the vulkan_builder created
+        // @param queues The return value of vulkan_builder::GetQueues()
+        void SetQueues(const CommandQueues &queues) {
+
+            Graphics = {queues.GraphicsQueue, queues.GraphicsIndex};
+            Compute = {queues.ComputeQueue, queues.ComputeIndex};
+            Transfer = {queues.TransferQueue, queues.TransferIndex};
+        }
+    };
+
+    // @brief One resource access of a pass
+    struct FrameGraphAccess {
+
+        uint32_t                Resource = ~0U;                         // @brief The return value of frame_graph::AddBuffer(...) and co.
+        ResourceAccess          Access = ResourceAccess::ComputeShaderRead;
+    };
+
+    // STATIC VARIABLES ================================================================================================
+
+    // FUNCTION DECLARATION ============================================================================================
+
+    // TEMPLATE DECLARATION ============================================================================================
+
+    // CLASS DECLARATION ===============================================================================================
+
+    // @brief Orders the passes of a frame, e.g. build -> trace -> denoise, with the minimal barriers and semaphores
+    // @note Resources are registered once, passes are added every frame in submission order and run by Execute().
+    // Within a queue the graph records one barrier_batch per pass that only covers the stages and accesses
+    // that actually depend on each other. Across queues, the submissions are split where a pass depends on another
+    // queue and chained with one timeline semaphore per queue.
+    // Typical frame:
+    //      graph.AddPass("Build TLAS", FrameGraphQueue::Compute, {{tlas, ResourceAccess::AccelStructBuildWrite}}, [&](vk::CommandBuffer cmd) { ... });
+    //      graph.AddPass("Trace", FrameGraphQueue::Graphics, {{tlas, ResourceAccess::AccelStructTraceRead}, {noisy, ResourceAccess::RayTracingShaderWrite}}, ...);
+    //      graph.AddPass("Denoise", FrameGraphQueue::Graphics, {{noisy, ResourceAccess::ComputeShaderRead}, {output, ResourceAccess::ComputeShaderWrite}}, ...);
+    //      graph.Execute();
+    // @warning Resources used on queues of different families must be created with VK_SHARING_MODE_CONCURRENT, the
+    // graph doesn't transfer queue family ownership.
+    class frame_graph {
+    public:
+
+        // @brief Creates the timeline semaphores and command pools of the queues
+        // @param device The Vulkan device, synchronization2 and timelineSemaphore must be enabled (vulkan_builder
+        // enables both)
+        // @param info The queues, at least the graphics queue is required
+        frame_graph(vk::Device device, const FrameGraphCreateInfo &info);
+
+        // @brief Waits until the GPU is done with all the passes and destroys the semaphores and command pools
+        ~frame_graph();
+
+        frame_graph(const frame_graph&) = delete;
+        frame_graph& operator=(const frame_graph&) = delete;
+
+        // @brief Registers a buffer, e.g. geometry, instance or scratch buffer
+        // @return The handle of the resource, used by FrameGraphAccess
+        uint32_t AddBuffer(vk::Buffer buffer);
+
+        // @brief Registers an acceleration structure
+        // @return The handle of the resource, used by FrameGraphAccess
+        uint32_t AddAccelStruct(vk::AccelerationStructureKHR accelStruct);
+
+        // @brief Registers an image, the graph transitions its layout from then on
+        // @param image The image
+        // @param layout The current layout of the image
+        // @param range The subresources the passes access
+        // @return The handle of the resource, used by FrameGraphAccess
+        uint32_t AddImage(vk::Image image, vk::ImageLayout layout,
+            const vk::ImageSubresourceRange &range = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1));
+
+        // @brief Replaces the image of a resource, e.g. the swapchain image of the frame
+        // @param resource The handle of the image resource
+        // @param image The new image
+        // @param layout The current layout of the new image
+        void SetImage(uint32_t resource, vk::Image image, vk::ImageLayout layout);
+
+        // @brief Get the layout an image resource is in after the passes that were executed
+        vk::ImageLayout GetImageLayout(uint32_t resource) const                                             { return m_resources[resource].Layout; }
+
+        // @brief Adds a pass to the frame, passes are submitted in the order they are added
+        // @param name The name of the pass, used in the log
+        // @param queue The queue the pass runs on
+        // @param accesses All the resources the pass reads and writes, accesses to the same resource are combined into one
+        // @param record Records the commands of the pass, it is called by Execute()
+        void AddPass(const std::string &name, FrameGraphQueue queue, const std::vector<FrameGraphAccess> &accesses,
+            std::function<void(vk::CommandBuffer)> record);
+
+        // @brief Makes the first submission of the queue in the next Execute() wait on a semaphore
+        // @param queue The queue
+        // @param semaphore A binary (value is ignored) or timeline semaphore, e.g. the swapchain image acquire semaphore
+        // or upload_manager::GetTimelineSemaphore()
+        // @param value The timeline value that is waited for
+        // @param stages The stages that wait
+        void AddWait(FrameGraphQueue queue, vk::Semaphore semaphore, uint64_t value, vk::PipelineStageFlags2 stages);
+
+        // @brief Makes the last submission of the queue in the next Execute() signal a semaphore, e.g. for presenting
+        void AddSignal(FrameGraphQueue queue, vk::Semaphore semaphore, uint64_t value = 0,
+            vk::PipelineStageFlags2 stages = vk::PipelineStageFlagBits2::eAllCommands);
+
+        // @brief Computes the barriers and semaphore waits, records all the passes and submits them
+        // @note Blocks only if the command buffers of FramesInFlight frames ago are still in use
+        void Execute();
+
+        // @brief Get the timeline semaphore of a queue
+        vk::Semaphore GetTimelineSemaphore(FrameGraphQueue queue) const                                    { return m_queues[m_queue_index[(uint32_t)queue]].Timeline; }
+
+        // @brief Get the value the last submission of the queue signals, once it reached it the queue finished all the
+        // executed passes
+        uint64_t GetSignaledValue(FrameGraphQueue queue) const                                              { return m_queues[m_queue_index[(uint32_t)queue]].LastValue; }
+
+        // @brief Blocks until all the executed passes are finished
+        void WaitIdle();
+
+    private:
+
+        static constexpr uint32_t MAX_QUEUES = 3;
+
+        struct queue_data {
+
+            vk::Queue                                   Queue = nullptr;
+            uint32_t                                    Family = ~0U;
+            vk::Semaphore                               Timeline = nullptr;
+            uint64_t                                    LastValue = 0;
+            std::vector<vk::SemaphoreSubmitInfo>        ExternalWaits;
+            std::vector<vk::SemaphoreSubmitInfo>        ExternalSignals;
+        };
+
+        // a pass of the current frame, or the timeline value of a pass of an earlier frame
+        struct sync_point {
+
+            uint32_t                                    Pass = ~0U;
+            uint64_t                                    Value = 0;
+
+            bool IsSet() const                                                                              { return Pass != ~0U || Value != 0; }
+        };
+
+        struct resource_state {
+
+            vk::Image                                   Image = nullptr;
+            vk::ImageSubresourceRange                   Range = {};
+            vk::ImageLayout                             Layout = vk::ImageLayout::eUndefined;
+
+            // the last write, and which stages and accesses of its queue already see it
+            sync_point                                  Write = {};
+            uint32_t                                    WriteQueue = 0;
+            vk::PipelineStageFlags2                     WriteStages = {};
+            vk::AccessFlags2                            WriteAccess = {};
+            vk::PipelineStageFlags2                     VisibleStages = {};
+            vk::AccessFlags2                            VisibleAccess = {};
+
+            // the reads since the last write, per queue
+            std::array<sync_point, MAX_QUEUES>          Reads = {};
+            std::array<vk::PipelineStageFlags2, MAX_QUEUES> ReadStages = {};
+        };
+
+        struct pass_data {
+
+            std::string                                 Name;
+            uint32_t                                    Queue = 0;
+            std::vector<FrameGraphAccess>               Accesses;
+            std::function<void(vk::CommandBuffer)>      Record;
+
+            barrier_batch                               Barriers;
+            std::vector<std::pair<uint32_t, vk::PipelineStageFlags2>> WaitPasses;  // passes of other queues and the stages that wait on them
+            std::vector<vk::SemaphoreSubmitInfo>        WaitValues;                 // the same for passes of earlier frames
+            bool                                        EndsSegment = false;        // another queue waits on the pass
+            uint32_t                                    Segment = ~0U;
+        };
+
+        // one submission, the passes of a queue between two semaphore operations
+        struct segment_data {
+
+            uint32_t                                    Queue = 0;
+            uint64_t                                    Value = 0;
+            std::vector<uint32_t>                       Passes;
+            std::vector<vk::SemaphoreSubmitInfo>        Waits;
+            std::vector<vk::SemaphoreSubmitInfo>        Signals;
+            vk::CommandBuffer                           CommandBuffer = nullptr;
+        };
+
+        // the command buffers of one frame, they are reused once its values are reached
+        struct frame_slot {
+
+            std::array<vk::CommandPool, MAX_QUEUES>                     Pools = {};
+            std::array<std::vector<vk::CommandBuffer>, MAX_QUEUES>      CommandBuffers;
+            std::array<uint32_t, MAX_QUEUES>                            UsedCommandBuffers = {};
+            std::array<uint64_t, MAX_QUEUES>                            Values = {};
+        };
+
+        uint32_t add_resource(const resource_state &state);
+
+        void compile_pass(uint32_t passIndex);
+
+        void add_wait(pass_data &pass, const sync_point &point, uint32_t queue, vk::PipelineStageFlags2 stages);
+
+        void build_segments(std::vector<segment_data> &segments);
+
+        vk::CommandBuffer get_command_buffer(frame_slot &slot, uint32_t queue);
+
+        vk::Device                                              m_device;
+        std::vector<queue_data>                                 m_queues;
+        std::array<uint32_t, MAX_QUEUES>                        m_queue_index = {};         // FrameGraphQueue -> m_queues
+        std::vector<resource_state>                             m_resources;
+        std::vector<pass_data>                                  m_passes;
+        std::vector<frame_slot>                                 m_frames;
+        uint64_t                                                m_frame_count = 0;
+    };
+
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include "../../src/pch.h"
+
+// FORWARD DECLARATIONS ================================================================================================
+
+namespace vr {
+
+    class shader_record_table;
+
+    // CONSTANTS =======================================================================================================
+
+    // @brief The largest record offset an instance can use, vk::AccelerationStructureInstanceKHR only has 24 bits for it
+    static constexpr uint32_t MAX_INSTANCE_RECORD_OFFSET = (1u << 24) - 1;
+
+    // MACROS ==========================================================================================================
+
+    // TYPES ===========================================================================================================
+
+    // STATIC VARIABLES ================================================================================================
+
+    // FUNCTION DECLARATION ============================================================================================
+
+    // TEMPLATE DECLARATION ============================================================================================
+
+    // CLASS DECLARATION ===============================================================================================
+
+    // @brief Compiles the hit group records of the instances of a scene into a deduplicated hit group region
+    // @note Every instance adds the consecutive records its geometries (and ray types) use. Instances whose records
+    // have the same hit groups and the same data share them, AddInstance(...) returns the offset of the shared records,
+    // that goes into instanceShaderBindingTableRecordOffset. Scenes with many instances of few materials end up with a
+    // few records instead of one per instance, which keeps the SBT small for the caches and the uploads.
+    // Typical use:
+    //      hit_record_compiler compiler(sbtInfo.HitGroupRecordSize);
+    //      for (auto &object : objects)
+    //          instances[object.Index].setInstanceShaderBindingTableRecordOffset(compiler.AddInstance(object.HitGroup, &object.Material));
+    //      sbtInfo.HitGroupIndices = compiler.GetHitGroupIndices();
+    //      SBTBuffer sbt = device.CreateSBT(pipeline, sbtInfo);
+    //      shader_record_table records(device, sbt, ShaderGroup::HitGroup, false);    // no frame uses the new SBT yet
+    //      compiler.WriteRecords(records);
+    // @warning Not thread safe
+    class hit_record_compiler {
+    public:
+
+        // @brief Creates an empty compiler
+        // @param recordDataSize The size in bytes of the data of each record, SBTInfo::HitGroupRecordSize
+        hit_record_compiler(uint32_t recordDataSize);
+
+        // @brief Get the hit groups of the compiled records, put them into SBTInfo::HitGroupIndices
+        const std::vector<uint32_t>& GetHitGroupIndices() const                                             { return m_hit_group_indices; }
+
+        // @brief Get the data of the compiled records, GetRecordDataSize() bytes per record
+        const std::vector<uint8_t>& GetRecordData() const                                                   { return m_record_data; }
+
+        // @brief Get the size in bytes of the data of each record
+        uint32_t GetRecordDataSize() const                                                                  { return m_record_data_size; }
+
+        // @brief Get the number of compiled records
+        uint32_t GetRecordCount() const                                                                     { return static_cast<uint32_t>(m_hit_group_indices.size()); }
+
+        // @brief Get the number of records the instances added, including the ones that were deduplicated
+        uint64_t GetRequestedRecordCount() const                                                            { return m_requested_record_count; }
+
+        // @brief Adds the records of an instance
+        // @param hitGroupIndices The hit group of each record, the index of the group in the pipeline as in
+        // SBTInfo::HitGroupIndices
+        // @param data The data of the records, recordCount * GetRecordDataSize() bytes, can be nullptr if the data
+        // size is 0
+        // @param recordCount The number of records the instance uses, e.g. one per geometry
+        // @return The record offset of the instance, MAX_INSTANCE_RECORD_OFFSET + 1 if it doesn't fit into 24 bits
+        uint32_t AddInstance(const uint32_t *hitGroupIndices, const void *data, uint32_t recordCount);
+
+        // @brief Adds the record of an instance with one geometry, see AddInstance(const uint32_t*, const void*, uint32_t)
+        uint32_t AddInstance(uint32_t hitGroupIndex, const void *data)                                      { return AddInstance(&hitGroupIndex, data, 1); }
+
+        // @brief Writes the data of all the compiled records
+        // @param table A table of the hit group region of an SBT buffer that was created with GetHitGroupIndices()
+        // @return False if the region is too small for the records
+        bool WriteRecords(shader_record_table &table) const;
+
+        // @brief Removes all the records, e.g. before compiling the next version of the scene
+        void Clear();
+
+    private:
+
+        // consecutive compiled records that an instance references
+        struct record_span {
+
+            uint32_t                                            First = 0;
+            uint32_t                                            Count = 0;
+        };
+
+        uint64_t hash_records(const uint32_t *hitGroupIndices, const uint8_t *data, uint32_t recordCount) const;
+
+        bool is_same_records(const record_span &span, const uint32_t *hitGroupIndices, const uint8_t *data) const;
+
+        uint32_t                                                m_record_data_size = 0;
+        std::vector<uint32_t>                                   m_hit_group_indices;
+        std::vector<uint8_t>                                    m_record_data;
+        std::unordered_multimap<uint64_t, record_span>          m_spans;                    // keyed by the hash of the records
+        uint64_t                                                m_requested_record_count = 0;
+    };
+
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include "../../src/pch.h"
+
+// FORWARD DECLARATIONS ================================================================================================
+
+namespace vr {
+
+    class vk_ray_device;
+
+    // CONSTANTS =======================================================================================================
+
+    // MACROS ==========================================================================================================
+
+    // TYPES ===========================================================================================================
+
+    // STATIC VARIABLES ================================================================================================
+
+    // FUNCTION DECLARATION ============================================================================================
+
+    // TEMPLATE DECLARATION ============================================================================================
+
+    // CLASS DECLARATION ===============================================================================================
+
+    // @brief A vk::PipelineCache that is loaded from and saved to a file, so pipelines that compiled in the previous
+    // run are not compiled again
+    // @note The file is memory mapped while the cache is created from it. It is only used if it was written by the same
+    // GPU (vendor and device ID) with the same driver (driver version, driver UUID and pipeline cache UUID), and if
+    // its data is intact, otherwise the cache starts empty. Saving writes a temporary file that replaces the old one
+    // with a rename, so a crash never leaves a half written cache behind.
+    // Typical use, right after the device is created:
+    //      pipeline_cache cache(device, "rt_pipelines.cache");
+    //      device.SetPipelineCache(cache.GetCache());          // used by all the pipeline functions from now on
+    // @warning The cache must be destroyed before the device
+    class pipeline_cache {
+    public:
+
+        // @brief Creates the cache from the file, or an empty cache if the file doesn't exist or doesn't match
+        // @param device The VkRay device
+        // @param path The file the cache is loaded from and saved to
+        pipeline_cache(vk_ray_device &device, const std::string &path);
+
+        // @brief Saves the cache and destroys it
+        ~pipeline_cache();
+
+        pipeline_cache(const pipeline_cache&) = delete;
+        pipeline_cache& operator=(const pipeline_cache&) = delete;
+
+        // @brief Get the cache, all threads can create pipelines with it at the same time
+        // @warning MergeThreadCaches() and Save() write to the cache, they must not run while a pipeline is created with it
+        vk::PipelineCache GetCache() const                                                                  { return m_cache; }
+
+        // @brief True if the cache was loaded from the file (warm start)
+        bool WasLoaded() const                                                                              { return m_loaded; }
+
+        // @brief Creates an empty, externally synchronized cache for one worker thread, that doesn't lock on every
+        // pipeline creation. Hand it back with Merge(...) when the thread is done.
+        // @note Requires the pipelineCreationCacheControl feature (vulkan_builder enables it)
+        [[nodiscard]] vk::PipelineCache CreateThreadCache();
+
+        // @brief Queues a thread cache for merging into the managed cache, it is merged and destroyed by the next
+        // MergeThreadCaches() or Save()
+        // @param threadCache The return value of CreateThreadCache(), no thread may use it anymore
+        // @note This function is thread safe, it doesn't touch the managed cache, so other threads may keep creating
+        // pipelines with GetCache()
+        void Merge(vk::PipelineCache threadCache);
+
+        // @brief Merges the queued thread caches into the managed cache and destroys them
+        // @warning vkMergePipelineCaches writes to the managed cache, so no thread may create a pipeline with GetCache()
+        // while this function runs. Call it at a point where the pipeline creation is done, e.g. after the loading screen.
+        void MergeThreadCaches();
+
+        // @brief Merges the queued thread caches and writes the cache to the file
+        // @return False if the file couldn't be written, the old file is kept then
+        // @warning Same as MergeThreadCaches(), no thread may create a pipeline with GetCache() meanwhile. It is called
+        // by the destructor.
+        bool Save();
+
+    private:
+
+        // precedes the data of vkGetPipelineCacheData in the file
+        struct file_header {
+
+            uint32_t                            Magic = 0;
+            uint32_t                            Version = 0;
+            uint32_t                            VendorID = 0;
+            uint32_t                            DeviceID = 0;
+            uint32_t                            DriverVersion = 0;
+            uint32_t                            Padding = 0;
+            uint8_t                             DriverUUID[VK_UUID_SIZE] = {};
+            uint8_t                             PipelineCacheUUID[VK_UUID_SIZE] = {};
+            uint64_t                            DataSize = 0;
+            uint64_t                            DataHash = 0;
+        };
+
+        file_header get_expected_header() const;
+
+        bool validate(const uint8_t *fileData, size_t fileSize) const;
+
+        // merges the queued thread caches, m_mutex must be locked
+        void merge_thread_caches();
+
+        vk::Device                                              m_device;
+        std::string                                             m_path;
+        vk::PhysicalDeviceProperties                            m_properties;
+        std::array<uint8_t, VK_UUID_SIZE>                       m_driver_uuid = {};
+        vk::PipelineCache                                       m_cache = nullptr;
+        bool                                                    m_loaded = false;
+        std::vector<vk::PipelineCache>                          m_thread_caches;            // queued by Merge(...)
+        std::mutex                                              m_mutex;                    // guards m_thread_caches and Save()
+    };
+
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include "../../src/pch.h"
+
+#include "VkRay/SBT.h"
+
+// FORWARD DECLARATIONS ================================================================================================
+
+namespace vr {
+
+    class vk_ray_device;
+
+    // CONSTANTS =======================================================================================================
+
+    // MACROS ==========================================================================================================
+
+    // TYPES ===========================================================================================================
+
+    // @brief Writes the shader records of a freshly created SBT buffer, e.g. with vk_ray_device::WriteToSBT(...)
+    // @note Called on a worker thread of vk_ray_device::GetThreadPool(), before the SBT buffer is used by any frame
+    using WriteRecordsFunc = std::function<void(SBTBuffer &sbtBuffer, const SBTInfo &sbtInfo)>;
+
+    // STATIC VARIABLES ================================================================================================
+
+    // FUNCTION DECLARATION ============================================================================================
+
+    // TEMPLATE DECLARATION ============================================================================================
+
+    // CLASS DECLARATION ===============================================================================================
+
+    // @brief Relinks a ray tracing pipeline in the background and swaps it in at a frame boundary
+    // @note Relink(...) hands the collections to a worker thread of vk_ray_device::GetThreadPool(). The worker creates
+    // the missing pipeline libraries, links the pipeline and creates a new SBT buffer, while the frames keep using the
+    // current pipeline. BeginFrame() swaps the finished pipeline in and retires the old pipeline and SBT buffer with
+    // vk_ray_device::RetireResource(...), so they are destroyed once the frames that use them are done. If Relink(...)
+    // is called again before the previous relink finished, the older one is dropped before it is ever used.
+    // Typical use:
+    //      relinker.Relink(collections, writeRecords);             // e.g. when a new material was streamed in
+    //      device.AdvanceFrame();                                  // once per frame
+    //      relinker.BeginFrame();
+    //      device.UploadSBT(relinker.GetSBT(), cmdBuf);              // only needed with SBTPlacement::DeviceLocal
+    //      device.DispatchRays(relinker.GetPipeline(), relinker.GetSBTInfo().PipelineStackSize, relinker.GetSBT(), width, height, 1, cmdBuf);
+    // @warning BeginFrame() and the getters must be called from the same thread, Relink(...) is thread safe
+    class pipeline_relinker {
+    public:
+
+        // @brief Creates the relinker, it has no pipeline until the first relink was swapped in
+        // @param device The VkRay device, it must outlive the relinker
+        // @param settings The settings of the libraries and the linked pipeline
+        // @param sbtInfo The shader record sizes, reserves and placement of the SBT buffers, the indices are ignored
+        // @param flags The flags of the libraries and the linked pipeline, default is eDescriptorBufferEXT
+        pipeline_relinker(vk_ray_device &device, const PipelineSettings &settings, const SBTInfo &sbtInfo,
+            vk::PipelineCreateFlags flags = vk::PipelineCreateFlagBits::eDescriptorBufferEXT);
+
+        // @brief Waits for the running relink and retires the pipeline and the SBT buffer
+        ~pipeline_relinker();
+
+        pipeline_relinker(const pipeline_relinker&) = delete;
+        pipeline_relinker& operator=(const pipeline_relinker&) = delete;
+
+        // @brief Get the current pipeline, nullptr until the first relink was swapped in
+        vk::Pipeline GetPipeline() const                                                                    { return m_active.Pipeline; }
+
+        // @brief Get the SBT buffer of the current pipeline
+        const SBTBuffer& GetSBT() const                                                                     { return m_active.SBT; }
+
+        // @brief Get the SBT buffer of the current pipeline, e.g. to write records or to upload a device local one
+        SBTBuffer& GetSBT()                                                                                 { return m_active.SBT; }
+
+        // @brief Get the SBT info of the current pipeline
+        const SBTInfo& GetSBTInfo() const                                                                   { return m_active.Info; }
+
+        // @brief Get the collections of the current pipeline, their libraries can be reused for the next relink
+        // @note The libraries the relinker compiled are destroyed with the relinker
+        const std::vector<RayTracingShaderCollection>& GetCollections() const                               { return m_active.Collections; }
+
+        // @brief Get the generation of the current pipeline, 0 until the first relink was swapped in
+        uint64_t GetGeneration() const                                                                      { return m_active.Generation; }
+
+        // @brief Queues a relink with new collections
+        // @param collections The collections of the new pipeline. Collections without a library (CollectionPipeline
+        // is nullptr) are compiled on the worker thread, the ones with a library are only linked.
+        // @param writeRecords Writes the shader records of the new SBT buffer, can be nullptr if the records only
+        // consist of the shader handles
+        // @return The generation of the new pipeline, GetGeneration() returns it once it is swapped in
+        // @note This function is thread safe and never blocks on the compilation
+        uint64_t Relink(std::vector<RayTracingShaderCollection> collections, WriteRecordsFunc writeRecords = nullptr);
+
+        // @brief Swaps in the last finished relink, call it once per frame before recording the ray dispatches
+        // @return True if a new pipeline was swapped in
+        bool BeginFrame();
+
+        // @brief True if a relink is queued or running
+        bool IsRelinking() const;
+
+        // @brief Blocks until the queued relinks are finished, BeginFrame() swaps them in
+        // @warning Must not be called from a job of vk_ray_device::GetThreadPool()
+        void WaitIdle();
+
+    private:
+
+        struct linked_pipeline {
+
+            vk::Pipeline                                Pipeline = nullptr;
+            SBTInfo                                     Info = {};
+            SBTBuffer                                   SBT = {};
+            std::vector<RayTracingShaderCollection>     Collections = {};
+            std::vector<vk::Pipeline>                   CreatedLibraries = {};  // compiled by the relinker for this pipeline
+            uint64_t                                    Generation = 0;
+        };
+
+        struct relink_request {
+
+            std::vector<RayTracingShaderCollection>     Collections = {};
+            WriteRecordsFunc                            WriteRecords = nullptr;
+            uint64_t                                    Generation = 0;
+        };
+
+        void relink_loop();
+
+        bool link(relink_request &request, linked_pipeline &outPipeline);
+
+        void destroy(linked_pipeline &pipeline);
+
+        void retire(linked_pipeline &pipeline);
+
+        vk_ray_device&                                          m_vr_device;
+        PipelineSettings                                        m_settings;
+        SBTInfo                                                 m_sbt_info;
+        vk::PipelineCreateFlags                                 m_flags;
+
+        mutable std::mutex                                      m_mutex;
+        std::condition_variable                                 m_idle;
+        std::optional<relink_request>                           m_queued;                   // only the newest request is kept
+        std::optional<linked_pipeline>                          m_ready;                    // finished, swapped in by BeginFrame()
+        bool                                                    m_running = false;
+        uint64_t                                                m_next_generation = 1;
+
+        linked_pipeline                                         m_active;                   // only used by the frame thread
+        std::vector<vk::Pipeline>                               m_libraries;                // compiled by the relinker, kept for GetCollections()
+    };
+
+}
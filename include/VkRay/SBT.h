@@ -7,6 +7,9 @@
 
 namespace vr
 {
+    /// @brief SBTInfo::PipelineStackSize of pipelines whose stack size wasn't computed, they use the default of the driver
+    static constexpr uint32_t DEFAULT_PIPELINE_STACK_SIZE = ~0U;
+
     /// @brief Enum that defines the type of shader in the shader binding table
     enum class ShaderGroup : uint8_t
     {
@@ -16,21 +19,79 @@ namespace vr
         Callable = 3
     };
 
+    /// @brief Enum that defines in which memory the shader binding table lives
+    enum class SBTPlacement : uint8_t
+    {
+        /// @brief The records are written straight into host visible memory, the device reads them from there.
+        /// Cheap to update, but on discrete GPUs every record fetch of a hit may go over PCIe.
+        HostVisible = 0,
+
+        /// @brief The records are written into a host copy and uploaded to device local memory with UploadSBT(...).
+        /// Only the changed records are uploaded again, so this is the better choice for big SBTs on discrete GPUs.
+        DeviceLocal = 1
+    };
+
     /// @brief Contains all shaders that will be used in a hit group of an SBT
     struct HitGroup
     {
         Shader ClosestHitShader = {};
         Shader AnyHitShader = {};
         Shader IntersectionShader = {};
+
+        /// @brief Specialization constants of all the shaders of the group, the constants of a shader take precedence.
+        /// Hit groups that only differ in these share their modules, only the specialized stages are compiled per group.
+        SpecializationConstants Specialization = {};
+    };
+
+    /// @brief The shader stages and shader groups of a collection
+    /// @note The stages point into the specialization storage, so this must be kept alive until the pipeline is created
+    struct ShaderStagesAndGroups
+    {
+        ShaderStagesAndGroups() = default;
+        ShaderStagesAndGroups(ShaderStagesAndGroups &&) = default;
+        ShaderStagesAndGroups &operator=(ShaderStagesAndGroups &&) = default;
+
+        /// @brief A copy would point into the storage of the original
+        ShaderStagesAndGroups(const ShaderStagesAndGroups &) = delete;
+        ShaderStagesAndGroups &operator=(const ShaderStagesAndGroups &) = delete;
+
+        std::vector<vk::PipelineShaderStageCreateInfo> Stages = {};
+        std::vector<vk::RayTracingShaderGroupCreateInfoKHR> Groups = {};
+
+        /// @brief The specialization infos the stages point to, deque keeps the addresses stable when growing
+        std::deque<vk::SpecializationInfo> SpecializationInfos = {};
+        std::deque<SpecializationConstants> SpecializationStorage = {};
     };
 
     /// @brief Structure that defines a Shader Binding Table that can be used to trace rays
     struct SBTBuffer
     {
-        allocated_buffer RayGenBuffer = {};
-        allocated_buffer MissBuffer = {};
-        allocated_buffer HitGroupBuffer = {};
-        allocated_buffer CallableBuffer = {};
+        /// @brief One buffer for all the shader types, the regions start at multiples of shaderGroupBaseAlignment
+        allocated_buffer Buffer = {};
+
+        /// @brief Where Buffer lives, see SBTInfo::Placement
+        SBTPlacement Placement = SBTPlacement::HostVisible;
+
+        /// @brief The host copy of Buffer, only used with SBTPlacement::DeviceLocal. All the writes go here.
+        std::vector<uint8_t> HostData = {};
+
+        /// @brief The bytes that were written since the last UploadSBT(...), for host visible buffers these are the
+        /// ranges that still have to be flushed, e.g. after writes through a shader_record_table
+        dirty_ranges DirtyRanges = {};
+
+        /// @brief Persistent staging buffer of UploadSBT(...), only used with SBTPlacement::DeviceLocal. It has one
+        /// slice of Buffer.Size bytes per frame in flight and is created by the first upload.
+        allocated_buffer Staging = {};
+
+        /// @brief The frame index of the last upload and the bytes of its staging slice that were used in that frame
+        uint64_t StagingFrame = 0;
+        vk::DeviceSize StagingUsed = 0;
+
+        /// @brief Byte offsets of the regions in Buffer, indexed by ShaderGroup
+        std::array<vk::DeviceSize, 4> Offsets = {};
+
+        /// @brief Bytes reserved for the regions in Buffer, including the reserved groups, indexed by ShaderGroup
+        std::array<vk::DeviceSize, 4> Capacities = {};
 
         /*
         Offsets define the start of the shader records in bytes.
@@ -79,6 +140,18 @@ namespace vr
 
         /// @brief The maximum size of the hit attribute in bytes in HitGroups
         uint32_t MaxHitAttributeSize = 0;
+
+        /// @brief The maximum depth of callable shaders calling callable shaders, used for the stack size. The default
+        /// matches the depth the driver assumes.
+        uint32_t MaxCallableDepth = 2;
+
+        /// @brief If true, the stack size of linked pipelines is computed from the stack sizes of their shader groups,
+        /// MaxRecursionDepth and MaxCallableDepth, and returned in SBTInfo::PipelineStackSize. Otherwise the driver uses
+        /// a worst case stack size, which lowers the occupancy. Pipelines that are created with a deferred operation
+        /// keep the default stack size, because the group stack sizes aren't known before the operation is finished.
+        /// @note The stack size is dynamic state of the pipeline then, pass SBTInfo::PipelineStackSize to
+        /// DispatchRays(...) or set it with setRayTracingPipelineStackSizeKHR before tracing rays
+        bool ComputeStackSize = true;
     };
 
     /// @brief Structure that defines the information needed to create a shader binding table
@@ -104,6 +177,14 @@ namespace vr
         uint32_t ReserveHitGroups = 0;
         uint32_t ReserveCallableGroups = 0;
 
+        /// @brief Where CreateSBT(...) puts the SBT buffer, device local SBTs have to be uploaded with UploadSBT(...)
+        SBTPlacement Placement = SBTPlacement::HostVisible;
+
+        /// @brief The stack size CreateRayTracingPipeline(...) computed for the pipeline, see
+        /// PipelineSettings::ComputeStackSize. DEFAULT_PIPELINE_STACK_SIZE if it wasn't computed.
+        /// @note Pass it to DispatchRays(...) together with the pipeline it was returned with
+        uint32_t PipelineStackSize = DEFAULT_PIPELINE_STACK_SIZE;
+
         /// Graph of how the shaders might be mixed in a full pipeline.
         /// The shaders can be mixed in any way, but this is just an example
 
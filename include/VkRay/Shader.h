@@ -18,6 +18,57 @@ namespace vr {
 
     // CLASS DECLARATION ===============================================================================================
 
+    // @brief Values of the specialization constants of a shader, the constants are folded in when the pipeline compiles
+    struct SpecializationConstants
+    {
+        std::vector<vk::SpecializationMapEntry> Entries = {};
+        std::vector<uint8_t> Data = {};
+
+        // @brief Sets a constant, the value is replaced if the constant is already set with the same size
+        // @param constantID The constant_id of the constant in the shader
+        // @param value The value, e.g. VkBool32 for bool constants
+        template <typename T>
+        void Set(uint32_t constantID, const T &value) {
+
+            static_assert(std::is_trivially_copyable_v<T>, "Specialization constants must be trivially copyable");
+            Set(constantID, &value, sizeof(T));
+        }
+
+        // @brief Sets a constant from raw bytes
+        void Set(uint32_t constantID, const void *value, size_t size) {
+
+            for (auto &entry : Entries) {
+
+                if (entry.constantID != constantID)
+                    continue;
+
+                if (entry.size == size) {
+
+                    memcpy(Data.data() + entry.offset, value, size);
+                    return;
+                }
+
+                // the size changed, so the old bytes are left unused
+                entry.offset = static_cast<uint32_t>(Data.size());
+                entry.size = size;
+                Data.insert(Data.end(), (const uint8_t *)value, (const uint8_t *)value + size);
+                return;
+            }
+
+            Entries.push_back(vk::SpecializationMapEntry(constantID, static_cast<uint32_t>(Data.size()), size));
+            Data.insert(Data.end(), (const uint8_t *)value, (const uint8_t *)value + size);
+        }
+
+        // @brief Sets all the constants of another set, e.g. to apply the constants of a hit group to its shaders
+        void Merge(const SpecializationConstants &other) {
+
+            for (auto &entry : other.Entries)
+                Set(entry.constantID, other.Data.data() + entry.offset, entry.size);
+        }
+
+        bool IsEmpty() const                                                                                { return Entries.empty(); }
+    };
+
     struct Shader
     {
         // Shader module handle
@@ -25,6 +76,18 @@ namespace vr {
 
         // If there are multiple entry points in the shader, this is the entry point that will be used, Default is "main"
         const char* EntryPoint = "main";
+
+        // Content hash of the SPIR-V, set by vk_ray_device::CreateShaderFromSPV(...), 0 if the module isn't cached
+        uint64_t Hash = 0;
+
+        // Set instead of Module when the device uses shader module identifiers, see vk_ray_device::SetShaderModuleIdentifiers(...)
+        const vk::PipelineShaderStageModuleIdentifierCreateInfoEXT* Identifier = nullptr;
+
+        // Specialization constants of this shader, permutations of one module only differ in these
+        SpecializationConstants Specialization = {};
+
+        // @brief True if the shader has a module or a module identifier
+        bool IsValid() const                                                                                { return Module || Identifier; }
     };
 
 }
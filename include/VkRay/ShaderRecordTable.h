@@ -0,0 +1,103 @@
+#pragma once
+
+#include "../../src/pch.h"
+
+#include "VkRay/SBT.h"
+
+// FORWARD DECLARATIONS ================================================================================================
+
+namespace vr {
+
+    class vk_ray_device;
+
+    // CONSTANTS =======================================================================================================
+
+    // MACROS ==========================================================================================================
+
+    // TYPES ===========================================================================================================
+
+    // STATIC VARIABLES ================================================================================================
+
+    // FUNCTION DECLARATION ============================================================================================
+
+    // TEMPLATE DECLARATION ============================================================================================
+
+    // CLASS DECLARATION ===============================================================================================
+
+    // @brief Writes the shader records of one region of an SBT buffer in bulk, e.g. per instance hit group records
+    // with material indices and buffer addresses
+    // @note The writes go straight to the mapped buffer (SBTPlacement::HostVisible) or to its host copy
+    // (SBTPlacement::DeviceLocal) and only mark the written bytes dirty in SBTBuffer::DirtyRanges. Flush(...) then
+    // flushes or uploads the dirty ranges at once, so thousands of records cost one copy per merged range instead of a
+    // map, copy and unmap each. The table holds no state of its own, so it is cheap to create every frame.
+    // Typical use, with an SBT buffer that was created with SBTPlacement::DeviceLocal:
+    //      shader_record_table records(device, sbt);
+    //      for (uint32_t i = 0; i < instanceCount; i++)
+    //          records.Write(i, materials[i]);
+    //      records.Flush(cmdBuf);                                  // once per frame, before DispatchRays(...)
+    // @warning Records that change every frame need SBTPlacement::DeviceLocal. With SBTPlacement::HostVisible the
+    // writes go straight into the memory the frames in flight are tracing with, so only write records that no
+    // submitted frame uses yet, e.g. when filling a new SBT buffer.
+    // @warning Not thread safe, and the SBT buffer must outlive the table
+    class shader_record_table {
+    public:
+
+        // @brief Creates a table for one region of the SBT buffer
+        // @param device The VkRay device that created the SBT buffer
+        // @param sbt The SBT buffer, its records are written by the table
+        // @param group The region of the SBT buffer, default is the hit groups
+        // @param perFrameWrites True if the records are rewritten while frames in flight use the SBT buffer, then the
+        // buffer must be device local and the table writes nothing otherwise
+        shader_record_table(vk_ray_device &device, SBTBuffer &sbt, ShaderGroup group = ShaderGroup::HitGroup, bool perFrameWrites = true);
+
+        // @brief Get the number of records in the region
+        uint32_t GetRecordCount() const                                                                     { return m_record_count; }
+
+        // @brief Get the number of bytes of a record that can be written, the part after the shader group handle
+        uint32_t GetRecordDataSize() const                                                                  { return m_record_data_size; }
+
+        // @brief Writes data to a record, the shader group handle isn't touched
+        // @param recordIndex The index of the record in the region
+        // @param data The data that will be written
+        // @param size The size of data in bytes
+        // @param offset The offset in bytes into the record data, e.g. to only update the material index
+        // @return False if the record or the data is out of bounds, nothing is written then
+        bool Write(uint32_t recordIndex, const void *data, uint32_t size, uint32_t offset = 0);
+
+        // @brief Writes a struct to a record, see Write(uint32_t, const void*, uint32_t, uint32_t)
+        template<typename T>
+        bool Write(uint32_t recordIndex, const T &data, uint32_t offset = 0)                                { return Write(recordIndex, &data, sizeof(T), offset); }
+
+        // @brief Writes the data of consecutive records, it is marked dirty as one range
+        // @param firstRecord The index of the first record that will be written
+        // @param recordCount The number of records that will be written
+        // @param data The data of the first record, the data of the next record starts dataStride bytes later
+        // @param dataSize The size in bytes of the data of each record
+        // @param dataStride The distance in bytes between the data of two records
+        // @return False if a record or the data is out of bounds, nothing is written then
+        bool WriteRange(uint32_t firstRecord, uint32_t recordCount, const void *data, uint32_t dataSize, uint32_t dataStride);
+
+        // @brief Writes a struct to each of the consecutive records, starting at firstRecord
+        template<typename T>
+        bool WriteRange(uint32_t firstRecord, const std::vector<T> &records)                                { return WriteRange(firstRecord, static_cast<uint32_t>(records.size()), records.data(), sizeof(T), sizeof(T)); }
+
+        // @brief Makes the written records visible to the device, call it once per frame after the writes
+        // @param cmdBuf The command buffer the upload of a device local SBT buffer is recorded to
+        // @return True if an upload was recorded, see vk_ray_device::UploadSBT(...)
+        bool Flush(vk::CommandBuffer cmdBuf);
+
+    private:
+
+        uint8_t *get_record(uint32_t recordIndex) const                                                     { return m_records + (vk::DeviceSize)recordIndex * m_stride; }
+
+        vk_ray_device&                                          m_vr_device;
+        SBTBuffer&                                              m_sbt;
+
+        uint8_t*                                                m_records = nullptr;        // the data of the first record, after its handle
+        vk::DeviceSize                                          m_records_offset = 0;       // offset of m_records in the buffer
+        vk::DeviceSize                                          m_stride = 0;
+        uint32_t                                                m_record_count = 0;
+        uint32_t                                                m_record_data_size = 0;
+    };
+
+}
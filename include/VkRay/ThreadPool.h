@@ -0,0 +1,64 @@
+#pragma once
+
+#include "../../src/pch.h"
+
+// FORWARD DECLARATIONS ================================================================================================
+
+namespace vr {
+
+    // CONSTANTS =======================================================================================================
+
+    // MACROS ==========================================================================================================
+
+    // TYPES ===========================================================================================================
+
+    // STATIC VARIABLES ================================================================================================
+
+    // FUNCTION DECLARATION ============================================================================================
+
+    // TEMPLATE DECLARATION ============================================================================================
+
+    // CLASS DECLARATION ===============================================================================================
+
+    // @brief A fixed set of worker threads that execute jobs in submission order
+    // @note VkRay uses it for work that can be spread across CPU cores, e.g. joining deferred host operations.
+    // Get the one of the device with vk_ray_device::GetThreadPool().
+    class thread_pool {
+    public:
+
+        // @brief Starts the worker threads
+        // @param threadCount The number of worker threads, if 0 the number of hardware threads is used
+        thread_pool(uint32_t threadCount = 0);
+
+        // @brief Finishes all the queued jobs and joins the worker threads
+        ~thread_pool();
+
+        thread_pool(const thread_pool&) = delete;
+        thread_pool& operator=(const thread_pool&) = delete;
+
+        // @brief Get the number of worker threads
+        uint32_t GetThreadCount() const                                                                     { return static_cast<uint32_t>(m_threads.size()); }
+
+        // @brief Queues a job, that is executed by the next free worker thread
+        // @param job The function that will be executed
+        // @note This function is thread safe, jobs can submit other jobs
+        void Submit(std::function<void()> job);
+
+        // @brief Blocks until all the queued jobs are finished
+        // @warning Must not be called from a job, it would wait for itself
+        void WaitIdle();
+
+    private:
+
+        void worker_loop();
+
+        std::vector<std::thread>                                m_threads;
+        std::deque<std::function<void()>>                       m_jobs;
+        std::mutex                                              m_mutex;
+        std::condition_variable                                 m_job_available;
+        std::condition_variable                                 m_idle;
+        uint32_t                                                m_active_jobs = 0;
+        bool                                                    m_stop = false;
+    };
+
+}
@@ -0,0 +1,167 @@
+#pragma once
+
+#include "../../src/pch.h"
+
+#include "VkRay/Buffer.h"
+#include "VkRay/builders/builders.h"
+
+// FORWARD DECLARATIONS ================================================================================================
+
+namespace vr {
+
+    class vk_ray_device;
+
+    // CONSTANTS =======================================================================================================
+
+    // MACROS ==========================================================================================================
+
+    // TYPES ===========================================================================================================
+
+    struct UploadManagerCreateInfo {
+
+        vk::DeviceSize          StagingSize = 64ull * 1024 * 1024;      // @brief Size of the staging ring buffer in bytes
+        vk::Queue               TransferQueue = nullptr;                // @brief The queue the copies are submitted to
+        uint32_t                TransferFamily = ~0U;                   // @brief The queue family of TransferQueue
+
+        // @brief The queue family that uses the uploaded buffers, e.g. the compute queue that builds the acceleration
+        // structures. If it differs from TransferFamily, the ownership of the uploaded ranges is transferred to it.
+        uint32_t                DstFamily = ~0U;
+
+        // @brief Fills the queues from the queues the vulkan_builder created
+        // @param queues The return value of vulkan_builder::GetQueues()
+        // @param dstFamily The queue family that uses the uploaded buffers, default is the graphics queue family
+        void SetQueues(const CommandQueues &queues, uint32_t dstFamily = ~0U) {
+
+            TransferQueue = queues.TransferQueue;
+            TransferFamily = queues.TransferIndex;
+            DstFamily = dstFamily == ~0U ? queues.GraphicsIndex : dstFamily;
+        }
+    };
+
+    // @brief The uploads of one upload_manager::Submit(), the destination queue waits on it before using the buffers
+    struct UploadBatch {
+
+        // @brief The value the timeline semaphore of the upload manager is signaled with, once the copies are done
+        // @note 0 if nothing was submitted
+        uint64_t                                TimelineValue = 0;
+
+        // @brief The acquire half of the queue family ownership transfer, empty if no transfer is needed
+        // @note Record them on the destination queue with upload_manager::RecordAcquireBarriers(...)
+        std::vector<vk::BufferMemoryBarrier>    AcquireBarriers = {};
+    };
+
+    // STATIC VARIABLES ================================================================================================
+
+    // FUNCTION DECLARATION ============================================================================================
+
+    // TEMPLATE DECLARATION ============================================================================================
+
+    // CLASS DECLARATION ===============================================================================================
+
+    // @brief Uploads data to device local buffers through a ring allocated staging buffer on the transfer queue
+    // @note All the uploads queued between two Submit() calls are recorded into one command buffer, with one
+    // vkCmdCopyBuffer per destination buffer that contains all its regions. Staging memory is reused as soon as the
+    // timeline semaphore shows that the copies reading it are done.
+    // Typical use:
+    //      uploader.Upload(vertexBuffer, 0, vertices.data(), vertexBytes);
+    //      UploadBatch batch = uploader.Submit();
+    //      uploader.RecordAcquireBarriers(batch, computeCmdBuf, vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, vk::AccessFlagBits::eShaderRead);
+    //      // submit computeCmdBuf waiting on uploader.GetTimelineSemaphore() with batch.TimelineValue
+    class upload_manager {
+    public:
+
+        // @brief Creates the staging buffer, the command pool and the timeline semaphore
+        // @param device The VkRay device, it must outlive the upload manager
+        // @param info The settings, the queues are required
+        // @note The device must have the timelineSemaphore feature enabled (vulkan_builder enables it)
+        upload_manager(vk_ray_device &device, const UploadManagerCreateInfo &info);
+
+        // @brief Waits for all the submitted uploads and destroys the resources
+        ~upload_manager();
+
+        upload_manager(const upload_manager&) = delete;
+        upload_manager& operator=(const upload_manager&) = delete;
+
+        // @brief Get the timeline semaphore that is signaled with UploadBatch::TimelineValue
+        vk::Semaphore GetTimelineSemaphore() const                                                          { return m_timeline; }
+
+        // @brief Get the size of the staging ring buffer in bytes
+        vk::DeviceSize GetStagingSize() const                                                               { return m_staging.Size; }
+
+        // @brief Queues a copy of data into the buffer, it is recorded by the next Submit()
+        // @param dst The destination buffer, it must have been created with eTransferDst usage
+        // @param dstOffset The offset in bytes into dst
+        // @param data The data, it is copied into the staging buffer right away, so it can be freed after the call
+        // @param size The size in bytes of data
+        // @return False if the destination range is out of bounds
+        // @note If the staging buffer is full, the queued uploads are submitted and the call blocks until the oldest
+        // uploads are finished. Uploads that are bigger than the staging buffer are split.
+        bool Upload(const allocated_buffer &dst, vk::DeviceSize dstOffset, const void *data, vk::DeviceSize size);
+
+        // @brief Submits all the queued uploads to the transfer queue
+        // @return The batch, that the users of the uploaded buffers have to wait on
+        UploadBatch Submit();
+
+        // @brief Records the acquire barriers of the batch to a command buffer of the destination queue family
+        // @param batch The return value of Submit()
+        // @param cmdBuf The command buffer, that must be submitted after waiting on the batch's timeline value
+        // @param dstStage The stage that reads the uploaded buffers
+        // @param dstAccess The access of that stage
+        void RecordAcquireBarriers(const UploadBatch &batch, vk::CommandBuffer cmdBuf, vk::PipelineStageFlags dstStage,
+            vk::AccessFlags dstAccess);
+
+        // @brief Get the last timeline value the transfer queue has finished
+        uint64_t GetCompletedValue() const;
+
+        // @brief Blocks until the transfer queue has finished the batch
+        // @param value The timeline value of the batch
+        // @param timeout The timeout in nanoseconds
+        // @return True if the batch is finished, false on timeout
+        bool Wait(uint64_t value, uint64_t timeout = UINT64_MAX);
+
+    private:
+
+        // a submission that is still reading its range of the staging ring
+        struct in_flight_batch {
+
+            vk::CommandBuffer                   CommandBuffer = nullptr;
+            uint64_t                            TimelineValue = 0;
+            vk::DeviceSize                      RingHead = 0;           // head of the ring after the batch, the new tail when it is done
+            vk::DeviceSize                      RingBytes = 0;          // bytes of the ring the batch used, including the wrap padding
+        };
+
+        // the regions of one destination buffer
+        struct pending_copy {
+
+            vk::Buffer                          Dst = nullptr;
+            std::vector<vk::BufferCopy>         Regions;
+        };
+
+        UploadBatch submit_locked();
+
+        bool allocate_staging(vk::DeviceSize size, vk::DeviceSize &outOffset);
+
+        void reclaim_finished(bool waitForOldest);
+
+        vk::CommandBuffer get_command_buffer();
+
+        vk_ray_device&                                          m_vr_device;
+        UploadManagerCreateInfo                                 m_info;
+        std::mutex                                              m_mutex;
+
+        allocated_buffer                                        m_staging = {};
+        vk::DeviceSize                                          m_head = 0;
+        vk::DeviceSize                                          m_tail = 0;
+        vk::DeviceSize                                          m_used = 0;
+        vk::DeviceSize                                          m_pending_bytes = 0;    // ring bytes of the queued uploads
+
+        vk::CommandPool                                         m_command_pool = nullptr;
+        std::vector<vk::CommandBuffer>                          m_free_command_buffers;
+        std::deque<in_flight_batch>                             m_in_flight;
+        std::vector<pending_copy>                               m_pending;
+
+        vk::Semaphore                                           m_timeline = nullptr;
+        uint64_t                                                m_next_value = 1;
+    };
+
+}
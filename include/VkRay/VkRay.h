@@ -1,10 +1,20 @@
 ﻿#pragma once
 
+#include "VkRay/AccelBuildQueue.h"
 #include "VkRay/AccelStruct.h"
+#include "VkRay/Barriers.h"
 #include "VkRay/Buffer.h"
+#include "VkRay/CommandAllocator.h"
 #include "VkRay/Descriptors.h"
+#include "VkRay/FrameGraph.h"
+#include "VkRay/HitRecordCompiler.h"
+#include "VkRay/PipelineCache.h"
+#include "VkRay/PipelineRelinker.h"
 #include "VkRay/SBT.h"
 #include "VkRay/Shader.h"
+#include "VkRay/ShaderRecordTable.h"
+#include "VkRay/ThreadPool.h"
+#include "VkRay/UploadManager.h"
 #include "VkRay/VkRay_device.h"
 
 #include "../../src/utils.h"
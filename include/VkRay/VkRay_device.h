@@ -3,9 +3,11 @@
 #include "../../src/pch.h"
 
 #include "VkRay/AccelStruct.h"
+#include "VkRay/Barriers.h"
 #include "VkRay/Descriptors.h"
 #include "VkRay/SBT.h"
 #include "VkRay/Shader.h"
+#include "VkRay/ThreadPool.h"
 
 #ifdef VULRAY_BUILD_DENOISERS
 #include "VkRay/Denoisers/DenoiserInterface.h"
@@ -14,6 +16,15 @@
 namespace vr
 {
 
+    struct host_build_state;
+    struct library_compile_state;
+    struct shader_module_entry;
+
+    // @note Thread safety: the functions that record to a command buffer (BuildBLAS(...), BuildTLAS(...),
+    // DispatchRays(...), BindDescriptorBuffer(...) and co.) only read the state of the device, so they can be called
+    // concurrently as long as every thread records to its own command buffer, e.g. one from command_allocator.
+    // Creating and destroying resources is thread safe too, VMA synchronizes internally. The setters are not, and
+    // objects that are passed in, e.g. a ManagedTLAS or a CompactionPipeline, must not be used by two threads at once.
     class vk_ray_device {
     public:
 
@@ -38,6 +49,25 @@ namespace vr
         // @warning If the pool is not created with the correct flags / memory types, then the allocations will fail.
         void SetVmaPool(VmaPool pool)                                                                       { m_current_pool = pool; }
 
+        // @brief Set the pipeline cache that the pipeline functions use when they are not given one
+        // @param cache The cache, e.g. pipeline_cache::GetCache(), can be nullptr to use no cache
+        void SetPipelineCache(vk::PipelineCache cache)                                                      { m_pipeline_cache = cache; }
+
+        // @brief Makes CreateShaderFromSPV(...) return shader module identifiers instead of shader modules
+        // @param enable If true, pipelines are created from the identifiers when the pipeline cache already contains
+        // them, modules are only created when the driver has to compile
+        // @note Requires the shaderModuleIdentifier feature (vulkan_builder::ShaderModuleIdentifiers). Only affects
+        // shaders that are created after the call.
+        void SetShaderModuleIdentifiers(bool enable)                                                        { m_use_module_identifiers = enable; }
+
+        // @brief Set the queue families that use the acceleration structures, e.g. the compute family of an
+        // accel_build_queue and the graphics family that traces them
+        // @param families The queue family indices, if two or more of them differ the buffers of the acceleration
+        // structures and of the arena blocks are created with vk::SharingMode::eConcurrent across them
+        // @note Only affects the buffers that are created after the call, so set it before creating acceleration
+        // structures and arenas
+        void SetAccelStructQueueFamilies(const std::vector<uint32_t> &families);
+
         // Getter Functions ===========================================================================================
 
         // @brief Get the Vulkan device handle
@@ -64,6 +94,18 @@ namespace vr
         // @brief Get the Descriptor Buffer properties of the physical device
         vk::PhysicalDeviceDescriptorBufferPropertiesEXT GetDescriptorBufferProperties() const               { return m_descriptor_buffer_properties; }
 
+        // @brief Get the Acceleration Structure features the physical device supports
+        // @note These are the supported features, not necessarily the ones that were enabled on the device
+        vk::PhysicalDeviceAccelerationStructureFeaturesKHR GetAccelerationStructureFeatures() const         { return m_accel_features; }
+
+        // @brief Get the distinct queue families the acceleration structure buffers are shared with, empty if they are
+        // exclusive, see SetAccelStructQueueFamilies(...)
+        const std::vector<uint32_t>& GetAccelStructQueueFamilies() const                                    { return m_accel_struct_families; }
+
+        // @brief Get the worker threads of VkRay, they are started on the first call
+        // @note The pool has one thread per hardware thread. It can be used for the application's own jobs too.
+        thread_pool& GetThreadPool();
+
         // @@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@
         // @@@@@@@@@@@@@@@@@@@@@@@ Command Buffer Functions @@@@@@@@@@@@@@@@@@@@@@@@@@@
         // @@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@
@@ -76,11 +118,53 @@ namespace vr
         // @param cmdBuf The command buffer that will be used to record the transition
         // @param srcStage The source pipeline stage, default is all commands
         // @param dstStage The destination pipeline stage, default is all commands
+        // @note Records one legacy barrier per call, barrier_batch::AddImageBarrier(...) records the transitions of
+        // several images with exact masks in one barrier
         void transition_image_layout(vk::CommandBuffer cmdBuf, vk::Image image, vk::ImageLayout oldLayout, vk::ImageLayout newLayout,
             const vk::ImageSubresourceRange& range = vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1),
             vk::PipelineStageFlags srcStage = vk::PipelineStageFlagBits::eAllGraphics,
             vk::PipelineStageFlags dstStage = vk::PipelineStageFlagBits::eAllCommands);
 
+        // @@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@
+        // @@@@@@@@@@@@@@@@@@@@@@@@@@@@ Frame Functions @@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@
+        // @@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@
+
+        // @brief Sets how many frames the GPU can be behind the CPU, default is 2
+        // @param count The number of frames in flight, resources retired with RetireResource(...) are destroyed
+        // after this many calls to AdvanceFrame()
+        void SetFramesInFlight(uint32_t count)                                                              { m_frames_in_flight = count; }
+
+        // @brief Get the number of frames in flight
+        uint32_t GetFramesInFlight() const                                                                  { return m_frames_in_flight; }
+
+        // @brief Get the index of the current frame, it is incremented by AdvanceFrame()
+        uint64_t GetFrameIndex() const                                                                      { return m_frame_index; }
+
+        // @brief Advances the frame index and destroys the retired resources that the GPU is done with
+        // @note Call this once per frame, after waiting for the fence of the frame that was submitted
+        // GetFramesInFlight() frames ago. Resources retired during frame N are destroyed when the frame index reaches
+        // N + GetFramesInFlight().
+        void AdvanceFrame();
+
+        // @brief Queues a function that destroys a resource once the GPU is done with the current frame
+        // @param destroyFunc The function that destroys the resource, it is called from AdvanceFrame() or
+        // FlushRetiredResources()
+        // @note This function is thread safe
+        void RetireResource(std::function<void()> destroyFunc);
+
+        // @brief Destroys the buffer once the GPU is done with the current frame
+        // @param buffer The buffer that will be destroyed
+        void RetireBuffer(const allocated_buffer &buffer);
+
+        // @brief Destroys the acceleration structure once the GPU is done with the current frame
+        // @param blas The acceleration structure that will be destroyed
+        void RetireBLAS(const BLASHandle &blas);
+
+        // @brief Destroys all the retired resources immediately
+        // @warning The device must be idle, or at least done with all the retired resources
+        // @note This is called when the VkRay device is destroyed
+        void FlushRetiredResources();
+
         // @@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@
         // @@@@@@@@@@@@@@@ Acceleration Structure Functions @@@@@@@@@@@@@@@@@@@@@@@@@@@
         // @@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@
@@ -96,6 +180,39 @@ namespace vr
         // @param cmdBuf The command buffer that will be used to record the build
         void BuildBLAS(const std::vector<BLASBuildInfo> &buildInfos, vk::CommandBuffer cmdBuf);
 
+        // @brief Splits the build infos into batches whose scratch memory fits into the budget
+        // @param buildInfos The build infos that will be scheduled, this should be the return value of CreateBLAS(...)
+        // @param scratchBudget The maximum size in bytes of the scratch memory a single batch may use
+        // @return The batches in build order. Every batch is a consecutive range of buildInfos
+        // @note A build info that alone needs more scratch memory than the budget is put into its own batch
+        [[nodiscard]] std::vector<BLASBatchStats> ScheduleBLASBatches(const std::vector<BLASBuildInfo> &buildInfos, vk::DeviceSize scratchBudget);
+
+        // @brief Builds any number of BLASes in batches that share ONE scratch buffer and records the builds to the
+        // command buffer
+        // @param buildInfos The build infos that will be built, this should be the return value of CreateBLAS(...)
+        // The scratch addresses of the build infos are overwritten.
+        // @param scratchBudget The maximum size in bytes of the scratch buffer that will be created
+        // @param cmdBuf The command buffer that will be used to record the builds
+        // @return The created scratch buffer and the statistics of every batch
+        // @note 1. The scratch buffer is created with the size of the biggest batch, so it is never bigger than needed.
+        // If a single build info needs more scratch memory than the budget, the scratch buffer is created big enough
+        // for it and a warning is logged.
+        // 2. A barrier is recorded between the batches, so that a batch doesn't overwrite the scratch memory that the
+        // previous batch is still using. The barrier does NOT make the built BLASes visible to the TLAS build, use
+        // AddAccelerationBuildBarrier(...) for that.
+        // @warning The returned scratch buffer must be destroyed by the user AFTER the command buffer execution
+        [[nodiscard]] BLASBatchBuildResult BuildBLASBatched(std::vector<BLASBuildInfo> &buildInfos, vk::DeviceSize scratchBudget, vk::CommandBuffer cmdBuf);
+
+        // @brief Builds any number of BLASes in batches that fit into the supplied scratch buffer and records the builds
+        // to the command buffer
+        // @param buildInfos The build infos that will be built, this should be the return value of CreateBLAS(...)
+        // The scratch addresses of the build infos are overwritten.
+        // @param scratchBuffer The scratch buffer that is reused by all the batches, its size is the budget
+        // @param cmdBuf The command buffer that will be used to record the builds
+        // @return The statistics of every batch and the build infos that were skipped, because they don't fit into
+        // the scratch buffer on their own
+        [[nodiscard]] BLASBatchBuildResult BuildBLASBatched(std::vector<BLASBuildInfo> &buildInfos, const allocated_buffer &scratchBuffer, vk::CommandBuffer cmdBuf);
+
         // @brief Updates the acceleration structure and returns the scratch buffer for building
         // @param updateInfo The information that will be used to update the acceleration structure
         // @return The build info that will be used to build the acceleration structure
@@ -117,6 +234,41 @@ namespace vr
         void BuildTLAS(TLASBuildInfo &buildInfo, const allocated_buffer &InstanceBuffer, uint32_t instanceCount,
                        vk::CommandBuffer cmdBuf);
 
+        // @brief Builds the acceleration structure from a slice of an instance ring and records the build to the
+        // command buffer
+        // @param buildInfo The build info, this should be the return value of CreateTLAS(...)
+        // @param slice The slice the instances were written to, see AcquireInstanceSlice(...)
+        // @param instanceCount The number of instances that were written to the slice
+        // @param cmdBuf The command buffer that will be used to record the build
+        // @note The written instances are flushed, in case the memory of the ring isn't host coherent
+        void BuildTLAS(TLASBuildInfo &buildInfo, const InstanceRingSlice &slice, uint32_t instanceCount, vk::CommandBuffer cmdBuf);
+
+        // @brief Creates a ring of instance buffers, one slice per frame in flight
+        // @param instancesPerSlice The number of instances that fit into a slice
+        // @param sliceCount The number of slices, if 0 GetFramesInFlight() slices are created
+        // @return The instance ring, the whole ring is one persistently mapped allocation
+        [[nodiscard]] InstanceRing CreateInstanceRing(uint32_t instancesPerSlice, uint32_t sliceCount = 0);
+
+        // @brief Returns the next slice of the ring, after waiting until the GPU is done reading it
+        // @param ring The instance ring
+        // @param timeout The timeout in nanoseconds for waiting on the guard of the slice
+        // @return The slice, its Instances pointer is null if the wait timed out or failed
+        // @note The wait only blocks if the GPU is still reading the slice, that was written SliceCount frames ago
+        [[nodiscard]] InstanceRingSlice AcquireInstanceSlice(InstanceRing &ring, uint64_t timeout = UINT64_MAX);
+
+        // @brief Guards the slice with the fence that is signaled when the submission reading it finished
+        // @note The fence is only waited on, never reset, so the usual per frame fence can be used. In that case
+        // acquire the next slice before resetting the fence of the frame, else the wait never finishes.
+        void GuardInstanceSlice(InstanceRing &ring, const InstanceRingSlice &slice, vk::Fence fence);
+
+        // @brief Guards the slice with the timeline semaphore value that is signaled when the submission reading it
+        // finished
+        void GuardInstanceSlice(InstanceRing &ring, const InstanceRingSlice &slice, vk::Semaphore timelineSemaphore, uint64_t value);
+
+        // @brief Destroys the buffer of the instance ring
+        // @warning The GPU must be done with all the slices
+        void DestroyInstanceRing(InstanceRing &ring);
+
         // @brief Updates the acceleration structure
         // @param oldTLAS The old acceleration structure that will be updated
         // @param oldBuildInfo The old build info that will be used to update the acceleration structure
@@ -131,6 +283,44 @@ namespace vr
         [[nodiscard]] std::pair<TLASHandle, TLASBuildInfo> UpdateTLAS(TLASHandle &oldTLAS, TLASBuildInfo &oldBuildInfo,
                                                                       bool destroyOld = true);
 
+        // @brief Creates a TLAS that keeps track of its instances and only uploads the changed ones
+        // @param info The settings of the managed TLAS
+        // @return The managed TLAS, it is empty until instances are added
+        [[nodiscard]] ManagedTLAS CreateManagedTLAS(const ManagedTLASCreateInfo &info);
+
+        // @brief Adds an instance to the managed TLAS
+        // @param tlas The managed TLAS
+        // @param instance The instance, its accelerationStructureReference is the device address of the BLAS
+        // @return The ID of the instance, that stays the same until the instance is removed
+        uint32_t AddTLASInstance(ManagedTLAS &tlas, const vk::AccelerationStructureInstanceKHR &instance);
+
+        // @brief Removes an instance from the managed TLAS, its ID may be reused by the next AddTLASInstance(...)
+        // @note The instance slot is masked out, so the TLAS can still be refit instead of rebuilt
+        // @warning A refit still reads the BLAS of the removed instance, so the BLAS must stay alive until the next
+        // rebuild, or it must be replaced by SetTLASInstance(...) before
+        void RemoveTLASInstance(ManagedTLAS &tlas, uint32_t instanceID);
+
+        // @brief Replaces the whole instance, e.g. to change the BLAS or the mask of it
+        void SetTLASInstance(ManagedTLAS &tlas, uint32_t instanceID, const vk::AccelerationStructureInstanceKHR &instance);
+
+        // @brief Changes the transform of an instance
+        void SetTLASInstanceTransform(ManagedTLAS &tlas, uint32_t instanceID, const vk::TransformMatrixKHR &transform);
+
+        // @brief Uploads the changed instances and records a refit or a rebuild of the TLAS to the command buffer
+        // @param tlas The managed TLAS
+        // @param cmdBuf The command buffer that will be used to record the upload and the build
+        // @return What was recorded, nothing is recorded if no instance changed
+        // @note 1. A rebuild is chosen when the instance count changed, when more than
+        // ManagedTLASCreateInfo::RebuildChangedFraction of the instances changed or moved too far since the last
+        // rebuild, or after ManagedTLASCreateInfo::MaxRefits refits.
+        // 2. If the TLAS had to grow, tlas.TLAS is a new acceleration structure, so its descriptor must be updated.
+        // The old one is retired with RetireResource(...).
+        // 3. A barrier for the trace rays / ray query stages is not recorded, that is up to the user.
+        TLASBuildMode BuildManagedTLAS(ManagedTLAS &tlas, vk::CommandBuffer cmdBuf);
+
+        // @brief Destroys the TLAS and the buffers of the managed TLAS
+        void DestroyManagedTLAS(ManagedTLAS &tlas);
+
         // @brief Creates a compaction request for the given BLASes
         // @param sourceBLAS The pointer to the BLASes that will be compacted supplied in a vector
         // @return The compaction request handle to call GetCompactionSizes(...) and CompactBLAS(...)
@@ -174,6 +364,88 @@ namespace vr
                                                           const std::vector<uint64_t> &sizes,
                                                           std::vector<BLASHandle *> oldBLAS, vk::CommandBuffer cmdBuf);
 
+        // @brief Queues the BLASes for automatic compaction and records the compacted size queries to the command buffer
+        // @param pipeline The compaction pipeline that will keep track of the compaction
+        // @param blas The BLASes that will be compacted, they must have been created with the eAllowCompaction flag
+        // @param cmdBuf The command buffer that will be used to record the queries, this should be the same command
+        // buffer the BLASes were built with, after the build
+        // @note A barrier is recorded before the queries, so the builds are finished before the sizes are queried.
+        // The queries are reset on the host, which needs the hostQueryReset feature (vulkan_builder enables it).
+        // @warning The BLASHandle pointers must stay valid until ProcessCompactions(...) replaced them
+        void QueueCompaction(CompactionPipeline &pipeline, const std::vector<BLASHandle *> &blas, vk::CommandBuffer cmdBuf);
+
+        // @brief Compacts all the queued BLASes whose compacted sizes are available and records the copies to the
+        // command buffer
+        // @param pipeline The compaction pipeline that contains the queued compactions
+        // @param cmdBuf The command buffer that will be used to record the compaction copies
+        // @return The number of BLASes that were replaced with their compacted version in this call
+        // @note 1. This function never waits for the GPU. Compactions whose sizes are not available yet, stay queued
+        // until a later call. Call it once per frame.
+        // 2. The BLASHandles given to QueueCompaction(...) are replaced in place and the original BLASes are retired
+        // with RetireBLAS(...), so they are destroyed once the GPU is done with them.
+        // 3. If the return value is not 0, the device addresses of the BLASes changed, so the instances that reference
+        // them have to be updated and the TLAS has to be rebuilt. A barrier is recorded after the copies, so the TLAS
+        // build can be recorded to the same command buffer.
+        uint32_t ProcessCompactions(CompactionPipeline &pipeline, vk::CommandBuffer cmdBuf);
+
+        // @brief Destroys the query pools of the compactions that are still queued in the pipeline
+        // @param pipeline The compaction pipeline that will be destroyed
+        void DestroyCompactionPipeline(CompactionPipeline &pipeline);
+
+        // @brief Creates an arena that sub-allocates acceleration structures from a few big buffers
+        // @param blockSize The size of each buffer of the arena, acceleration structures that are bigger get a buffer
+        // of their own
+        // @return The arena, set BLASCreateInfo::Arena to allocate BLASes from it
+        // @note BLASes that are compacted with ProcessCompactions(...) or the CompactBLAS(...) overload that replaces
+        // the old BLASes are allocated from the arena of the source BLAS.
+        [[nodiscard]] std::unique_ptr<AccelStructArena> CreateAccelStructArena(vk::DeviceSize blockSize = 64ull * 1024 * 1024);
+
+        // @brief Returns the memory usage of the arena
+        [[nodiscard]] AccelStructArenaStats GetAccelStructArenaStats(AccelStructArena &arena);
+
+        // @brief Moves BLASes out of the least used blocks of the arena into the other blocks and records the copies
+        // to the command buffer
+        // @param arena The arena that will be defragmented
+        // @param blas The BLASes that may be moved, BLASes that are not in the arena are ignored
+        // @param cmdBuf The command buffer that will be used to record the copies
+        // @return The number of BLASes that were moved
+        // @note 1. The BLASHandles are replaced in place and the originals are retired with RetireBLAS(...). When the
+        // last BLAS of a block is destroyed, the block is released.
+        // 2. If the return value is not 0, the device addresses of the BLASes changed, so the instances that reference
+        // them have to be updated and the TLAS has to be rebuilt.
+        // 3. Compacting into the arena also fills up the holes, so it is best to call this after the compactions.
+        uint32_t DefragmentAccelStructArena(AccelStructArena &arena, const std::vector<BLASHandle *> &blas, vk::CommandBuffer cmdBuf);
+
+        // @brief Destroys the arena and all its buffers
+        // @param arena The arena that will be destroyed, it is reset right away
+        // @note The arena is retired with RetireResource(...), so it is destroyed after the BLASes that were retired
+        // before (e.g. by DefragmentAccelStructArena(...)) and once the frames in flight are done with its blocks
+        // @warning All the acceleration structures of the arena must be destroyed or retired before
+        void DestroyAccelStructArena(std::unique_ptr<AccelStructArena> &arena);
+
+        // @brief Builds the BLASes on the host with a deferred host operation, that is joined by the worker threads
+        // of GetThreadPool()
+        // @param buildInfos The build infos, they must have been created with BuildType eHost
+        // @return A future that is ready once the build is done, with the result of the build
+        // @note 1. This function returns immediately, so the build overlaps other CPU work such as recording frames.
+        // 2. The host scratch memory is allocated internally and the build infos are copied, but the geometry data
+        // that GeometryData::HostAddresses point to must stay valid until the future is ready.
+        // 3. Requires the accelerationStructureHostCommands feature, see GetAccelerationStructureFeatures().
+        // @warning The BLASes must not be used by the device before the future is ready
+        [[nodiscard]] std::future<vk::Result> BuildBLASOnHost(const std::vector<BLASBuildInfo> &buildInfos);
+
+        // @brief Builds the TLAS on the host with a deferred host operation, that is joined by the worker threads
+        // of GetThreadPool()
+        // @param buildInfo The build info, it must have been created with BuildType eHost
+        // @param instances Host pointer to the vk::AccelerationStructureInstanceKHR array
+        // @param instanceCount Number of instances in the array
+        // @return A future that is ready once the build is done, with the result of the build
+        // @note 1. For host builds, vk::AccelerationStructureInstanceKHR::accelerationStructureReference must be the
+        // vk::AccelerationStructureKHR handle of the BLAS, not its device address.
+        // 2. The instances must stay valid until the future is ready.
+        [[nodiscard]] std::future<vk::Result> BuildTLASOnHost(TLASBuildInfo &buildInfo, const vk::AccelerationStructureInstanceKHR *instances,
+            uint32_t instanceCount);
+
         // @brief Creates a SINGLE scratch buffer for building acceleration structures and binds the scratch buffer to
         // the build infos
         // @param buildInfos The build infos that will be used to create the scratch buffer
@@ -244,6 +516,10 @@ namespace vr
         // @param cmdBuf The command buffer that will be used to record the barrier
         void AddAccelerationBuildBarrier(vk::CommandBuffer cmdBuf);
 
+        // @brief Adds the same barrier to a batch, so it is recorded together with the other barriers of the batch
+        // @param barriers The batch, e.g. the one that also transitions the output image for the trace
+        void AddAccelerationBuildBarrier(barrier_batch &barriers);
+
         // @brief Destroys the acceleration structure
         // @param accel The acceleration structures that will be destroyed
         void DestroyBLAS(std::vector<BLASHandle> &blas);
@@ -285,21 +561,23 @@ namespace vr
         // 2. By default VmaAllocationCreateInfo::usage is VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE, so the memory will be
         // allocated preferentially on the device. This can be overriden by specifying a VmaPool from where the memory
         // will be allocated.
+        // 3. Buffers with eAccelerationStructureStorageKHR usage are shared concurrently across the families of
+        // SetAccelStructQueueFamilies(...).
         [[nodiscard]] allocated_buffer create_buffer(vk::DeviceSize size, vk::BufferUsageFlags bufferUsage, VmaAllocationCreateFlags flags = 0,
             uint32_t alignment = 0,VmaPool pool = nullptr);
 
         // @brief Creates a buffer for storing the instances
         // @param instanceCount The number of instances that will be stored in the buffer (not byte size)
         // @return The created buffer
-        // @note The buffer is created with the VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT flag, so it is
-        // host writable. If you want it in device local memory, you should create a buffer with create_buffer(...) and
+        // @note The buffer is created with the VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT flag and is
+        // persistently mapped (allocated_buffer::MappedData), so it is host writable. If you want it in device local memory, you should create a buffer with create_buffer(...) and
         // copy the instance data to the device local buffer.
         [[nodiscard]] allocated_buffer CreateInstanceBuffer(uint32_t instanceCount);
 
         // @brief Creates a buffer for storing the scratch data and uses correct alignment / flags
         // @param size The size of the buffer
         // @return The created buffer
-        [[nodiscard]] allocated_buffer CreateScratchBuffer(uint32_t size);
+        [[nodiscard]] allocated_buffer CreateScratchBuffer(vk::DeviceSize size);
 
         // @brief Creates a buffer for storing the descriptor sets
         // @param layout The descriptor set layout that will be used to create the buffer
@@ -321,29 +599,72 @@ namespace vr
         // responsibility to check the sizes.
         void CopyData(allocated_buffer src, allocated_buffer dst, vk::DeviceSize size, vk::CommandBuffer cmdBuf);
 
+        // @brief Copies many regions from src to dst with a single vkCmdCopyBuffer
+        // @param src The source buffer
+        // @param dst The destination buffer
+        // @param regions The regions that will be copied, the offsets are in bytes
+        // @param cmdBuf The command buffer that will be used to record the copy
+        // @note For uploading through a managed staging buffer, see upload_manager
+        void CopyData(allocated_buffer src, allocated_buffer dst, const std::vector<vk::BufferCopy> &regions, vk::CommandBuffer cmdBuf);
+
         // @brief Uploads data to a buffer, via mapping the buffer and memcpy
         // @param alloc The buffer that will be updated, MUST be host visible when created
         // @param data The data that will be copied to the buffer
         // @param size The size in bytes of the data that will be copied to the buffer
         // @param offset The offset in bytes of the buffer that will be updated, default is 0
-        // @note If doing many memcpy operations, it is recommended to map the buffer once (via MapBuffer(...)) and
-        // memcpy to the mapped data This function maps and unmaps the buffer every time it is called, therefore, it is
-        // inefficient to call this function many times
+        // @note Persistently mapped buffers (allocated_buffer::MappedData) are written directly and only the written
+        // range is flushed. Other buffers are mapped and unmapped every time this function is called, so for many
+        // memcpy operations it is recommended to map the buffer once (via MapBuffer(...)) and memcpy to the mapped data
         // @warning Segfault if pointer and size are not valid / out of bounds.
         // VMA assertion if the buffer is not mappable.
         void UpdateBuffer(allocated_buffer alloc, void *data, const vk::DeviceSize size, uint32_t offset = 0);
 
+        // @brief Fills instances with multiple threads, the range is split into chunks that are written concurrently
+        // by the thread pool and the calling thread
+        // @param instances The destination, e.g. the Instances of an InstanceRingSlice or mapped instance buffer memory
+        // @param instanceCount The number of instances that are written
+        // @param writer Called once per chunk with (instances, first, count), it must write exactly the instances
+        // [first, first + count) of instances. It is called from multiple threads at the same time.
+        // @return The number of written instances, that can be passed to BuildTLAS(...)
+        // @note Chunks start at cache line boundaries, so as long as instances is cache line aligned (as the buffers of
+        // CreateInstanceBuffer(...) are), no two threads write to the same cache line. Small ranges are written on the
+        // calling thread only.
+        // @warning Blocks until all chunks are written, so it must not be called from a job of GetThreadPool()
+        uint32_t WriteInstances(vk::AccelerationStructureInstanceKHR *instances, uint32_t instanceCount, const InstanceWriter &writer);
+
+        // @brief Maps the instance buffer once, fills it with WriteInstances(...) and flushes the written range
+        // @param instanceBuffer The buffer, this should be the return value of CreateInstanceBuffer(...)
+        // @param instanceCount The number of instances that are written, clamped to the capacity of the buffer
+        // @param writer See WriteInstances(...)
+        // @return The number of written instances, that can be passed to BuildTLAS(...)
+        uint32_t WriteInstanceBuffer(allocated_buffer &instanceBuffer, uint32_t instanceCount, const InstanceWriter &writer);
+
+        // @brief Packs the instances into the instance buffer with PackInstances(...) on multiple threads
+        // @param instanceBuffer The buffer, this should be the return value of CreateInstanceBuffer(...)
+        // @param info The instances in structure of arrays layout
+        // @return The number of written instances, that can be passed to BuildTLAS(...)
+        uint32_t WriteInstanceBuffer(allocated_buffer &instanceBuffer, const InstancePackInfo &info);
+
         // @brief Maps the buffer and returns the mapped data
         // @param buffer The buffer that will be mapped
         // @return The mapped data
         // @note The buffer must have been created with the VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT flag
-        // or similar flags
+        // or similar flags. If it was created with VMA_ALLOCATION_CREATE_MAPPED_BIT, the persistent mapping is
+        // returned and nothing is mapped.
         [[nodiscard]] void *MapBuffer(allocated_buffer &buffer);
 
         // @brief Unmaps the buffer
         // @param buffer The buffer that will be unmapped
+        // @note A persistently mapped buffer stays mapped, it is only flushed if its memory isn't host coherent
         void UnmapBuffer(allocated_buffer &buffer);
 
+        // @brief Makes host writes to the buffer visible to the device
+        // @param buffer The buffer that was written to
+        // @param offset The offset in bytes of the written range
+        // @param size The size in bytes of the written range, default is the rest of the buffer
+        // @note Does nothing for host coherent memory, so it is cheap to call after every write
+        void FlushBuffer(const allocated_buffer &buffer, vk::DeviceSize offset = 0, vk::DeviceSize size = VK_WHOLE_SIZE);
+
         // @brief Destroys the buffer
         // @param buffer The buffer that will be destroyed
         void DestroyBuffer(allocated_buffer &buffer);
@@ -359,6 +680,8 @@ namespace vr
         // @brief Creates a shader object from SPIRV code
         // @param info The information that will be used to create the shader module
         // @return The created shader module
+        // @note The modules are cached by a content hash of the SPIRV code, so identical code shares one module that
+        // is reference counted by DestroyShader(...). This function is thread safe.
         [[nodiscard]] Shader CreateShaderFromSPV(const std::vector<uint32_t> &spv);
 
         // @brief Creates a shader module from SPIRV code
@@ -380,8 +703,12 @@ namespace vr
         // Useful if wanting to create a pipeline library and link the pipeline library to the pipeline.
         // @param info The ShaderBindingTable including the collection of shaders that will be used to create the
         // shader stages and shader groups
+        // @param useModuleIdentifiers If true, shaders that only have a module identifier are passed as identifiers,
+        // the pipeline must then be created with eFailOnPipelineCompileRequired. If false, their modules are created.
         // @return The shader stages and shader groups that are constructed from the ShaderBindingTable
-        [[nodiscard]] std::pair<std::vector<vk::PipelineShaderStageCreateInfo>, std::vector<vk::RayTracingShaderGroupCreateInfoKHR>> GetShaderStagesAndRayTracingGroups(const RayTracingShaderCollection &info);
+        // @note Stages with the same module, entry point and specialization constants are only added once, the groups
+        // reference the shared stage. There is still one group per shader, so the SBT indices don't change.
+        [[nodiscard]] ShaderStagesAndGroups GetShaderStagesAndRayTracingGroups(const RayTracingShaderCollection &info, bool useModuleIdentifiers = false);
 
         // @brief Creates a ray tracing pipeline
         // @param shaderCollection The shader collection that will be used to create the pipeline.
@@ -401,7 +728,7 @@ namespace vr
         // @param settings The settings that will be used to create the pipeline. All the pipelines in the
         // shaderCollections must have been created with the same settings.
         // @param flags The flags that will be used to create the pipeline, default is eDescriptorBufferEXT
-        // @param cache The pipeline cache that will be used to create the pipeline, default is nullptr
+        // @param cache The pipeline cache that will be used to create the pipeline, default is the one of SetPipelineCache(...)
         // @param deferredOp The deferred operation that will be used to create the pipeline, default is nullptr
         // @return The created ray tracing pipeline and the shader binding table info to create the shader binding
         // table
@@ -417,7 +744,7 @@ namespace vr
         // @param sbtInfoOld The old shader binding table info that will be used to create the new shader binding table
         // info
         // @param flags The flags that will be used to create the pipeline, default is eDescriptorBufferEXT
-        // @param cache The pipeline cache that will be used to create the pipeline, default is nullptr
+        // @param cache The pipeline cache that will be used to create the pipeline, default is the one of SetPipelineCache(...)
         // @param deferredOp The deferred operation that will be used to create the pipeline, default is nullptr
         // @return The created ray tracing pipeline and the shader binding table info to create the shader binding
         // table
@@ -437,15 +764,41 @@ namespace vr
         // @param shaderCollection The shader collection that will be used to create the pipeline library
         // @param settings The settings that will be used to create the pipeline library
         // @param flags The flags that will be used to create the pipeline library, default is eDescriptorBufferEXT
-        // @param cache The pipeline cache that will be used to create the pipeline library, default is nullptr
+        // @param cache The pipeline cache that will be used to create the pipeline library, default is the one of
+        // SetPipelineCache(...)
         // @param deferredOp The deferred operation that will be used to create the pipeline library, default is
         // nullptr
         // @return shaderCollection::CollectionPipeline is set to the created pipeline library
         void CreatePipelineLibrary(RayTracingShaderCollection &shaderCollection, PipelineSettings &settings, vk::PipelineCreateFlags flags = vk::PipelineCreateFlagBits::eDescriptorBufferEXT,
             vk::PipelineCache cache = nullptr, vk::DeferredOperationKHR deferredOp = nullptr);
 
-        // @brief Destroys the shader module
+        // @brief Creates the pipeline libraries of many collections in parallel, every library is a deferred operation
+        // that the worker threads of GetThreadPool() join
+        // @param shaderCollections The shader collections, shaderCollection::CollectionPipeline of each is set to its
+        // library, or nullptr if its creation failed
+        // @param settings The settings that will be used to create the pipeline libraries
+        // @param flags The flags that will be used to create the pipeline libraries, default is eDescriptorBufferEXT
+        // @param cache The pipeline cache, default is the one of SetPipelineCache(...)
+        // @return eSuccess, or the error of the first library that failed
+        // @note Blocks until all the libraries are created, the compile time scales with the number of CPU cores
+        // @warning Must not be called from a job of GetThreadPool(), the job would wait for the jobs queued behind it
+        [[nodiscard]] vk::Result CreatePipelineLibraries(std::vector<RayTracingShaderCollection> &shaderCollections, PipelineSettings &settings,
+            vk::PipelineCreateFlags flags = vk::PipelineCreateFlagBits::eDescriptorBufferEXT, vk::PipelineCache cache = nullptr);
+
+        // @brief Creates the pipeline libraries of the collections in parallel with CreatePipelineLibraries(...) and
+        // links them with CreateRayTracingPipeline(...)
+        // @param shaderCollections The shader collections, their libraries are kept, so they can be linked again with
+        // other collections later
+        // @param settings The settings that will be used to create the libraries and the pipeline
+        // @param flags The flags that will be used to create the libraries and the pipeline, default is eDescriptorBufferEXT
+        // @param cache The pipeline cache, default is the one of SetPipelineCache(...)
+        // @return The linked pipeline and the shader binding table info, the pipeline is nullptr if a library failed
+        [[nodiscard]] std::pair<vk::Pipeline, SBTInfo> CompileRayTracingPipeline(std::vector<RayTracingShaderCollection> &shaderCollections, PipelineSettings &settings,
+            vk::PipelineCreateFlags flags = vk::PipelineCreateFlagBits::eDescriptorBufferEXT, vk::PipelineCache cache = nullptr);
+
+        // @brief Destroys the shader module, cached modules are destroyed when their last shader is destroyed
         // @param shader The shader module that will be destroyed
+        // @note This function is thread safe for shaders of CreateShaderFromSPV(...)
         void DestroyShader(Shader &shader);
 
         // @@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@
@@ -462,8 +815,8 @@ namespace vr
         // @param items The descriptor items that will be used to update the descriptor buffer
         // @param type The type of the descriptor buffer
         // @param setIndexInBuffer The index of the descriptor set in the buffer, default is 0
-        // @param pMappedData The pointer to the mapped data of the buffer, if it is null, the buffer will be mapped
-        // and unmapped, default is nullptr
+        // @param pMappedData The pointer to the mapped data of the buffer, if it is null, the persistent mapping
+        // of the buffer is used (or the buffer is mapped and unmapped, if it has none), default is nullptr
         // @note For each element in the items vector, the buffer will be updated with the given data in
         // DescriptorItem::pImageViews/pResources pointer
         // @warning There can be a segmentation fault if the pointers in the DescriptorItem are not valid or the
@@ -476,8 +829,8 @@ namespace vr
         // @param item The descriptor item that will be used to update the descriptor buffer
         // @param type The type of the descriptor buffer
         // @param setIndexInBuffer The index of the descriptor set in the buffer, default is 0
-        // @param pMappedData The pointer to the mapped data of the buffer, if it is null, the buffer will be mapped
-        // and unmapped, default is nullptr
+        // @param pMappedData The pointer to the mapped data of the buffer, if it is null, the persistent mapping
+        // of the buffer is used (or the buffer is mapped and unmapped, if it has none), default is nullptr
         // @note For each element in the items vector, the buffer will be updated with the given data in
         // DescriptorItem::pImageViews/pResources pointer
         // @warning There can be a segmentation fault if the pointers in the DescriptorItem are not valid or the
@@ -490,8 +843,8 @@ namespace vr
         // @param itemIndex The index of the descriptor item in the layout -> DescriptorItem::p***[itemIndex]
         // @param type The type of the descriptor buffer
         // @param setIndexInBuffer The index of the descriptor set in the buffer, default is 0
-        // @param pMappedData The pointer to the mapped data of the buffer, if it is null, the buffer will be mapped
-        // and unmapped, default is nullptr
+        // @param pMappedData The pointer to the mapped data of the buffer, if it is null, the persistent mapping
+        // of the buffer is used (or the buffer is mapped and unmapped, if it has none), default is nullptr
         // @warning There can be a segmentation fault if the pointers in the DescriptorItem are not valid or the item
         // index is out of bounds
         void UpdateDescriptorBuffer(DescriptorBuffer &buffer, const DescriptorItem &item, uint32_t itemIndex, DescriptorBufferType type, uint32_t setIndexInBuffer = 0,
@@ -559,18 +912,34 @@ namespace vr
         // @param groupIndex The index of the shader group that will be written to
         // @param data The data that will be written to the shader record
         // @param dataSize The size of the data in bytes that will be written to the shader record
-        // @param mappedData The pointer to the mapped data of the SBT buffer, if it is null, the buffer will be mapped
-        // and unmapped, default is nullptr
+        // @param mappedData The pointer to the mapped data of the SBT buffer, if it is null, the persistent mapping
+        // of the buffer is used (or the buffer is mapped and unmapped, if it has none), default is nullptr
+        // @note With SBTPlacement::DeviceLocal the record is written to the host copy and mappedData is ignored, the
+        // record is marked dirty and uploaded by the next UploadSBT(...). With SBTPlacement::HostVisible the record is
+        // flushed right away, with or without mappedData.
         // @warning Segfault if any of the pointers are not valid or the data size if out of bounds
-        void WriteToSBT(SBTBuffer sbtBuf, ShaderGroup group, uint32_t groupIndex, void *data, uint32_t dataSize,
+        void WriteToSBT(SBTBuffer &sbtBuf, ShaderGroup group, uint32_t groupIndex, void *data, uint32_t dataSize,
                         void *mappedData = nullptr);
 
-        // @brief Creates a buffer for each shader type in the shader binding table
+        // @brief Records the upload of the dirty records of a device local SBT buffer
+        // @param buffer The SBT buffer, with SBTPlacement::HostVisible the dirty ranges are only flushed and nothing
+        // is recorded
+        // @param cmdBuf The command buffer that will be used to record the upload, outside of a render pass
+        // @return True if an upload was recorded
+        // @note Only the bytes written since the last upload are copied, through the staging slice of the current
+        // frame in SBTBuffer::Staging, so uploads allocate nothing after the first one. The slice is reused
+        // GetFramesInFlight() frames later, uploads that overflow it within one frame get a staging buffer of their
+        // own that is retired with the frame. Barriers against the ray dispatches before and after the upload are
+        // recorded as well. Call it once per frame after writing the records and before DispatchRays(...).
+        bool UploadSBT(SBTBuffer &buffer, vk::CommandBuffer cmdBuf);
+
+        // @brief Creates the SBT buffer, one buffer that contains the regions of all the shader types
         // @param pipeline The pipeline that will be used to create the SBT buffer
         // @param sbt The information about the shader binding table, must contain the indices of the shader groups in
         // the pipeline
-        // @return The SBT buffer object, which has buffers and vk::StridedDeviceAddressRegionKHR for each shader type
+        // @return The SBT buffer object, which has the buffer and vk::StridedDeviceAddressRegionKHR for each shader type
         // in the shader binding table ready to be used in dispatching rays.
+        // @note The handles of all the groups are fetched with one driver call
         [[nodiscard]] SBTBuffer CreateSBT(vk::Pipeline pipeline, const SBTInfo &sbt);
 
         // @brief Rebuilds the SBT buffer with the new shader binding table info
@@ -579,20 +948,33 @@ namespace vr
         // @param sbt The information about the shader binding table, must contain the indices of the shader groups in
         // the pipeline
         // @return True if the SBT buffer was rebuilt successfully, false otherwise, because the SBT buffer is not big
-        // enough to fit all the shaders in the shader binding table info, then the user should call CreateSBT(...) to
-        // create a new SBT buffer and reserve more space for the shaders.
+        // enough to fit all the shaders in the shader binding table info, then the user should call GrowSBT(...), or
+        // CreateSBT(...) to create a new SBT buffer and reserve more space for the shaders.
         // @note This function doesn't reallocate the SBT buffer, it just rewrites the new opaque handles to the
         // buffer. So you don't have to WriteToSBT(...) again after rebuilding the SBT buffer.
         bool RebuildSBT(vk::Pipeline pipeline, SBTBuffer &buffer, const SBTInfo &sbt);
 
+        // @brief Rebuilds the SBT buffer, and reallocates it with more room if the shaders don't fit
+        // @param pipeline The pipeline that will be used to rebuild the SBT buffer
+        // @param buffer The SBT buffer that will be rebuilt, it can be empty, then it is created
+        // @param sbt The information about the shader binding table, must contain the indices of the shader groups in
+        // the pipeline
+        // @return True if the SBT buffer was reallocated, then the regions point to the new buffer
+        // @note The regions that don't fit grow to at least twice their capacity, so adding groups one by one costs
+        // amortized O(1). The records of the old buffer are copied to the new one on the host before this returns, so
+        // records can be written right away. Device local buffers are uploaded by the next UploadSBT(...). The old
+        // buffer is retired with the current frame, tables created with it have to be created again.
+        bool GrowSBT(vk::Pipeline pipeline, SBTBuffer &buffer, const SBTInfo &sbt);
+
         // @brief Copies the whole SBT from a buffer to another, including the opaque handles.
         // @param dst The SBT buffer that will be copied to
         // @param src The SBT buffer that will be copied from
-        // @note dst must have the same or bigger size than src for all the SBT buffers.
+        // @note dst must have the same or bigger capacity than src for all the shader types. The placements of the
+        // buffers may differ, a device local dst has to be uploaded with UploadSBT(...) afterwards.
         // @example SBT too small, so create a new SBT buffer with bigger size and copy the old SBT to the new one.
         // Then call RebuildSBT(...) to rewrite the opaque handles to the new SBT buffer, because SBT won't function
         // with the old opaque handles. You would want to do this, because it copies the shader records, so you don't
-        // have to call WriteToSBT(...) again for even the old shader records.
+        // have to call WriteToSBT(...) again for even the old shader records. GrowSBT(...) does all of this.
         void CopySBT(SBTBuffer &src, SBTBuffer &dst);
 
         // @brief Checks if the shaders can fit in the SBT buffer
@@ -608,12 +990,14 @@ namespace vr
 
         // @brief Dispatches the rays
         // @param rtPipeline The ray tracing pipeline that will be used to dispatch the rays
+        // @param stackSize The SBTInfo::PipelineStackSize that was returned with rtPipeline, it is set if it isn't
+        // DEFAULT_PIPELINE_STACK_SIZE, see PipelineSettings::ComputeStackSize
         // @param buffer The SBT buffer that contains the shader records
         // @param width The width of the image that will be used to dispatch the rays
         // @param height The height of the image that will be used to dispatch the rays
         // @param depth The depth of the image that will be used to dispatch the rays, default is 1
         // @param cmdBuf The command buffer that will be used to record the dispatch
-        void DispatchRays(const vk::Pipeline rtPipeline, const SBTBuffer &buffer, uint32_t width, uint32_t height, uint32_t depth, vk::CommandBuffer cmdBuf);
+        void DispatchRays(const vk::Pipeline rtPipeline, uint32_t stackSize, const SBTBuffer &buffer, uint32_t width, uint32_t height, uint32_t depth, vk::CommandBuffer cmdBuf);
 
         // @@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@@
         // @@@@@@@@@@@@@@@@@@@@@@@@@@@ Denoiser Functions @@@@@@@@@@@@@@@@@@@@@@@@@@@@@
@@ -642,9 +1026,109 @@ namespace vr
         vk::PhysicalDeviceRayTracingPipelinePropertiesKHR       m_ray_tracing_properties;
         vk::PhysicalDeviceAccelerationStructurePropertiesKHR    m_accel_properties;
         vk::PhysicalDeviceDescriptorBufferPropertiesEXT         m_descriptor_buffer_properties;
+        vk::PhysicalDeviceAccelerationStructureFeaturesKHR      m_accel_features;
         VmaAllocator                                            m_vma_allocator;
         bool                                                    m_user_supplied_allocator = false;
         VmaPool                                                 m_current_pool = nullptr;
+        std::vector<uint32_t>                                   m_accel_struct_families;    // concurrent sharing of the AS buffers, if 2 or more
+        vk::PipelineCache                                       m_pipeline_cache = nullptr;
+
+        std::mutex                                              m_shader_module_mutex;
+        std::unordered_multimap<uint64_t, std::shared_ptr<shader_module_entry>> m_shader_modules;   // by content hash
+        bool                                                    m_use_module_identifiers = false;
+
+
+        std::mutex                                              m_retire_mutex;
+        std::deque<std::pair<uint64_t, std::function<void()>>>  m_retired_resources;        // frame index when retired, destroy function
+        std::atomic<uint64_t>                                   m_frame_index = 0;
+        uint32_t                                                m_frames_in_flight = 2;
+
+        std::unique_ptr<thread_pool>                            m_thread_pool = nullptr;
+        std::once_flag                                          m_thread_pool_once;
+
+        // @brief Builds the stage of a shader, the module of an identifier only shader is created if needed
+        vk::PipelineShaderStageCreateInfo make_shader_stage(const Shader &shader, vk::ShaderStageFlagBits stage, bool useModuleIdentifiers);
+
+        // @brief Adds the stage of a shader, or returns the index of an identical stage that was added before
+        // @param groupConstants The specialization constants of the hit group, can be null
+        uint32_t add_shader_stage(ShaderStagesAndGroups &outStages, std::unordered_multimap<uint64_t, uint32_t> &stageLookup, const Shader &shader,
+            vk::ShaderStageFlagBits stage, const SpecializationConstants *groupConstants, bool useModuleIdentifiers);
+
+        // @brief Gets the module of a cached shader, it is created on first use if the shader only has an identifier
+        vk::ShaderModule get_cached_module(const Shader &shader);
+
+        // @brief Destroys the modules of the shaders that were never destroyed
+        void destroy_shader_modules();
+
+        // @brief Creates a pipeline from the stages of a collection, with module identifiers if they are enabled.
+        // Falls back to the modules if the driver has to compile the pipeline.
+        vk::ResultValue<vk::Pipeline> create_pipeline_from_collection(const RayTracingShaderCollection &collection,
+            vk::RayTracingPipelineCreateInfoKHR pipelineInfo, vk::PipelineCache cache, vk::DeferredOperationKHR deferredOp);
+
+        // @brief Gets the handles of all the groups the SBT info references with one driver call, tightly packed
+        std::vector<uint8_t> get_group_handles(vk::Pipeline pipeline, const SBTInfo &sbt);
+
+        // @brief Copies the record data of src to dst record by record on the host, the handles of dst are left untouched
+        void copy_sbt_records(SBTBuffer &src, SBTBuffer &dst);
+
+        // @brief Computes the stack size of a linked pipeline from the stack sizes of its groups, for DispatchRays(...)
+        uint32_t compute_stack_size(vk::Pipeline pipeline, const SBTInfo &sbtInfo, const PipelineSettings &settings);
+
+        // @brief Recreates the TLAS, instance buffer and scratch buffer of the managed TLAS with a bigger capacity
+        void resize_managed_tlas(ManagedTLAS &tlas, uint32_t capacity);
+
+        // @brief Creates a host visible buffer for an acceleration structure that is built on the host
+        allocated_buffer create_host_accel_struct_buffer(vk::DeviceSize size);
+
+        // @brief Joins a deferred operation on a worker thread until it has no more work for the thread
+        // @param activeJoiners Number of threads that still join the operation, decremented when this thread leaves
+        // @param outResult The result of the finished operation, only set if true is returned
+        // @return true in the last thread that leaves, the operation is finished and destroyed then
+        bool join_deferred_operation(vk::DeferredOperationKHR operation, std::atomic<uint32_t> &activeJoiners, vk::Result &outResult);
+
+        // @brief Starts the deferred host build and hands the deferred operation to the worker threads
+        std::future<vk::Result> launch_host_build(std::shared_ptr<host_build_state> state);
+
+        // @brief Joins the deferred operation of the host build, the last thread that leaves finishes the build
+        void join_host_build(std::shared_ptr<host_build_state> state);
+
+        // @brief Starts the deferred creation of a pipeline library and hands the deferred operation to the worker threads
+        std::future<vk::Result> launch_library_compile(std::shared_ptr<library_compile_state> state, vk::PipelineCache cache);
+
+        // @brief Joins the deferred operation of the library, the last thread that leaves finishes the library
+        void join_library_compile(std::shared_ptr<library_compile_state> state);
+
+        // @brief Hands the library to its collection, or destroys it if it failed
+        void finish_library_compile(library_compile_state &state, vk::Result result);
+
+        // @brief Creates a BLAS with the given size and records a copy from the source BLAS to it
+        // @param mode eCompact for compaction, eClone for moving the BLAS
+        // @param arena The arena the BLAS is allocated from, if null the BLAS gets its own buffer
+        // @param excludedBlocks Blocks of the arena that must not be used, can be null
+        BLASHandle create_blas_copy(vk::AccelerationStructureKHR source, vk::DeviceSize size, vk::CopyAccelerationStructureModeKHR mode,
+            AccelStructArena *arena, vk::CommandBuffer cmdBuf, const std::vector<bool> *excludedBlocks = nullptr);
+
+        // @brief Creates the memory for an acceleration structure, either in the arena or as its own buffer
+        // @param excludedBlocks Blocks of the arena that must not be used, can be null
+        // @return false if the memory couldn't be allocated
+        bool allocate_accel_struct_memory(vk::DeviceSize size, AccelStructArena *arena, allocated_buffer &outBuffer,
+            AccelStructArenaAllocation &outAllocation, const std::vector<bool> *excludedBlocks = nullptr);
+
+        // @brief Frees the memory of an acceleration structure, releases the arena block if it became empty
+        void free_accel_struct_memory(allocated_buffer &buffer, AccelStructArenaAllocation &allocation);
+
+        // @brief Destroys the blocks of an arena, called by the retired DestroyAccelStructArena(...)
+        void destroy_accel_struct_arena(AccelStructArena &arena);
+
+        // @brief Returns the scratch size of the build info for its build mode, aligned to the scratch offset alignment
+        vk::DeviceSize get_aligned_scratch_size(const BLASBuildInfo &buildInfo) const;
+
+        // @brief Records the batches of the build infos, the scratch buffer must be big enough for the biggest batch
+        void record_blas_batches(std::vector<BLASBuildInfo> &buildInfos, const std::vector<BLASBatchStats> &batches, const allocated_buffer &scratchBuffer,
+            vk::CommandBuffer cmdBuf);
+
+        // @brief Adds a barrier so the next acceleration structure build can reuse the scratch memory of the previous one
+        void add_scratch_reuse_barrier(vk::CommandBuffer cmdBuf);
     };
 
 }
@@ -79,9 +79,12 @@ namespace vr {
         [[nodiscard]] CommandQueues GetQueues();
 
         bool                                            EnableDebug = false;                    // Enables validation layers
+        bool                                            Headless = false;                       // No surface and no present support, pass nullptr to PickPhysicalDevice(...)
         std::vector<vk::ValidationFeatureEnableEXT>     ValidationFeatures;                     // Enables raytracing extensions
         bool                                            DedicatedCompute = false;               // Device creation will fail if the device does not support the needed dedicated queues
         bool                                            DedicatedTransfer = false;
+        bool                                            HostAccelerationStructureCommands = false;  // Requires host acceleration structure builds, most GPUs don't support them
+        bool                                            ShaderModuleIdentifiers = false;        // Requires VK_EXT_shader_module_identifier, see vk_ray_device::SetShaderModuleIdentifiers(...)
         VkPhysicalDeviceFeatures                        PhysicalDeviceFeatures10 = {};
         VkPhysicalDeviceVulkan11Features                PhysicalDeviceFeatures11 = {};
         VkPhysicalDeviceVulkan12Features                PhysicalDeviceFeatures12 = {};
@@ -0,0 +1,280 @@
+
+#include "pch.h"
+
+#include "VkRay/AccelBuildQueue.h"
+#include "VkRay/VkRay_device.h"
+
+// FORWARD DECLARATIONS ================================================================================================
+
+namespace vr {
+
+    // CONSTANTS =======================================================================================================
+
+    // MACROS ==========================================================================================================
+
+    // TYPES ===========================================================================================================
+
+    // STATIC VARIABLES ================================================================================================
+
+    // FUNCTION IMPLEMENTATION =========================================================================================
+
+    // CLASS IMPLEMENTATION ============================================================================================
+
+    accel_build_queue::accel_build_queue(vk_ray_device &device, const AccelBuildQueueCreateInfo &info)
+        : m_vr_device(device), m_info(info) {
+
+        if (!info.ComputeQueue || info.ComputeFamily == ~0U)
+            VR_LOG(error, "accel_build_queue: No compute queue was supplied");
+
+        // the graphics queue traces the acceleration structures without an ownership transfer
+        const auto &sharedFamilies = device.GetAccelStructQueueFamilies();
+        auto isShared = [&](uint32_t family) { return std::find(sharedFamilies.begin(), sharedFamilies.end(), family) != sharedFamilies.end(); };
+        if (info.GraphicsFamily != ~0U && info.GraphicsFamily != info.ComputeFamily && (!isShared(info.GraphicsFamily) || !isShared(info.ComputeFamily)))
+            VR_LOG(warning, "accel_build_queue: The compute and graphics families differ, call vk_ray_device::SetAccelStructQueueFamilies(...) with both before creating acceleration structures");
+
+        create_pool(m_tlas_recorder);
+
+        auto typeInfo = vk::SemaphoreTypeCreateInfo()
+            .setSemaphoreType(vk::SemaphoreType::eTimeline)
+            .setInitialValue(0);
+        m_timeline = device.GetDevice().createSemaphore(vk::SemaphoreCreateInfo().setPNext(&typeInfo));
+    }
+
+
+    accel_build_queue::~accel_build_queue() {
+
+        Wait(m_next_value - 1);
+
+        vk::Device device = m_vr_device.GetDevice();
+        for (auto &batch : m_in_flight)
+            for (auto &scratch : batch.Scratch)
+                m_vr_device.DestroyBuffer(scratch);
+
+        for (auto &[threadId, recorder] : m_recorders) {
+
+            if (recorder->Open)
+                VR_LOG(warning, "accel_build_queue: Destroyed with builds that were never submitted");
+
+            for (auto &scratch : recorder->Scratch)
+                m_vr_device.DestroyBuffer(scratch);
+            device.destroyCommandPool(recorder->Pool);
+        }
+
+        device.destroyCommandPool(m_tlas_recorder.Pool);
+        device.destroySemaphore(m_timeline);
+    }
+
+    // CLASS PUBLIC ====================================================================================================
+
+    uint64_t accel_build_queue::EnqueueBLAS(std::vector<BLASBuildInfo> buildInfos) {
+
+        if (buildInfos.empty())
+            return 0;
+
+        // every call gets its own scratch buffer, so the builds of the threads never overlap in scratch memory
+        allocated_buffer scratch = m_vr_device.CreateScratchBufferFromBuildInfos(buildInfos);
+
+        thread_recorder &recorder = get_recorder();
+        std::lock_guard<std::mutex> lock(recorder.Mutex);
+
+        if (!recorder.Open) {
+
+            recorder.Open = get_command_buffer(recorder);
+            recorder.Open.begin(vk::CommandBufferBeginInfo().setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+        }
+
+        m_vr_device.BuildBLAS(buildInfos, recorder.Open);
+        recorder.Scratch.push_back(scratch);
+
+        return recorder.OpenValue;
+    }
+
+
+    uint64_t accel_build_queue::EnqueueTLAS(const TLASBuildInfo &buildInfo, const allocated_buffer &instanceBuffer, uint32_t instanceCount) {
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_pending_tlas.push_back({buildInfo, instanceBuffer, instanceCount});
+        return m_next_value;
+    }
+
+
+    void accel_build_queue::AddWait(vk::Semaphore semaphore, uint64_t value) {
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_waits.push_back(vk::SemaphoreSubmitInfo(semaphore, value, vk::PipelineStageFlagBits2::eAccelerationStructureBuildKHR));
+    }
+
+
+    void accel_build_queue::AddUploadWait(const upload_manager &uploader, const UploadBatch &batch) {
+
+        if (batch.TimelineValue == 0)
+            return;
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_waits.push_back(vk::SemaphoreSubmitInfo(uploader.GetTimelineSemaphore(), batch.TimelineValue, vk::PipelineStageFlagBits2::eAccelerationStructureBuildKHR));
+
+        for (auto barrier : batch.AcquireBarriers)
+            m_acquire_barriers.push_back(barrier.setDstAccessMask(vk::AccessFlagBits::eShaderRead));
+    }
+
+
+    uint64_t accel_build_queue::Submit() {
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        // no thread can record while its command buffer is ended and the batch value changes
+        std::vector<std::unique_lock<std::mutex>> recorderLocks;
+        recorderLocks.reserve(m_recorders.size());
+        for (auto &[threadId, recorder] : m_recorders)
+            recorderLocks.emplace_back(recorder->Mutex);
+
+        reclaim_finished();
+
+        bool anyBLAS = std::any_of(m_recorders.begin(), m_recorders.end(), [](const auto &entry) { return entry.second->Open != nullptr; });
+        if (!anyBLAS && m_pending_tlas.empty())
+            return 0;
+
+        in_flight_batch batch = {};
+        batch.TimelineValue = m_next_value++;
+
+        std::vector<vk::CommandBufferSubmitInfo> commandBufferInfos;
+
+        // the uploaded buffers are acquired first, the submission order makes the barriers cover all the builds
+        if (!m_acquire_barriers.empty()) {
+
+            vk::CommandBuffer cmdBuf = get_command_buffer(m_tlas_recorder);
+            cmdBuf.begin(vk::CommandBufferBeginInfo().setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+            cmdBuf.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+                (vk::DependencyFlagBits)0, nullptr, m_acquire_barriers, nullptr);
+            cmdBuf.end();
+
+            commandBufferInfos.push_back(vk::CommandBufferSubmitInfo(cmdBuf));
+            batch.CommandBuffers.push_back({&m_tlas_recorder, cmdBuf});
+            m_acquire_barriers.clear();
+        }
+
+        for (auto &[threadId, recorder] : m_recorders) {
+
+            recorder->OpenValue = m_next_value;
+            if (!recorder->Open)
+                continue;
+
+            recorder->Open.end();
+            commandBufferInfos.push_back(vk::CommandBufferSubmitInfo(recorder->Open));
+            batch.CommandBuffers.push_back({recorder.get(), recorder->Open});
+            batch.Scratch.insert(batch.Scratch.end(), recorder->Scratch.begin(), recorder->Scratch.end());
+
+            recorder->Open = nullptr;
+            recorder->Scratch.clear();
+        }
+
+        // the TLAS builds come last, so one barrier makes all the BLASes visible to them
+        if (!m_pending_tlas.empty()) {
+
+            vk::CommandBuffer cmdBuf = get_command_buffer(m_tlas_recorder);
+            cmdBuf.begin(vk::CommandBufferBeginInfo().setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+
+            m_vr_device.AddAccelerationBuildBarrier(cmdBuf);
+            for (auto &pending : m_pending_tlas) {
+
+                batch.Scratch.push_back(m_vr_device.CreateScratchBufferFromBuildInfo(pending.BuildInfo));
+                m_vr_device.BuildTLAS(pending.BuildInfo, pending.InstanceBuffer, pending.InstanceCount, cmdBuf);
+            }
+
+            cmdBuf.end();
+            commandBufferInfos.push_back(vk::CommandBufferSubmitInfo(cmdBuf));
+            batch.CommandBuffers.push_back({&m_tlas_recorder, cmdBuf});
+            m_pending_tlas.clear();
+        }
+
+        auto signalInfo = vk::SemaphoreSubmitInfo(m_timeline, batch.TimelineValue, vk::PipelineStageFlagBits2::eAccelerationStructureBuildKHR);
+        auto submitInfo = vk::SubmitInfo2()
+            .setWaitSemaphoreInfos(m_waits)
+            .setCommandBufferInfos(commandBufferInfos)
+            .setSignalSemaphoreInfos(signalInfo);
+
+        m_info.ComputeQueue.submit2(submitInfo);
+
+        m_waits.clear();
+        m_in_flight.push_back(std::move(batch));
+        return m_in_flight.back().TimelineValue;
+    }
+
+
+    uint64_t accel_build_queue::GetCompletedValue() const              { return m_vr_device.GetDevice().getSemaphoreCounterValue(m_timeline); }
+
+
+    bool accel_build_queue::Wait(uint64_t value, uint64_t timeout) {
+
+        if (value == 0)
+            return true;
+
+        auto waitInfo = vk::SemaphoreWaitInfo()
+            .setSemaphores(m_timeline)
+            .setValues(value);
+
+        return m_vr_device.GetDevice().waitSemaphores(waitInfo, timeout) == vk::Result::eSuccess;
+    }
+
+    // CLASS PROTECTED =================================================================================================
+
+    // CLASS PRIVATE ===================================================================================================
+
+    accel_build_queue::thread_recorder& accel_build_queue::get_recorder() {
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto &recorder = m_recorders[std::this_thread::get_id()];
+        if (!recorder) {
+
+            recorder = std::make_unique<thread_recorder>();
+            recorder->OpenValue = m_next_value;
+            create_pool(*recorder);
+        }
+
+        return *recorder;
+    }
+
+
+    void accel_build_queue::create_pool(thread_recorder &recorder) {
+
+        recorder.Pool = m_vr_device.GetDevice().createCommandPool(vk::CommandPoolCreateInfo()
+            .setFlags(vk::CommandPoolCreateFlagBits::eResetCommandBuffer | vk::CommandPoolCreateFlagBits::eTransient)
+            .setQueueFamilyIndex(m_info.ComputeFamily));
+    }
+
+
+    vk::CommandBuffer accel_build_queue::get_command_buffer(thread_recorder &recorder) {
+
+        if (!recorder.Free.empty()) {
+
+            vk::CommandBuffer cmdBuf = recorder.Free.back();
+            recorder.Free.pop_back();
+            return cmdBuf;                                                                  // reset implicitly by begin()
+        }
+
+        return m_vr_device.GetDevice().allocateCommandBuffers(vk::CommandBufferAllocateInfo()
+            .setCommandPool(recorder.Pool)
+            .setLevel(vk::CommandBufferLevel::ePrimary)
+            .setCommandBufferCount(1))[0];
+    }
+
+
+    void accel_build_queue::reclaim_finished() {
+
+        // the callers hold the locks of all the recorders
+        uint64_t completed = GetCompletedValue();
+        while (!m_in_flight.empty() && m_in_flight.front().TimelineValue <= completed) {
+
+            in_flight_batch &batch = m_in_flight.front();
+            for (auto &[recorder, cmdBuf] : batch.CommandBuffers)
+                recorder->Free.push_back(cmdBuf);
+
+            for (auto &scratch : batch.Scratch)
+                m_vr_device.DestroyBuffer(scratch);
+
+            m_in_flight.pop_front();
+        }
+    }
+
+}
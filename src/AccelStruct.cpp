@@ -30,7 +30,7 @@ namespace vr
         {
             // Convert the geometries to the vulkan format
             outBuildInfo.Geometries[i] = vk::AccelerationStructureGeometryKHR()
-                                             .setGeometry(ConvertToVulkanGeometry(info.Geometries[i]))
+                                             .setGeometry(ConvertToVulkanGeometry(info.Geometries[i], info.BuildType))
                                              .setFlags(info.Geometries[i].Flags)
                                              .setGeometryType(info.Geometries[i].Type);
 
@@ -53,21 +53,33 @@ namespace vr
                                              .setPGeometries(outBuildInfo.Geometries.get())
                                              .setGeometryCount(outBuildInfo.GeometryCount);
 
+        outBuildInfo.BuildType = info.BuildType;
+
         // Get the size requirements for the acceleration structure
-        m_device.getAccelerationStructureBuildSizesKHR(vk::AccelerationStructureBuildTypeKHR::eDevice,
+        m_device.getAccelerationStructureBuildSizesKHR(info.BuildType,
                                                       &outBuildInfo.BuildGeometryInfo, maxPrimitiveCounts.data(),
                                                       &outBuildInfo.BuildSizes,
                                                       m_dyn_loader); // This will fill in the size requirements
 
-        // Create the buffer for the acceleration structure
-        outAccel.Buffer = create_buffer(outBuildInfo.BuildSizes.accelerationStructureSize,
-                                       // no flags for VMA
-                                       vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR, 0);
+        // Create the memory for the acceleration structure, either in the arena or as its own buffer
+        if (info.BuildType == vk::AccelerationStructureBuildTypeKHR::eHost)
+        {
+            if (info.Arena)
+                VR_LOG(warning, "CreateBLAS: Host built BLASes can't be allocated from an arena, because they need host visible memory");
+
+            outAccel.Buffer = create_host_accel_struct_buffer(outBuildInfo.BuildSizes.accelerationStructureSize);
+            if (!outAccel.Buffer.Buffer)
+                return std::make_pair(outAccel, outBuildInfo);
+        }
+        else if (!allocate_accel_struct_memory(outBuildInfo.BuildSizes.accelerationStructureSize, info.Arena,
+                                               outAccel.Buffer, outAccel.ArenaAllocation))
+            return std::make_pair(outAccel, outBuildInfo);
 
         // Create the acceleration structure
         auto createInfo = vk::AccelerationStructureCreateInfoKHR()
                               .setType(vk::AccelerationStructureTypeKHR::eBottomLevel)
                               .setBuffer(outAccel.Buffer.Buffer)
+                              .setOffset(outAccel.ArenaAllocation.Offset)
                               .setSize(outBuildInfo.BuildSizes.accelerationStructureSize);
 
         outAccel.AccelerationStructure = m_device.createAccelerationStructureKHR(createInfo, nullptr, m_dyn_loader);
@@ -101,6 +113,164 @@ namespace vr
                                               m_dyn_loader);
     }
 
+    std::vector<BLASBatchStats> vk_ray_device::ScheduleBLASBatches(const std::vector<BLASBuildInfo> &buildInfos,
+                                                                   vk::DeviceSize scratchBudget)
+    {
+        std::vector<BLASBatchStats> outBatches;
+        BLASBatchStats current = {};
+
+        for (uint32_t i = 0; i < buildInfos.size(); i++)
+        {
+            vk::DeviceSize scratchSize = get_aligned_scratch_size(buildInfos[i]);
+
+            // close the current batch if the build info doesn't fit into the budget anymore
+            if (current.BuildInfoCount > 0 && current.ScratchSize + scratchSize > scratchBudget)
+            {
+                outBatches.push_back(current);
+                current = {};
+            }
+
+            if (current.BuildInfoCount == 0)
+                current.FirstBuildInfo = i;
+
+            current.BuildInfoCount++;
+            current.ScratchSize += scratchSize;
+            for (uint32_t r = 0; r < buildInfos[i].RangesCount; r++)
+                current.PrimitiveCount += buildInfos[i].Ranges[r].primitiveCount;
+        }
+
+        if (current.BuildInfoCount > 0)
+            outBatches.push_back(current);
+
+        return outBatches;
+    }
+
+    BLASBatchBuildResult vk_ray_device::BuildBLASBatched(std::vector<BLASBuildInfo> &buildInfos,
+                                                         vk::DeviceSize scratchBudget, vk::CommandBuffer cmdBuf)
+    {
+        BLASBatchBuildResult outResult = {};
+        if (buildInfos.empty())
+            return outResult;
+
+        outResult.Batches = ScheduleBLASBatches(buildInfos, scratchBudget);
+
+        // the scratch buffer only needs to be as big as the biggest batch
+        vk::DeviceSize scratchSize = 0;
+        for (auto &batch : outResult.Batches)
+            scratchSize = std::max(scratchSize, batch.ScratchSize);
+
+        if (scratchSize > scratchBudget)
+            VR_LOG(warning, "BuildBLASBatched: A single BLAS needs {} bytes of scratch memory, which exceeds the budget of {} bytes",
+                scratchSize, scratchBudget);
+
+        outResult.ScratchBuffer = CreateScratchBuffer(scratchSize);
+        record_blas_batches(buildInfos, outResult.Batches, outResult.ScratchBuffer, cmdBuf);
+
+        return outResult;
+    }
+
+    BLASBatchBuildResult vk_ray_device::BuildBLASBatched(std::vector<BLASBuildInfo> &buildInfos,
+                                                         const allocated_buffer &scratchBuffer, vk::CommandBuffer cmdBuf)
+    {
+        BLASBatchBuildResult outResult = {};
+        outResult.ScratchBuffer = scratchBuffer;
+
+        // the start of the scratch buffer may be moved to satisfy the alignment, that memory can't be used
+        const vk::DeviceSize alignment = m_accel_properties.minAccelerationStructureScratchOffsetAlignment;
+        const vk::DeviceSize alignmentLoss = AlignUp((uint64_t)scratchBuffer.DevAddress, (uint64_t)alignment) - scratchBuffer.DevAddress;
+        const vk::DeviceSize budget = scratchBuffer.Size > alignmentLoss ? scratchBuffer.Size - alignmentLoss : 0;
+
+        // filter out the build infos that can never fit, the rest keep their order
+        std::vector<BLASBuildInfo> fittingInfos;
+        std::vector<uint32_t> fittingIndices;
+        fittingInfos.reserve(buildInfos.size());
+        fittingIndices.reserve(buildInfos.size());
+
+        for (uint32_t i = 0; i < buildInfos.size(); i++)
+        {
+            if (get_aligned_scratch_size(buildInfos[i]) > budget)
+            {
+                VR_LOG(error, "BuildBLASBatched: Build info {} needs more scratch memory than the scratch buffer has, skipping it", i);
+                outResult.SkippedBuildInfos.push_back(i);
+                continue;
+            }
+            fittingInfos.push_back(buildInfos[i]);
+            fittingIndices.push_back(i);
+        }
+
+        if (fittingInfos.empty())
+            return outResult;
+
+        outResult.Batches = ScheduleBLASBatches(fittingInfos, budget);
+        record_blas_batches(fittingInfos, outResult.Batches, scratchBuffer, cmdBuf);
+
+        // write the scratch addresses back and remap the batches to the indices of the supplied vector, the batches
+        // stay as they were recorded, skipped build infos inside of a batch are only listed in SkippedBuildInfos
+        for (uint32_t i = 0; i < fittingInfos.size(); i++)
+            buildInfos[fittingIndices[i]].BuildGeometryInfo.scratchData = fittingInfos[i].BuildGeometryInfo.scratchData;
+
+        for (auto &batch : outResult.Batches)
+            batch.FirstBuildInfo = fittingIndices[batch.FirstBuildInfo];
+
+        return outResult;
+    }
+
+    void vk_ray_device::record_blas_batches(std::vector<BLASBuildInfo> &buildInfos, const std::vector<BLASBatchStats> &batches,
+                                           const allocated_buffer &scratchBuffer, vk::CommandBuffer cmdBuf)
+    {
+        std::vector<vk::AccelerationStructureBuildRangeInfoKHR *> pBuildRangeInfos;
+        std::vector<vk::AccelerationStructureBuildGeometryInfoKHR> buildGeometryInfos;
+
+        for (uint32_t b = 0; b < batches.size(); b++)
+        {
+            const BLASBatchStats &batch = batches[b];
+
+            // every batch starts at the beginning of the scratch buffer again
+            vk::DeviceAddress scratchAddr = scratchBuffer.DevAddress;
+            pBuildRangeInfos.clear();
+            buildGeometryInfos.clear();
+
+            for (uint32_t i = batch.FirstBuildInfo; i < batch.FirstBuildInfo + batch.BuildInfoCount; i++)
+            {
+                BindScratchAdressToBuildInfo(scratchAddr, buildInfos[i]);
+                scratchAddr += get_aligned_scratch_size(buildInfos[i]);
+
+                pBuildRangeInfos.push_back(buildInfos[i].Ranges.get());
+                buildGeometryInfos.push_back(buildInfos[i].BuildGeometryInfo);
+            }
+
+            // the previous batch must be done with the scratch memory before this batch can use it
+            if (b > 0)
+                add_scratch_reuse_barrier(cmdBuf);
+
+            cmdBuf.buildAccelerationStructuresKHR(buildGeometryInfos.size(), buildGeometryInfos.data(),
+                                                  pBuildRangeInfos.data(), m_dyn_loader);
+        }
+    }
+
+    vk::DeviceSize vk_ray_device::get_aligned_scratch_size(const BLASBuildInfo &buildInfo) const
+    {
+        vk::DeviceSize scratchSize = buildInfo.BuildGeometryInfo.mode == vk::BuildAccelerationStructureModeKHR::eBuild
+                                         ? buildInfo.BuildSizes.buildScratchSize
+                                         : buildInfo.BuildSizes.updateScratchSize;
+
+        return AlignUp((uint64_t)scratchSize, (uint64_t)m_accel_properties.minAccelerationStructureScratchOffsetAlignment);
+    }
+
+    void vk_ray_device::add_scratch_reuse_barrier(vk::CommandBuffer cmdBuf)
+    {
+        // scratch memory is read and written by the build with the acceleration structure access flags
+        auto barrier = vk::MemoryBarrier()
+                           .setSrcAccessMask(vk::AccessFlagBits::eAccelerationStructureWriteKHR |
+                                             vk::AccessFlagBits::eAccelerationStructureReadKHR)
+                           .setDstAccessMask(vk::AccessFlagBits::eAccelerationStructureWriteKHR |
+                                             vk::AccessFlagBits::eAccelerationStructureReadKHR);
+
+        cmdBuf.pipelineBarrier(vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+                               vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, (vk::DependencyFlagBits)0, 1,
+                               &barrier, 0, nullptr, 0, nullptr);
+    }
+
     BLASBuildInfo vk_ray_device::UpdateBLAS(BLASUpdateInfo &updateInfo)
     {
         assert(updateInfo.NewGeometryAddresses.size() == updateInfo.SourceBuildInfo.GeometryCount &&
@@ -142,7 +312,7 @@ namespace vr
         }
 
         // Get the size requirements for the acceleration structure
-        m_device.getAccelerationStructureBuildSizesKHR(vk::AccelerationStructureBuildTypeKHR::eDevice,
+        m_device.getAccelerationStructureBuildSizesKHR(outBuildInfo.BuildType,
                                                       &outBuildInfo.BuildGeometryInfo, maxPrimitiveCounts.data(),
                                                       &outBuildInfo.BuildSizes,
                                                       m_dyn_loader); // This will fill in the size requirements
@@ -202,31 +372,10 @@ namespace vr
         {
             if (sizes[i] == 0)
                 continue;
-            // Create buffer
-            allocated_buffer compactBuffer =
-                create_buffer(sizes[i], vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR, 0);
 
-            // Create the compacted acceleration structure
-            auto createInfo = vk::AccelerationStructureCreateInfoKHR()
-                                  .setSize(sizes[i])
-                                  .setType(vk::AccelerationStructureTypeKHR::eBottomLevel)
-                                  .setBuffer(compactBuffer.Buffer);
-
-            auto compactAccel = m_device.createAccelerationStructureKHR(createInfo, nullptr, m_dyn_loader);
-
-            auto copyInfo = vk::CopyAccelerationStructureInfoKHR()
-                                .setSrc(request.SourceBLAS[i])
-                                .setDst(compactAccel)
-                                .setMode(vk::CopyAccelerationStructureModeKHR::eCompact);
-
-            cmdBuf.copyAccelerationStructureKHR(copyInfo, m_dyn_loader);
-
-            // Set the new acceleration structure
-            newBLASToReturn[i].AccelerationStructure = compactAccel;
-            newBLASToReturn[i].Buffer = compactBuffer;
-            auto addressInfo = vk::AccelerationStructureDeviceAddressInfoKHR().setAccelerationStructure(
-                newBLASToReturn[i].AccelerationStructure);
-            newBLASToReturn[i].Buffer.DevAddress = m_device.getAccelerationStructureAddressKHR(addressInfo, m_dyn_loader);
+            // Create the compacted acceleration structure and copy to it
+            newBLASToReturn[i] = create_blas_copy(request.SourceBLAS[i], sizes[i],
+                                                  vk::CopyAccelerationStructureModeKHR::eCompact, nullptr, cmdBuf);
         }
         return newBLASToReturn;
     }
@@ -241,39 +390,148 @@ namespace vr
         {
             if (sizes[i] == 0)
                 continue;
-            // Create buffer
-            allocated_buffer compactBuffer =
-                create_buffer(sizes[i], vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR, 0);
 
-            // Create the compacted acceleration structure
-            auto createInfo = vk::AccelerationStructureCreateInfoKHR()
-                                  .setSize(sizes[i])
-                                  .setType(vk::AccelerationStructureTypeKHR::eBottomLevel)
-                                  .setBuffer(compactBuffer.Buffer);
-
-            auto compactAccel = m_device.createAccelerationStructureKHR(createInfo, nullptr, m_dyn_loader);
-
-            auto copyInfo = vk::CopyAccelerationStructureInfoKHR()
-                                .setSrc(request.SourceBLAS[i])
-                                .setDst(compactAccel)
-                                .setMode(vk::CopyAccelerationStructureModeKHR::eCompact);
-
-            cmdBuf.copyAccelerationStructureKHR(copyInfo, m_dyn_loader);
+            // Create the compacted acceleration structure and copy to it
+            BLASHandle compactBLAS =
+                create_blas_copy(request.SourceBLAS[i], sizes[i], vk::CopyAccelerationStructureModeKHR::eCompact,
+                                 oldBLAS[i]->ArenaAllocation.Arena, cmdBuf);
 
             // store the old acceleration structure
-            oldBLASToReturn[i].AccelerationStructure = oldBLAS[i]->AccelerationStructure;
-            oldBLASToReturn[i].Buffer = oldBLAS[i]->Buffer;
+            oldBLASToReturn[i] = *oldBLAS[i];
             auto addressInfo = vk::AccelerationStructureDeviceAddressInfoKHR().setAccelerationStructure(
                 oldBLASToReturn[i].AccelerationStructure);
             oldBLASToReturn[i].Buffer.DevAddress = m_device.getAccelerationStructureAddressKHR(addressInfo, m_dyn_loader);
 
             // replace
-            oldBLAS[i]->AccelerationStructure = compactAccel;
-            oldBLAS[i]->Buffer = compactBuffer;
+            *oldBLAS[i] = compactBLAS;
         }
         return oldBLASToReturn;
     }
 
+    void vk_ray_device::QueueCompaction(CompactionPipeline &pipeline, const std::vector<BLASHandle *> &blas,
+                                        vk::CommandBuffer cmdBuf)
+    {
+        if (blas.empty())
+            return;
+
+        CompactionPipeline::PendingCompaction pending = {};
+        pending.Request = RequestCompaction(blas);
+        pending.Targets = blas;
+
+        uint32_t blasCount = pending.Request.SourceBLAS.size();
+
+        // the builds have to finish before the compacted sizes can be written
+        auto barrier = vk::MemoryBarrier()
+                           .setSrcAccessMask(vk::AccessFlagBits::eAccelerationStructureWriteKHR)
+                           .setDstAccessMask(vk::AccessFlagBits::eAccelerationStructureReadKHR);
+
+        cmdBuf.pipelineBarrier(vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
+                               vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, (vk::DependencyFlagBits)0, 1,
+                               &barrier, 0, nullptr, 0, nullptr);
+
+        // reset on the host, so ProcessCompactions(...) reads unavailable queries even before cmdBuf is submitted
+        m_device.resetQueryPool(pending.Request.CompactionQueryPool, 0, blasCount);
+        cmdBuf.writeAccelerationStructuresPropertiesKHR(pending.Request.SourceBLAS,
+                                                        vk::QueryType::eAccelerationStructureCompactedSizeKHR,
+                                                        pending.Request.CompactionQueryPool, 0, m_dyn_loader);
+
+        pipeline.Pending.push_back(std::move(pending));
+    }
+
+    uint32_t vk_ray_device::ProcessCompactions(CompactionPipeline &pipeline, vk::CommandBuffer cmdBuf)
+    {
+        uint32_t compactedCount = 0;
+
+        for (auto it = pipeline.Pending.begin(); it != pipeline.Pending.end();)
+        {
+            uint32_t blasCount = it->Request.SourceBLAS.size();
+
+            // no wait flag, so this returns eNotReady instead of stalling when the GPU hasn't written the sizes yet
+            auto [result, sizes] = m_device.getQueryPoolResults<uint64_t>(
+                it->Request.CompactionQueryPool, 0, blasCount, sizeof(uint64_t) * blasCount, sizeof(uint64_t),
+                vk::QueryResultFlagBits::e64);
+
+            if (result != vk::Result::eSuccess)
+            {
+                ++it;
+                continue;
+            }
+
+            for (uint32_t i = 0; i < blasCount; i++)
+            {
+                BLASHandle *target = it->Targets[i];
+
+                // the BLAS was replaced or destroyed since the compaction was queued, or compaction doesn't help
+                if (sizes[i] == 0 || target->AccelerationStructure != it->Request.SourceBLAS[i] ||
+                    sizes[i] >= target->Buffer.Size)
+                    continue;
+
+                BLASHandle compactBLAS =
+                    create_blas_copy(it->Request.SourceBLAS[i], sizes[i], vk::CopyAccelerationStructureModeKHR::eCompact,
+                                     target->ArenaAllocation.Arena, cmdBuf);
+                if (!compactBLAS.AccelerationStructure)
+                    continue;
+
+                pipeline.BytesSaved += target->Buffer.Size - sizes[i];
+                pipeline.CompactedCount++;
+                compactedCount++;
+
+                // the original may still be used by frames in flight and by the copy recorded above
+                RetireBLAS(*target);
+                *target = compactBLAS;
+            }
+
+            m_device.destroyQueryPool(it->Request.CompactionQueryPool);
+            it = pipeline.Pending.erase(it);
+        }
+
+        // make the compacted BLASes visible to the following TLAS builds
+        if (compactedCount > 0)
+            AddAccelerationBuildBarrier(cmdBuf);
+
+        return compactedCount;
+    }
+
+    void vk_ray_device::DestroyCompactionPipeline(CompactionPipeline &pipeline)
+    {
+        for (auto &pending : pipeline.Pending)
+            m_device.destroyQueryPool(pending.Request.CompactionQueryPool);
+
+        pipeline.Pending.clear();
+    }
+
+    BLASHandle vk_ray_device::create_blas_copy(vk::AccelerationStructureKHR source, vk::DeviceSize size,
+                                               vk::CopyAccelerationStructureModeKHR mode, AccelStructArena *arena,
+                                               vk::CommandBuffer cmdBuf, const std::vector<bool> *excludedBlocks)
+    {
+        BLASHandle outBLAS = {};
+
+        // Create the memory, either in the arena or as its own buffer
+        if (!allocate_accel_struct_memory(size, arena, outBLAS.Buffer, outBLAS.ArenaAllocation, excludedBlocks))
+            return outBLAS;
+
+        // Create the destination acceleration structure
+        auto createInfo = vk::AccelerationStructureCreateInfoKHR()
+                              .setSize(size)
+                              .setType(vk::AccelerationStructureTypeKHR::eBottomLevel)
+                              .setBuffer(outBLAS.Buffer.Buffer)
+                              .setOffset(outBLAS.ArenaAllocation.Offset);
+
+        outBLAS.AccelerationStructure = m_device.createAccelerationStructureKHR(createInfo, nullptr, m_dyn_loader);
+
+        auto copyInfo = vk::CopyAccelerationStructureInfoKHR()
+                            .setSrc(source)
+                            .setDst(outBLAS.AccelerationStructure)
+                            .setMode(mode);
+
+        cmdBuf.copyAccelerationStructureKHR(copyInfo, m_dyn_loader);
+
+        auto addressInfo = vk::AccelerationStructureDeviceAddressInfoKHR().setAccelerationStructure(outBLAS.AccelerationStructure);
+        outBLAS.Buffer.DevAddress = m_device.getAccelerationStructureAddressKHR(addressInfo, m_dyn_loader);
+
+        return outBLAS;
+    }
+
     allocated_buffer vk_ray_device::CreateScratchBufferFromBuildInfos(std::vector<BLASBuildInfo> &buildInfos)
     {
         uint32_t scratchSize = GetScratchBufferSize(buildInfos);
@@ -377,15 +635,20 @@ namespace vr
                 .setFirstVertex(0)
                 .setTransformOffset(0);
 
+        outBuildInfo.BuildType = info.BuildType;
+
         // Get the size requirements for the acceleration structure
         m_device.getAccelerationStructureBuildSizesKHR(
-            vk::AccelerationStructureBuildTypeKHR::eDevice, &outBuildInfo.BuildGeometryInfo,
+            info.BuildType, &outBuildInfo.BuildGeometryInfo,
             &info.MaxInstanceCount, // max number of instances/primitives in the geometry
             &outBuildInfo.BuildSizes, m_dyn_loader);
 
-        // Create the buffer for the acceleration structure
-        outAccel.Buffer = create_buffer(outBuildInfo.BuildSizes.accelerationStructureSize,
-                                       vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR, 0);
+        // Create the buffer for the acceleration structure, host builds write it with the CPU
+        if (info.BuildType == vk::AccelerationStructureBuildTypeKHR::eHost)
+            outAccel.Buffer = create_host_accel_struct_buffer(outBuildInfo.BuildSizes.accelerationStructureSize);
+        else
+            outAccel.Buffer = create_buffer(outBuildInfo.BuildSizes.accelerationStructureSize,
+                                           vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR, 0);
 
         // Create the acceleration structure
         auto createInfo = vk::AccelerationStructureCreateInfoKHR()
@@ -517,14 +780,15 @@ namespace vr
 
     void vk_ray_device::AddAccelerationBuildBarrier(vk::CommandBuffer cmdBuf)
     {
-        // accel build barrier for for next build
-        auto barrier = vk::MemoryBarrier()
-                           .setSrcAccessMask(vk::AccessFlagBits::eAccelerationStructureWriteKHR)
-                           .setDstAccessMask(vk::AccessFlagBits::eAccelerationStructureReadKHR);
+        barrier_batch barriers;
+        AddAccelerationBuildBarrier(barriers);
+        barriers.Flush(cmdBuf);
+    }
 
-        cmdBuf.pipelineBarrier(vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR,
-                               vk::PipelineStageFlagBits::eAccelerationStructureBuildKHR, (vk::DependencyFlagBits)0, 1,
-                               &barrier, 0, nullptr, 0, nullptr);
+    void vk_ray_device::AddAccelerationBuildBarrier(barrier_batch &barriers)
+    {
+        // accel build barrier for for next build
+        barriers.AddMemoryBarrier(ResourceAccess::AccelStructBuildWrite, ResourceAccess::AccelStructBuildRead);
     }
 
     void vk_ray_device::DestroyBLAS(std::vector<BLASHandle> &blas)
@@ -532,14 +796,14 @@ namespace vr
         for (auto &b : blas)
         {
             m_device.destroyAccelerationStructureKHR(b.AccelerationStructure, nullptr, m_dyn_loader);
-            DestroyBuffer(b.Buffer);
+            free_accel_struct_memory(b.Buffer, b.ArenaAllocation);
         }
     }
 
     void vk_ray_device::DestroyBLAS(BLASHandle &blas)
     {
         m_device.destroyAccelerationStructureKHR(blas.AccelerationStructure, nullptr, m_dyn_loader);
-        DestroyBuffer(blas.Buffer);
+        free_accel_struct_memory(blas.Buffer, blas.ArenaAllocation);
     }
 
     void vk_ray_device::DestroyTLAS(TLASHandle &tlas)
@@ -553,27 +817,38 @@ namespace vr
         m_device.destroyAccelerationStructureKHR(accel, nullptr, m_dyn_loader);
     }
 
-    vk::AccelerationStructureGeometryDataKHR ConvertToVulkanGeometry(const GeometryData &geom)
+    vk::AccelerationStructureGeometryDataKHR ConvertToVulkanGeometry(const GeometryData &geom,
+                                                                     vk::AccelerationStructureBuildTypeKHR buildType)
     {
         vk::AccelerationStructureGeometryDataKHR outGeom = {};
 
+        // host builds read the geometry through host pointers instead of device addresses
+        bool hostBuild = buildType == vk::AccelerationStructureBuildTypeKHR::eHost;
+        auto vertexData = hostBuild ? vk::DeviceOrHostAddressConstKHR(geom.HostAddresses.VertexData)
+                                    : vk::DeviceOrHostAddressConstKHR(geom.DataAddresses.VertexDevAddress);
+        auto indexData = hostBuild ? vk::DeviceOrHostAddressConstKHR(geom.HostAddresses.IndexData)
+                                   : vk::DeviceOrHostAddressConstKHR(geom.DataAddresses.IndexDevAddress);
+        auto transformData = hostBuild ? vk::DeviceOrHostAddressConstKHR(geom.HostAddresses.TransformData)
+                                       : vk::DeviceOrHostAddressConstKHR(geom.DataAddresses.TransformDevAddress);
+
         switch (geom.Type)
         {
         case vk::GeometryTypeKHR::eTriangles:
         {
             return outGeom.setTriangles(vk::AccelerationStructureGeometryTrianglesDataKHR()
                                             .setVertexFormat(geom.VertexFormat)
-                                            .setVertexData(geom.DataAddresses.VertexDevAddress)
+                                            .setVertexData(vertexData)
                                             .setVertexStride(geom.Stride)
                                             .setMaxVertex(geom.PrimitiveCount * 3) // 3 vertices per triangle
                                             .setIndexType(geom.IndexFormat)
-                                            .setIndexData(geom.DataAddresses.IndexDevAddress)
-                                            .setTransformData(geom.DataAddresses.TransformDevAddress));
+                                            .setIndexData(indexData)
+                                            .setTransformData(transformData));
         }
         case vk::GeometryTypeKHR::eAabbs:
         {
+            // the AABB data shares the union with the vertex data
             return outGeom.setAabbs(vk::AccelerationStructureGeometryAabbsDataKHR()
-                                        .setData(geom.DataAddresses.AABBDevAddress)
+                                        .setData(vertexData)
                                         .setStride(geom.Stride));
         }
         default:
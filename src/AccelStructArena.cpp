@@ -0,0 +1,284 @@
+
+#include "pch.h"
+
+#include "VkRay/AccelStruct.h"
+#include "VkRay/VkRay_device.h"
+
+namespace vr
+{
+    // acceleration structures must be placed at offsets that are a multiple of 256 bytes
+    static constexpr vk::DeviceSize ACCEL_STRUCT_OFFSET_ALIGNMENT = 256;
+
+    //--------------------------------------------------------------------------------------
+    // ARENA FUNCTIONS
+    //--------------------------------------------------------------------------------------
+
+    std::unique_ptr<AccelStructArena> vk_ray_device::CreateAccelStructArena(vk::DeviceSize blockSize)
+    {
+        auto outArena = std::make_unique<AccelStructArena>();
+
+        // blocks are created lazily, when the first acceleration structure doesn't fit anymore
+        outArena->BlockSize = AlignUp((uint64_t)blockSize, (uint64_t)ACCEL_STRUCT_OFFSET_ALIGNMENT);
+
+        return outArena;
+    }
+
+    AccelStructArenaStats vk_ray_device::GetAccelStructArenaStats(AccelStructArena &arena)
+    {
+        AccelStructArenaStats outStats = {};
+
+        std::lock_guard<std::mutex> lock(arena.Mutex);
+        for (auto &block : arena.Blocks)
+        {
+            if (block.VirtualBlock == nullptr)
+                continue;
+
+            VmaStatistics stats = {};
+            vmaGetVirtualBlockStatistics(block.VirtualBlock, &stats);
+
+            outStats.BlockCount++;
+            outStats.AllocationCount += stats.allocationCount;
+            outStats.TotalBytes += stats.blockBytes;
+            outStats.UsedBytes += stats.allocationBytes;
+        }
+
+        return outStats;
+    }
+
+    uint32_t vk_ray_device::DefragmentAccelStructArena(AccelStructArena &arena, const std::vector<BLASHandle *> &blas,
+                                                       vk::CommandBuffer cmdBuf)
+    {
+        // blocks that will be emptied, the moved BLASes must not be allocated from them
+        std::vector<bool> sourceBlocks;
+        bool anySourceBlock = false;
+        {
+            std::lock_guard<std::mutex> lock(arena.Mutex);
+
+            uint32_t blockCount = arena.Blocks.size();
+            sourceBlocks.resize(blockCount, false);
+
+            std::vector<VmaStatistics> stats(blockCount);
+            std::vector<uint32_t> liveBlocks;
+            vk::DeviceSize freeBytes = 0;
+            for (uint32_t i = 0; i < blockCount; i++)
+            {
+                if (arena.Blocks[i].VirtualBlock == nullptr)
+                    continue;
+
+                vmaGetVirtualBlockStatistics(arena.Blocks[i].VirtualBlock, &stats[i]);
+                freeBytes += stats[i].blockBytes - stats[i].allocationBytes;
+                liveBlocks.push_back(i);
+            }
+
+            // empty the least used blocks first, they need the fewest copies to be released
+            std::sort(liveBlocks.begin(), liveBlocks.end(), [&stats](uint32_t a, uint32_t b) {
+                return stats[a].allocationBytes < stats[b].allocationBytes;
+            });
+
+            // keep emptying blocks as long as the remaining blocks have enough free space for their content
+            for (uint32_t i = 0; i + 1 < liveBlocks.size(); i++)
+            {
+                const VmaStatistics &blockStats = stats[liveBlocks[i]];
+                vk::DeviceSize blockFreeBytes = blockStats.blockBytes - blockStats.allocationBytes;
+
+                if (blockStats.allocationBytes > freeBytes - blockFreeBytes)
+                    break;
+
+                freeBytes -= blockFreeBytes + blockStats.allocationBytes;
+                sourceBlocks[liveBlocks[i]] = true;
+                anySourceBlock = true;
+            }
+        }
+
+        if (!anySourceBlock)
+            return 0;
+
+        // the BLASes have to be built before they can be copied
+        AddAccelerationBuildBarrier(cmdBuf);
+
+        uint32_t movedCount = 0;
+        for (auto *target : blas)
+        {
+            const AccelStructArenaAllocation &allocation = target->ArenaAllocation;
+            if (allocation.Arena != &arena || allocation.BlockIndex >= sourceBlocks.size() ||
+                !sourceBlocks[allocation.BlockIndex])
+                continue;
+
+            // fragmentation can make the allocation fail even though there is enough free space, the BLAS stays then
+            BLASHandle movedBLAS = create_blas_copy(target->AccelerationStructure, target->Buffer.Size,
+                                                    vk::CopyAccelerationStructureModeKHR::eClone, &arena, cmdBuf,
+                                                    &sourceBlocks);
+            if (!movedBLAS.AccelerationStructure)
+                continue;
+
+            // the original may still be used by frames in flight and by the copy recorded above
+            // when the last BLAS of a source block is destroyed, the block is released
+            RetireBLAS(*target);
+            *target = movedBLAS;
+            movedCount++;
+        }
+
+        // make the moved BLASes visible to the following TLAS builds
+        if (movedCount > 0)
+            AddAccelerationBuildBarrier(cmdBuf);
+
+        return movedCount;
+    }
+
+    void vk_ray_device::DestroyAccelStructArena(std::unique_ptr<AccelStructArena> &arena)
+    {
+        if (!arena)
+            return;
+
+        // BLASes retired by defragmentation or compaction still point to the arena, and the frames in flight may still
+        // trace BLASes in its blocks. The retired resources are destroyed in order, so the arena goes after them.
+        std::shared_ptr<AccelStructArena> retiredArena(arena.release());
+        RetireResource([this, retiredArena]() { destroy_accel_struct_arena(*retiredArena); });
+    }
+
+    bool vk_ray_device::allocate_accel_struct_memory(vk::DeviceSize size, AccelStructArena *arena,
+                                                     allocated_buffer &outBuffer,
+                                                     AccelStructArenaAllocation &outAllocation,
+                                                     const std::vector<bool> *excludedBlocks)
+    {
+        outAllocation = {};
+
+        if (arena == nullptr)
+        {
+            outBuffer = create_buffer(size, vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR, 0);
+            return outBuffer.Buffer != nullptr;
+        }
+
+        VmaVirtualAllocationCreateInfo allocInfo = {};
+        allocInfo.size = size;
+        allocInfo.alignment = ACCEL_STRUCT_OFFSET_ALIGNMENT;
+
+        // the buffer of the block is shared, so the returned buffer doesn't own an allocation
+        auto bindToBlock = [&](uint32_t blockIndex) {
+            const AccelStructArenaBlock &block = arena->Blocks[blockIndex];
+            outAllocation.Arena = arena;
+            outAllocation.BlockIndex = blockIndex;
+
+            outBuffer = {};
+            outBuffer.Buffer = block.Buffer.Buffer;
+            outBuffer.DevAddress = block.Buffer.DevAddress + outAllocation.Offset;
+            outBuffer.Size = size;
+        };
+
+        std::lock_guard<std::mutex> lock(arena->Mutex);
+
+        uint32_t releasedBlock = arena->Blocks.size();
+        for (uint32_t i = 0; i < arena->Blocks.size(); i++)
+        {
+            AccelStructArenaBlock &block = arena->Blocks[i];
+            if (block.VirtualBlock == nullptr)
+            {
+                releasedBlock = std::min(releasedBlock, i);
+                continue;
+            }
+
+            if (excludedBlocks && i < excludedBlocks->size() && (*excludedBlocks)[i])
+                continue;
+
+            if (vmaVirtualAllocate(block.VirtualBlock, &allocInfo, &outAllocation.Allocation, &outAllocation.Offset) ==
+                VK_SUCCESS)
+            {
+                bindToBlock(i);
+                return true;
+            }
+        }
+
+        // defragmentation must not grow the arena
+        if (excludedBlocks)
+            return false;
+
+        // none of the blocks has space left, so create a new one
+        AccelStructArenaBlock newBlock = {};
+        vk::DeviceSize blockSize = std::max(arena->BlockSize, AlignUp((uint64_t)size, (uint64_t)ACCEL_STRUCT_OFFSET_ALIGNMENT));
+
+        newBlock.Buffer = create_buffer(blockSize, vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR, 0,
+                                        ACCEL_STRUCT_OFFSET_ALIGNMENT);
+        if (newBlock.Buffer.Buffer == nullptr)
+            return false;
+
+        VmaVirtualBlockCreateInfo blockInfo = {};
+        blockInfo.size = blockSize;
+        VkResult result = vmaCreateVirtualBlock(&blockInfo, &newBlock.VirtualBlock);
+        if (result == VK_SUCCESS)
+            result = vmaVirtualAllocate(newBlock.VirtualBlock, &allocInfo, &outAllocation.Allocation, &outAllocation.Offset);
+
+        if (result != VK_SUCCESS)
+        {
+            VR_LOG(error, "allocate_accel_struct_memory: Failed to allocate from a new arena block, result {}",
+                   vk::to_string((vk::Result)result));
+
+            if (newBlock.VirtualBlock)
+                vmaDestroyVirtualBlock(newBlock.VirtualBlock);
+            DestroyBuffer(newBlock.Buffer);
+            outAllocation = {};
+            return false;
+        }
+
+        // reuse the slot of a released block, so the block indices of the other allocations stay valid
+        if (releasedBlock < arena->Blocks.size())
+            arena->Blocks[releasedBlock] = newBlock;
+        else
+            arena->Blocks.push_back(newBlock);
+
+        bindToBlock(releasedBlock);
+        return true;
+    }
+
+    void vk_ray_device::free_accel_struct_memory(allocated_buffer &buffer, AccelStructArenaAllocation &allocation)
+    {
+        if (allocation.Arena == nullptr)
+        {
+            DestroyBuffer(buffer);
+            return;
+        }
+
+        AccelStructArena *arena = allocation.Arena;
+        std::lock_guard<std::mutex> lock(arena->Mutex);
+
+        AccelStructArenaBlock &block = arena->Blocks[allocation.BlockIndex];
+        vmaVirtualFree(block.VirtualBlock, allocation.Allocation);
+
+        // release empty blocks, but keep the last one, so the arena doesn't recreate it for every new BLAS
+        if (vmaIsVirtualBlockEmpty(block.VirtualBlock))
+        {
+            uint32_t liveBlockCount = std::count_if(arena->Blocks.begin(), arena->Blocks.end(),
+                                                    [](const AccelStructArenaBlock &b) { return b.VirtualBlock != nullptr; });
+            if (liveBlockCount > 1)
+            {
+                vmaDestroyVirtualBlock(block.VirtualBlock);
+                DestroyBuffer(block.Buffer);
+                block = {};
+            }
+        }
+
+        allocation = {};
+        buffer = {};
+    }
+
+    void vk_ray_device::destroy_accel_struct_arena(AccelStructArena &arena)
+    {
+        std::lock_guard<std::mutex> lock(arena.Mutex);
+
+        for (auto &block : arena.Blocks)
+        {
+            if (block.VirtualBlock == nullptr)
+                continue;
+
+            if (vmaIsVirtualBlockEmpty(block.VirtualBlock) == VK_FALSE)
+            {
+                VR_LOG(warning, "DestroyAccelStructArena: The arena still contains acceleration structures");
+                vmaClearVirtualBlock(block.VirtualBlock);
+            }
+
+            vmaDestroyVirtualBlock(block.VirtualBlock);
+            DestroyBuffer(block.Buffer);
+            block = {};
+        }
+    }
+
+} // namespace vr
@@ -0,0 +1,180 @@
+
+#include "pch.h"
+
+#include "VkRay/AccelStruct.h"
+#include "VkRay/VkRay_device.h"
+
+namespace vr
+{
+    /// @brief Everything a host build reads, it is kept alive until the deferred operation is finished
+    struct host_build_state
+    {
+        vk::DeferredOperationKHR Operation = nullptr;
+
+        std::vector<vk::AccelerationStructureBuildGeometryInfoKHR> GeometryInfos = {};
+        std::vector<const vk::AccelerationStructureBuildRangeInfoKHR *> RangeInfos = {};
+
+        /// @brief The geometries and ranges of the build infos, the geometry infos point into them
+        std::vector<std::shared_ptr<void>> KeepAlive = {};
+
+        /// @brief Range of the TLAS build, copied because the caller may change the build info
+        vk::AccelerationStructureBuildRangeInfoKHR TLASRange = {};
+
+        std::unique_ptr<uint8_t[]> Scratch = nullptr;
+
+        /// @brief Number of worker threads that are still joining the deferred operation
+        std::atomic<uint32_t> ActiveJoiners = 0;
+
+        std::promise<vk::Result> Promise;
+    };
+
+    // returns a future that is already ready, for builds that can't be started
+    static std::future<vk::Result> make_ready_future(vk::Result result)
+    {
+        std::promise<vk::Result> promise;
+        promise.set_value(result);
+        return promise.get_future();
+    }
+
+    //--------------------------------------------------------------------------------------
+    // HOST BUILD FUNCTIONS
+    //--------------------------------------------------------------------------------------
+
+    std::future<vk::Result> vk_ray_device::BuildBLASOnHost(const std::vector<BLASBuildInfo> &buildInfos)
+    {
+        if (!m_accel_features.accelerationStructureHostCommands)
+        {
+            VR_LOG(error, "BuildBLASOnHost: The device doesn't support host acceleration structure commands");
+            return make_ready_future(vk::Result::eErrorFeatureNotPresent);
+        }
+
+        if (buildInfos.empty())
+            return make_ready_future(vk::Result::eSuccess);
+
+        auto state = std::make_shared<host_build_state>();
+        state->GeometryInfos.reserve(buildInfos.size());
+        state->RangeInfos.reserve(buildInfos.size());
+
+        vk::DeviceSize scratchSize = 0;
+        for (auto &info : buildInfos)
+        {
+            if (info.BuildType != vk::AccelerationStructureBuildTypeKHR::eHost)
+            {
+                VR_LOG(error, "BuildBLASOnHost: All the build infos must be created with BuildType eHost");
+                return make_ready_future(vk::Result::eErrorUnknown);
+            }
+            scratchSize += get_aligned_scratch_size(info);
+        }
+
+        // host scratch memory is plain memory, but it still has to respect the scratch offset alignment
+        uint64_t alignment = m_accel_properties.minAccelerationStructureScratchOffsetAlignment;
+        state->Scratch = std::make_unique_for_overwrite<uint8_t[]>(scratchSize + alignment);
+        uint8_t *scratchData = state->Scratch.get();
+        scratchData += AlignUp((uint64_t)scratchData, alignment) - (uint64_t)scratchData;
+
+        for (auto &info : buildInfos)
+        {
+            auto geometryInfo = info.BuildGeometryInfo;
+            geometryInfo.scratchData.hostAddress = scratchData;
+            scratchData += get_aligned_scratch_size(info);
+
+            state->GeometryInfos.push_back(geometryInfo);
+            state->RangeInfos.push_back(info.Ranges.get());
+            state->KeepAlive.push_back(info.Geometries);
+            state->KeepAlive.push_back(info.Ranges);
+        }
+
+        return launch_host_build(state);
+    }
+
+    std::future<vk::Result> vk_ray_device::BuildTLASOnHost(TLASBuildInfo &buildInfo,
+                                                           const vk::AccelerationStructureInstanceKHR *instances,
+                                                           uint32_t instanceCount)
+    {
+        if (!m_accel_features.accelerationStructureHostCommands)
+        {
+            VR_LOG(error, "BuildTLASOnHost: The device doesn't support host acceleration structure commands");
+            return make_ready_future(vk::Result::eErrorFeatureNotPresent);
+        }
+
+        if (buildInfo.BuildType != vk::AccelerationStructureBuildTypeKHR::eHost)
+        {
+            VR_LOG(error, "BuildTLASOnHost: The build info must be created with BuildType eHost");
+            return make_ready_future(vk::Result::eErrorUnknown);
+        }
+
+        buildInfo.RangeInfo.primitiveCount = instanceCount;
+        buildInfo.Geometry->geometry.instances.data.hostAddress = instances;
+
+        auto state = std::make_shared<host_build_state>();
+        state->TLASRange = buildInfo.RangeInfo;
+
+        vk::DeviceSize scratchSize = buildInfo.BuildGeometryInfo.mode == vk::BuildAccelerationStructureModeKHR::eBuild
+                                         ? buildInfo.BuildSizes.buildScratchSize
+                                         : buildInfo.BuildSizes.updateScratchSize;
+
+        uint64_t alignment = m_accel_properties.minAccelerationStructureScratchOffsetAlignment;
+        state->Scratch = std::make_unique_for_overwrite<uint8_t[]>(scratchSize + alignment);
+        uint8_t *scratchData = state->Scratch.get();
+        scratchData += AlignUp((uint64_t)scratchData, alignment) - (uint64_t)scratchData;
+
+        // the geometry is copied, so the caller can reuse the build info for the next build right away
+        auto geometry = std::make_shared<vk::AccelerationStructureGeometryKHR>(*buildInfo.Geometry);
+        auto geometryInfo = buildInfo.BuildGeometryInfo;
+        geometryInfo.setPGeometries(geometry.get());
+        geometryInfo.scratchData.hostAddress = scratchData;
+
+        state->GeometryInfos.push_back(geometryInfo);
+        state->RangeInfos.push_back(&state->TLASRange);
+        state->KeepAlive.push_back(geometry);
+
+        return launch_host_build(state);
+    }
+
+    allocated_buffer vk_ray_device::create_host_accel_struct_buffer(vk::DeviceSize size)
+    {
+        // the CPU writes the acceleration structure, so it has to be in host visible memory
+        return create_buffer(size, vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR,
+                             VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT);
+    }
+
+    std::future<vk::Result> vk_ray_device::launch_host_build(std::shared_ptr<host_build_state> state)
+    {
+        std::future<vk::Result> outFuture = state->Promise.get_future();
+
+        state->Operation = m_device.createDeferredOperationKHR(nullptr, m_dyn_loader);
+
+        vk::Result result = m_device.buildAccelerationStructuresKHR(state->Operation, state->GeometryInfos.size(),
+                                                                    state->GeometryInfos.data(),
+                                                                    state->RangeInfos.data(), m_dyn_loader);
+
+        // the implementation may finish the build right away, or fail before deferring it
+        if (result != vk::Result::eOperationDeferredKHR)
+        {
+            m_device.destroyDeferredOperationKHR(state->Operation, nullptr, m_dyn_loader);
+            state->Promise.set_value(result == vk::Result::eOperationNotDeferredKHR ? vk::Result::eSuccess : result);
+            return outFuture;
+        }
+
+        // no point in starting more joiners than the operation can use
+        thread_pool &pool = GetThreadPool();
+        uint32_t maxConcurrency = m_device.getDeferredOperationMaxConcurrencyKHR(state->Operation, m_dyn_loader);
+        uint32_t joinerCount = std::clamp(maxConcurrency, 1u, pool.GetThreadCount());
+
+        state->ActiveJoiners = joinerCount;
+        for (uint32_t i = 0; i < joinerCount; i++)
+            pool.Submit([this, state]() { join_host_build(state); });
+
+        return outFuture;
+    }
+
+    void vk_ray_device::join_host_build(std::shared_ptr<host_build_state> state)
+    {
+        vk::Result buildResult;
+        if (!join_deferred_operation(state->Operation, state->ActiveJoiners, buildResult))
+            return;
+
+        state->Promise.set_value(buildResult);
+    }
+
+} // namespace vr
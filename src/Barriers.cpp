@@ -0,0 +1,282 @@
+
+#include "pch.h"
+
+#include "VkRay/Barriers.h"
+
+// FORWARD DECLARATIONS ================================================================================================
+
+namespace vr {
+
+    // CONSTANTS =======================================================================================================
+
+    static constexpr vk::AccessFlags2 WRITE_ACCESS = vk::AccessFlagBits2::eShaderWrite | vk::AccessFlagBits2::eShaderStorageWrite |
+        vk::AccessFlagBits2::eColorAttachmentWrite | vk::AccessFlagBits2::eDepthStencilAttachmentWrite | vk::AccessFlagBits2::eTransferWrite |
+        vk::AccessFlagBits2::eHostWrite | vk::AccessFlagBits2::eMemoryWrite | vk::AccessFlagBits2::eAccelerationStructureWriteKHR;
+
+    // MACROS ==========================================================================================================
+
+    // TYPES ===========================================================================================================
+
+    // STATIC VARIABLES ================================================================================================
+
+    // FUNCTION IMPLEMENTATION =========================================================================================
+
+    ResourceAccessInfo GetAccessInfo(ResourceAccess access) {
+
+        using Stage = vk::PipelineStageFlagBits2;
+        using Access = vk::AccessFlagBits2;
+
+        switch (access) {
+
+            case ResourceAccess::None:
+                return {Stage::eNone, Access::eNone, {}, vk::ImageLayout::eUndefined};
+            case ResourceAccess::AccelStructBuildInput:
+                return {Stage::eAccelerationStructureBuildKHR, Access::eShaderRead, {}, vk::ImageLayout::eUndefined};
+            case ResourceAccess::AccelStructBuildWrite:     // updates read the source and the scratch memory too
+                return {Stage::eAccelerationStructureBuildKHR, Access::eAccelerationStructureReadKHR | Access::eAccelerationStructureWriteKHR,
+                    Access::eAccelerationStructureWriteKHR, vk::ImageLayout::eUndefined};
+            case ResourceAccess::AccelStructBuildRead:
+                return {Stage::eAccelerationStructureBuildKHR, Access::eAccelerationStructureReadKHR, {}, vk::ImageLayout::eUndefined};
+            case ResourceAccess::AccelStructTraceRead:
+                return {Stage::eRayTracingShaderKHR, Access::eAccelerationStructureReadKHR, {}, vk::ImageLayout::eUndefined};
+            case ResourceAccess::AccelStructComputeRead:
+                return {Stage::eComputeShader, Access::eAccelerationStructureReadKHR, {}, vk::ImageLayout::eUndefined};
+            case ResourceAccess::RayTracingShaderRead:
+                return {Stage::eRayTracingShaderKHR, Access::eShaderStorageRead, {}, vk::ImageLayout::eGeneral};
+            case ResourceAccess::RayTracingShaderWrite:
+                return {Stage::eRayTracingShaderKHR, Access::eShaderStorageRead | Access::eShaderStorageWrite, Access::eShaderStorageWrite,
+                    vk::ImageLayout::eGeneral};
+            case ResourceAccess::ShaderBindingTableRead:    // requires VK_KHR_ray_tracing_maintenance1
+                return {Stage::eRayTracingShaderKHR, Access::eShaderBindingTableReadKHR, {}, vk::ImageLayout::eUndefined};
+            case ResourceAccess::ComputeShaderRead:
+                return {Stage::eComputeShader, Access::eShaderStorageRead, {}, vk::ImageLayout::eGeneral};
+            case ResourceAccess::ComputeShaderWrite:
+                return {Stage::eComputeShader, Access::eShaderStorageRead | Access::eShaderStorageWrite, Access::eShaderStorageWrite,
+                    vk::ImageLayout::eGeneral};
+            case ResourceAccess::FragmentShaderSampled:
+                return {Stage::eFragmentShader, Access::eShaderSampledRead, {}, vk::ImageLayout::eShaderReadOnlyOptimal};
+            case ResourceAccess::TransferRead:
+                return {Stage::eCopy, Access::eTransferRead, {}, vk::ImageLayout::eTransferSrcOptimal};
+            case ResourceAccess::TransferWrite:
+                return {Stage::eCopy, Access::eTransferWrite, Access::eTransferWrite, vk::ImageLayout::eTransferDstOptimal};
+            case ResourceAccess::HostWrite:
+                return {Stage::eHost, Access::eHostWrite, Access::eHostWrite, vk::ImageLayout::eUndefined};
+            case ResourceAccess::Present:                   // the semaphore signaled for presenting does the rest
+                return {Stage::eNone, Access::eNone, {}, vk::ImageLayout::ePresentSrcKHR};
+        }
+
+        return {};
+    }
+
+
+    static bool ranges_overlap(uint32_t baseA, uint32_t countA, uint32_t baseB, uint32_t countB) {
+
+        uint64_t endA = countA == VK_REMAINING_MIP_LEVELS ? UINT64_MAX : (uint64_t)baseA + countA;     // same value as VK_REMAINING_ARRAY_LAYERS
+        uint64_t endB = countB == VK_REMAINING_MIP_LEVELS ? UINT64_MAX : (uint64_t)baseB + countB;
+        return baseA < endB && baseB < endA;
+    }
+
+
+    static bool subresources_overlap(const vk::ImageSubresourceRange &a, const vk::ImageSubresourceRange &b) {
+
+        return (a.aspectMask & b.aspectMask) && ranges_overlap(a.baseMipLevel, a.levelCount, b.baseMipLevel, b.levelCount) &&
+            ranges_overlap(a.baseArrayLayer, a.layerCount, b.baseArrayLayer, b.layerCount);
+    }
+
+    // CLASS IMPLEMENTATION ============================================================================================
+
+    // CLASS PUBLIC ====================================================================================================
+
+    void barrier_batch::AddMemoryBarrier(ResourceAccess src, ResourceAccess dst) {
+
+        ResourceAccessInfo srcInfo = GetAccessInfo(src);
+        ResourceAccessInfo dstInfo = GetAccessInfo(dst);
+
+        // only the writes of the source have to be made available
+        AddMemoryBarrier(srcInfo.Stages, srcInfo.WriteAccess, dstInfo.Stages, dstInfo.Access);
+    }
+
+
+    void barrier_batch::AddMemoryBarrier(vk::PipelineStageFlags2 srcStages, vk::AccessFlags2 srcAccess, vk::PipelineStageFlags2 dstStages,
+        vk::AccessFlags2 dstAccess) {
+
+        if (m_detect_redundant) {
+
+            if (!srcStages || !dstStages)
+                report_redundant("memory barrier without source or destination stages");
+            else if (srcStages == vk::PipelineStageFlagBits2::eHost)
+                report_redundant("memory barrier after host writes, the queue submission makes them visible");
+            else if (!(srcAccess & WRITE_ACCESS) && !(dstAccess & WRITE_ACCESS))
+                report_redundant("memory barrier between two reads");
+        }
+
+        m_memory_barrier.srcStageMask |= srcStages;
+        m_memory_barrier.srcAccessMask |= srcAccess;
+        m_memory_barrier.dstStageMask |= dstStages;
+        m_memory_barrier.dstAccessMask |= dstAccess;
+    }
+
+
+    void barrier_batch::AddBufferBarrier(vk::Buffer buffer, ResourceAccess src, ResourceAccess dst, vk::DeviceSize offset, vk::DeviceSize size) {
+
+        ResourceAccessInfo srcInfo = GetAccessInfo(src);
+        ResourceAccessInfo dstInfo = GetAccessInfo(dst);
+
+        AddBufferBarrier(vk::BufferMemoryBarrier2()
+            .setSrcStageMask(srcInfo.Stages)
+            .setSrcAccessMask(srcInfo.WriteAccess)
+            .setDstStageMask(dstInfo.Stages)
+            .setDstAccessMask(dstInfo.Access)
+            .setBuffer(buffer)
+            .setOffset(offset)
+            .setSize(size));
+    }
+
+
+    void barrier_batch::AddBufferBarrier(const vk::BufferMemoryBarrier2 &barrier) {
+
+        bool ownershipTransfer = barrier.srcQueueFamilyIndex != barrier.dstQueueFamilyIndex;
+        if (m_detect_redundant && !ownershipTransfer) {
+
+            if (!barrier.srcStageMask || !barrier.dstStageMask)
+                report_redundant("buffer barrier without source or destination stages");
+            else if (barrier.srcStageMask == vk::PipelineStageFlagBits2::eHost)
+                report_redundant("buffer barrier after host writes, the queue submission makes them visible");
+            else if (!(barrier.srcAccessMask & WRITE_ACCESS) && !(barrier.dstAccessMask & WRITE_ACCESS))
+                report_redundant("buffer barrier between two reads");
+        }
+
+        for (auto &existing : m_buffer_barriers) {
+
+            if (existing.buffer == barrier.buffer && existing.offset == barrier.offset && existing.size == barrier.size &&
+                existing.srcQueueFamilyIndex == barrier.srcQueueFamilyIndex && existing.dstQueueFamilyIndex == barrier.dstQueueFamilyIndex) {
+
+                existing.srcStageMask |= barrier.srcStageMask;
+                existing.srcAccessMask |= barrier.srcAccessMask;
+                existing.dstStageMask |= barrier.dstStageMask;
+                existing.dstAccessMask |= barrier.dstAccessMask;
+                return;
+            }
+        }
+
+        m_buffer_barriers.push_back(barrier);
+    }
+
+
+    void barrier_batch::AddImageBarrier(vk::Image image, ResourceAccess src, ResourceAccess dst, const vk::ImageSubresourceRange &range) {
+
+        ResourceAccessInfo srcInfo = GetAccessInfo(src);
+        ResourceAccessInfo dstInfo = GetAccessInfo(dst);
+
+        // accesses without a layout keep the current one, e.g. an AS build reading an image can't happen anyway
+        vk::ImageLayout newLayout = dstInfo.Layout == vk::ImageLayout::eUndefined ? srcInfo.Layout : dstInfo.Layout;
+
+        AddImageBarrier(vk::ImageMemoryBarrier2()
+            .setSrcStageMask(srcInfo.Stages)
+            .setSrcAccessMask(srcInfo.WriteAccess)
+            .setDstStageMask(dstInfo.Stages)
+            .setDstAccessMask(dstInfo.Access)
+            .setOldLayout(srcInfo.Layout)
+            .setNewLayout(newLayout)
+            .setImage(image)
+            .setSubresourceRange(range));
+    }
+
+
+    void barrier_batch::AddImageBarrier(const vk::ImageMemoryBarrier2 &barrier) {
+
+        bool transition = barrier.oldLayout != barrier.newLayout;
+        bool ownershipTransfer = barrier.srcQueueFamilyIndex != barrier.dstQueueFamilyIndex;
+        if (m_detect_redundant && !transition && !ownershipTransfer) {
+
+            if (!barrier.srcStageMask || !barrier.dstStageMask)
+                report_redundant("image barrier without layout transition and without source or destination stages");
+            else if (!(barrier.srcAccessMask & WRITE_ACCESS) && !(barrier.dstAccessMask & WRITE_ACCESS))
+                report_redundant("image barrier between two reads without layout transition");
+        }
+
+        for (auto &existing : m_image_barriers) {
+
+            if (existing.image == barrier.image && existing.subresourceRange == barrier.subresourceRange &&
+                existing.oldLayout == barrier.oldLayout && existing.newLayout == barrier.newLayout &&
+                existing.srcQueueFamilyIndex == barrier.srcQueueFamilyIndex && existing.dstQueueFamilyIndex == barrier.dstQueueFamilyIndex) {
+
+                existing.srcStageMask |= barrier.srcStageMask;
+                existing.srcAccessMask |= barrier.srcAccessMask;
+                existing.dstStageMask |= barrier.dstStageMask;
+                existing.dstAccessMask |= barrier.dstAccessMask;
+                return;
+            }
+        }
+
+        m_image_barriers.push_back(barrier);
+    }
+
+
+    void barrier_batch::Flush(vk::CommandBuffer cmdBuf) {
+
+        if (IsEmpty())
+            return;
+
+        if (m_detect_redundant)
+            check_flushed_barriers();
+
+        bool hasMemoryBarrier = m_memory_barrier.srcStageMask || m_memory_barrier.dstStageMask;
+        auto dependencyInfo = vk::DependencyInfo()
+            .setMemoryBarrierCount(hasMemoryBarrier ? 1 : 0)
+            .setPMemoryBarriers(&m_memory_barrier)
+            .setBufferMemoryBarriers(m_buffer_barriers)
+            .setImageMemoryBarriers(m_image_barriers);
+
+        cmdBuf.pipelineBarrier2(dependencyInfo);
+
+        Clear();
+    }
+
+
+    void barrier_batch::Clear() {
+
+        m_memory_barrier = vk::MemoryBarrier2();
+        m_buffer_barriers.clear();
+        m_image_barriers.clear();
+    }
+
+
+    bool barrier_batch::IsEmpty() const {
+
+        bool hasMemoryBarrier = m_memory_barrier.srcStageMask || m_memory_barrier.dstStageMask;
+        return !hasMemoryBarrier && m_buffer_barriers.empty() && m_image_barriers.empty();
+    }
+
+    // CLASS PROTECTED =================================================================================================
+
+    // CLASS PRIVATE ===================================================================================================
+
+    void barrier_batch::report_redundant(const char *reason) {
+
+        m_redundant_count++;
+        VR_LOG(warning, "barrier_batch: Redundant barrier, {}", reason);
+    }
+
+
+    void barrier_batch::check_flushed_barriers() {
+
+        // a buffer barrier that the global memory barrier already covers does nothing but cost time
+        const vk::MemoryBarrier2 &global = m_memory_barrier;
+        for (const auto &barrier : m_buffer_barriers) {
+
+            bool ownershipTransfer = barrier.srcQueueFamilyIndex != barrier.dstQueueFamilyIndex;
+            if (!ownershipTransfer && !(barrier.srcStageMask & ~global.srcStageMask) && !(barrier.srcAccessMask & ~global.srcAccessMask) &&
+                !(barrier.dstStageMask & ~global.dstStageMask) && !(barrier.dstAccessMask & ~global.dstAccessMask))
+                report_redundant("buffer barrier covered by the memory barrier of the batch");
+        }
+
+        // two transitions of the same subresources in one batch are unordered, one of them is wrong or redundant
+        for (size_t i = 0; i < m_image_barriers.size(); i++)
+            for (size_t k = i + 1; k < m_image_barriers.size(); k++)
+                if (m_image_barriers[i].image == m_image_barriers[k].image &&
+                    subresources_overlap(m_image_barriers[i].subresourceRange, m_image_barriers[k].subresourceRange))
+                    report_redundant("the same image subresources have two barriers in one batch");
+    }
+
+}
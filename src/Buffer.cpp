@@ -11,6 +11,13 @@ namespace vr {
 
     // CONSTANTS =======================================================================================================
 
+    // instance buffers are aligned to a cache line, so chunks that start at a multiple of it never share a line
+    static constexpr uint32_t CACHE_LINE_SIZE = 64;
+    static constexpr uint32_t INSTANCES_PER_CACHE_LINE = std::max<uint32_t>(1, CACHE_LINE_SIZE / sizeof(vk::AccelerationStructureInstanceKHR));
+
+    // smaller chunks cost more in job overhead than they save, 16 KiB of instances per job
+    static constexpr uint32_t MIN_INSTANCES_PER_JOB = 256;
+
     // MACROS ==========================================================================================================
 
     // TYPES ===========================================================================================================
@@ -26,6 +33,62 @@ namespace vr {
 
     // CLASS IMPLEMENTATION ============================================================================================
 
+    void dirty_ranges::Add(uint64_t offset, uint64_t size) {
+
+        if (size == 0)
+            return;
+
+        // extend the last range for the common case of sequential writes
+        if (!m_ranges.empty()) {
+
+            BufferRange &last = m_ranges.back();
+            if (offset >= last.Offset && offset <= last.Offset + last.Size) {
+
+                last.Size = std::max(last.Size, offset + size - last.Offset);
+                return;
+            }
+        }
+
+        m_ranges.push_back({offset, size});
+        m_merged = false;
+    }
+
+
+    const std::vector<BufferRange>& dirty_ranges::GetRanges(uint64_t mergeGap) {
+
+        // ranges merged with a bigger gap stay merged, they still cover everything that is dirty
+        if (m_merged && mergeGap <= m_merge_gap)
+            return m_ranges;
+
+        std::sort(m_ranges.begin(), m_ranges.end(), [](const BufferRange &a, const BufferRange &b) { return a.Offset < b.Offset; });
+
+        uint32_t mergedCount = 0;
+        for (uint32_t i = 1; i < m_ranges.size(); i++) {
+
+            BufferRange &current = m_ranges[mergedCount];
+            const BufferRange &next = m_ranges[i];
+            if (next.Offset <= current.Offset + current.Size + mergeGap)
+                current.Size = std::max(current.Size, next.Offset + next.Size - current.Offset);
+            else
+                m_ranges[++mergedCount] = next;
+        }
+        if (!m_ranges.empty())
+            m_ranges.resize(mergedCount + 1);
+
+        m_merged = true;
+        m_merge_gap = mergeGap;
+        return m_ranges;
+    }
+
+
+    uint64_t dirty_ranges::GetTotalSize(uint64_t mergeGap) {
+
+        uint64_t totalSize = 0;
+        for (const auto &range : GetRanges(mergeGap))
+            totalSize += range.Size;
+        return totalSize;
+    }
+
     // CLASS PUBLIC ====================================================================================================
 
     AllocatedImage vk_ray_device::create_image(const vk::ImageCreateInfo& imgInfo, VmaAllocationCreateFlags flags, VmaPool pool) {
@@ -60,12 +123,17 @@ namespace vr {
         bufInfo.setSize(size);
         bufInfo.setUsage(bufferUsage | vk::BufferUsageFlagBits::eShaderDeviceAddress);
 
+        // acceleration structures that are built on one queue family and traced on another need no ownership transfer
+        if ((bufferUsage & vk::BufferUsageFlagBits::eAccelerationStructureStorageKHR) && !m_accel_struct_families.empty())
+            bufInfo.setSharingMode(vk::SharingMode::eConcurrent).setQueueFamilyIndices(m_accel_struct_families);
+
         vk::Result result;
+        VmaAllocationInfo allocationInfo = {};
         if (alignment)
             result = (vk::Result)vmaCreateBufferWithAlignment(m_vma_allocator, (VkBufferCreateInfo*)& bufInfo, &alloc_inf, // type punning
-                alignment, (VkBuffer*)&outBuffer.Buffer, &outBuffer.Allocation, nullptr);
+                alignment, (VkBuffer*)&outBuffer.Buffer, &outBuffer.Allocation, &allocationInfo);
         else
-            result = (vk::Result)vmaCreateBuffer(m_vma_allocator, (VkBufferCreateInfo*)& bufInfo, &alloc_inf, (VkBuffer*)&outBuffer.Buffer, &outBuffer.Allocation, nullptr);
+            result = (vk::Result)vmaCreateBuffer(m_vma_allocator, (VkBufferCreateInfo*)& bufInfo, &alloc_inf, (VkBuffer*)&outBuffer.Buffer, &outBuffer.Allocation, &allocationInfo);
 
         if (result != vk::Result::eSuccess)
         {
@@ -75,6 +143,13 @@ namespace vr {
 
         outBuffer.DevAddress = m_device.getBufferAddress(vk::BufferDeviceAddressInfo().setBuffer(outBuffer.Buffer));
         outBuffer.Size = size;
+
+        // the pointer stays valid until the buffer is destroyed, so the write paths never have to map the memory
+        outBuffer.MappedData = allocationInfo.pMappedData;
+
+        VkMemoryPropertyFlags memoryFlags = 0;
+        vmaGetAllocationMemoryProperties(m_vma_allocator, outBuffer.Allocation, &memoryFlags);
+        outBuffer.HostCoherent = (memoryFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
         return outBuffer;
     }
 
@@ -82,11 +157,11 @@ namespace vr {
     allocated_buffer vk_ray_device::CreateInstanceBuffer(uint32_t instanceCount) {
 
         return create_buffer(instanceCount * sizeof(vk::AccelerationStructureInstanceKHR), vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR,
-            VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT);
+            VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT, CACHE_LINE_SIZE);
     }
 
 
-    allocated_buffer vk_ray_device::CreateScratchBuffer(uint32_t size) {
+    allocated_buffer vk_ray_device::CreateScratchBuffer(vk::DeviceSize size) {
 
         return create_buffer(size, vk::BufferUsageFlagBits::eStorageBuffer, 0, m_accel_properties.minAccelerationStructureScratchOffsetAlignment);
     }
@@ -100,7 +175,7 @@ namespace vr {
         size = AlignUp(size, m_descriptor_buffer_properties.descriptorBufferOffsetAlignment);
 
         // create a buffer that is big enough to hold all the descriptor sets and with the proper alignment
-        outBuffer.Buffer = create_buffer(size * setCount, usageFlags, VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT,
+        outBuffer.Buffer = create_buffer(size * setCount, usageFlags, VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT,
             m_descriptor_buffer_properties.descriptorBufferOffsetAlignment);
 
         // fill the offsets to the items
@@ -137,6 +212,13 @@ namespace vr {
 
     void vk_ray_device::UpdateBuffer(allocated_buffer alloc, void *data, const vk::DeviceSize size, uint32_t offset) {
 
+        if (alloc.MappedData) {
+
+            memcpy((uint8_t *)alloc.MappedData + offset, data, size);
+            FlushBuffer(alloc, offset, size);
+            return;
+        }
+
         void *mappedData;
         vmaMapMemory(m_vma_allocator, alloc.Allocation, &mappedData);
         memcpy((uint8_t *)mappedData + offset, data, size);
@@ -144,6 +226,78 @@ namespace vr {
     }
 
 
+    uint32_t vk_ray_device::WriteInstances(vk::AccelerationStructureInstanceKHR *instances, uint32_t instanceCount, const InstanceWriter &writer) {
+
+        if (instanceCount == 0)
+            return 0;
+
+        thread_pool &pool = GetThreadPool();
+
+        // the calling thread writes one chunk itself, so it doesn't just sit and wait
+        uint32_t chunkCount = std::min(pool.GetThreadCount() + 1, (instanceCount + MIN_INSTANCES_PER_JOB - 1) / MIN_INSTANCES_PER_JOB);
+        if (chunkCount <= 1) {
+
+            writer(instances, 0, instanceCount);
+            return instanceCount;
+        }
+
+        uint32_t chunkSize = (instanceCount + chunkCount - 1) / chunkCount;
+        chunkSize = AlignUp(chunkSize, INSTANCES_PER_CACHE_LINE);
+        chunkCount = (instanceCount + chunkSize - 1) / chunkSize;
+
+        // every chunk is a disjoint range of whole cache lines, so the jobs need no locks
+        std::latch done(chunkCount - 1);
+        for (uint32_t chunk = 1; chunk < chunkCount; chunk++) {
+
+            uint32_t first = chunk * chunkSize;
+            uint32_t count = std::min(chunkSize, instanceCount - first);
+            pool.Submit([&writer, &done, instances, first, count]() {
+
+                writer(instances, first, count);
+                done.count_down();
+            });
+        }
+
+        writer(instances, 0, chunkSize);
+        done.wait();
+
+        return instanceCount;
+    }
+
+
+    uint32_t vk_ray_device::WriteInstanceBuffer(allocated_buffer &instanceBuffer, uint32_t instanceCount, const InstanceWriter &writer) {
+
+        uint32_t capacity = instanceBuffer.Size / sizeof(vk::AccelerationStructureInstanceKHR);
+        if (instanceCount > capacity) {
+
+            VR_LOG(warning, "WriteInstanceBuffer: {} instances don't fit into the buffer, only {} are written", instanceCount, capacity);
+            instanceCount = capacity;
+        }
+
+        if (instanceCount == 0)
+            return 0;
+
+        // the buffers of CreateInstanceBuffer(...) are persistently mapped, others are mapped once for all the threads
+        auto *instances = (vk::AccelerationStructureInstanceKHR *)MapBuffer(instanceBuffer);
+        WriteInstances(instances, instanceCount, writer);
+
+        FlushBuffer(instanceBuffer, 0, (vk::DeviceSize)instanceCount * sizeof(vk::AccelerationStructureInstanceKHR));
+        if (!instanceBuffer.MappedData)
+            UnmapBuffer(instanceBuffer);
+
+        return instanceCount;
+    }
+
+
+    uint32_t vk_ray_device::WriteInstanceBuffer(allocated_buffer &instanceBuffer, const InstancePackInfo &info) {
+
+        return WriteInstanceBuffer(instanceBuffer, info.Count, [&info](vk::AccelerationStructureInstanceKHR *instances, uint32_t first, uint32_t count) {
+
+            PackInstances(info, instances, first, count);
+        });
+    }
+
+
     void vk_ray_device::CopyData(allocated_buffer src, allocated_buffer dst, vk::DeviceSize size, vk::CommandBuffer cmdBuf) {
 
         auto copyRegion = vk::BufferCopy().setSize(size);
@@ -151,15 +305,44 @@ namespace vr {
     }
 
 
+    void vk_ray_device::CopyData(allocated_buffer src, allocated_buffer dst, const std::vector<vk::BufferCopy> &regions, vk::CommandBuffer cmdBuf) {
+
+        if (!regions.empty())
+            cmdBuf.copyBuffer(src.Buffer, dst.Buffer, regions);
+    }
+
+
     void *vk_ray_device::MapBuffer(allocated_buffer &buffer) {
 
+        if (buffer.MappedData)
+            return buffer.MappedData;
+
         void *mappedData;
         vmaMapMemory(m_vma_allocator, buffer.Allocation, &mappedData);
         return mappedData;
     }
 
 
-    void vk_ray_device::UnmapBuffer(allocated_buffer &buffer)         { vmaUnmapMemory(m_vma_allocator, buffer.Allocation); }
+    void vk_ray_device::UnmapBuffer(allocated_buffer &buffer) {
+
+        // a persistent mapping stays, only the writes have to be made visible
+        if (buffer.MappedData) {
+
+            FlushBuffer(buffer);
+            return;
+        }
+
+        vmaUnmapMemory(m_vma_allocator, buffer.Allocation);
+    }
+
+
+    void vk_ray_device::FlushBuffer(const allocated_buffer &buffer, vk::DeviceSize offset, vk::DeviceSize size) {
+
+        if (buffer.HostCoherent || buffer.Allocation == nullptr)
+            return;
+
+        vmaFlushAllocation(m_vma_allocator, buffer.Allocation, offset, size);
+    }
 
 
     void vk_ray_device::transition_image_layout(vk::CommandBuffer cmdBuf, vk::Image image, vk::ImageLayout oldLayout, vk::ImageLayout newLayout,
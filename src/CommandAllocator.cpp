@@ -0,0 +1,168 @@
+
+#include "pch.h"
+
+#include "VkRay/CommandAllocator.h"
+
+// FORWARD DECLARATIONS ================================================================================================
+
+namespace vr {
+
+    // CONSTANTS =======================================================================================================
+
+    // MACROS ==========================================================================================================
+
+    // TYPES ===========================================================================================================
+
+    // STATIC VARIABLES ================================================================================================
+
+    // ids are never reused, so the entries of destroyed allocators are never found again
+    static std::atomic<uint64_t> s_next_allocator_id = 1;
+
+    // the pools of the calling thread, per allocator id
+    static thread_local std::unordered_map<uint64_t, void*> t_thread_pools;
+
+    // FUNCTION IMPLEMENTATION =========================================================================================
+
+    // CLASS IMPLEMENTATION ============================================================================================
+
+    command_allocator::command_allocator(vk::Device device, const CommandAllocatorCreateInfo &info)
+        : m_device(device), m_info(info), m_id(s_next_allocator_id++) {
+
+        if (info.QueueFamily == ~0U)
+            VR_LOG(error, "command_allocator: No queue family was supplied");
+
+        m_info.FramesInFlight = std::max(info.FramesInFlight, 1u);
+    }
+
+
+    command_allocator::~command_allocator() {
+
+        for (auto &thread : m_threads)
+            for (auto &frame : thread->Frames)
+                m_device.destroyCommandPool(frame.Pool);
+    }
+
+    // CLASS PUBLIC ====================================================================================================
+
+    void command_allocator::BeginFrame() {
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        m_frame_slot = (m_frame_slot + 1) % m_info.FramesInFlight;
+        for (auto &thread : m_threads) {
+
+            frame_pool &frame = thread->Frames[m_frame_slot];
+            if (frame.UsedPrimaries == 0 && frame.UsedSecondaries == 0)
+                continue;
+
+            m_device.resetCommandPool(frame.Pool);
+            frame.UsedPrimaries = 0;
+            frame.UsedSecondaries = 0;
+        }
+
+        if (!m_enqueued.empty()) {
+
+            VR_LOG(warning, "command_allocator::BeginFrame: {} enqueued command buffers were never submitted", m_enqueued.size());
+            m_enqueued.clear();
+        }
+    }
+
+
+    vk::CommandBuffer command_allocator::AllocatePrimary()             { return allocate(vk::CommandBufferLevel::ePrimary); }
+
+
+    vk::CommandBuffer command_allocator::AllocateSecondary()           { return allocate(vk::CommandBufferLevel::eSecondary); }
+
+
+    vk::CommandBuffer command_allocator::ExecuteSecondaries(const std::vector<vk::CommandBuffer> &secondaries) {
+
+        vk::CommandBuffer cmdBuf = AllocatePrimary();
+        cmdBuf.begin(vk::CommandBufferBeginInfo().setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+        if (!secondaries.empty())
+            cmdBuf.executeCommands(secondaries);
+        cmdBuf.end();
+
+        return cmdBuf;
+    }
+
+
+    void command_allocator::Enqueue(vk::CommandBuffer cmdBuf) {
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_enqueued.push_back(cmdBuf);
+    }
+
+
+    void command_allocator::Submit(vk::Queue queue, const std::vector<vk::SemaphoreSubmitInfo> &waits,
+        const std::vector<vk::SemaphoreSubmitInfo> &signals, vk::Fence fence) {
+
+        std::vector<vk::CommandBufferSubmitInfo> commandBufferInfos;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            commandBufferInfos.reserve(m_enqueued.size());
+            for (auto cmdBuf : m_enqueued)
+                commandBufferInfos.push_back(vk::CommandBufferSubmitInfo(cmdBuf));
+            m_enqueued.clear();
+        }
+
+        auto submitInfo = vk::SubmitInfo2()
+            .setWaitSemaphoreInfos(waits)
+            .setCommandBufferInfos(commandBufferInfos)
+            .setSignalSemaphoreInfos(signals);
+
+        queue.submit2(submitInfo, fence);
+    }
+
+
+    uint32_t command_allocator::GetThreadCount() const {
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return static_cast<uint32_t>(m_threads.size());
+    }
+
+    // CLASS PROTECTED =================================================================================================
+
+    // CLASS PRIVATE ===================================================================================================
+
+    command_allocator::thread_pools& command_allocator::get_thread_pools() {
+
+        void *&cached = t_thread_pools[m_id];
+        if (cached)
+            return *(thread_pools*)cached;
+
+        // first allocation of the thread, its pools are created once and live as long as the allocator
+        auto pools = std::make_unique<thread_pools>();
+        pools->Frames.resize(m_info.FramesInFlight);
+        for (auto &frame : pools->Frames)
+            frame.Pool = m_device.createCommandPool(vk::CommandPoolCreateInfo()
+                .setFlags(vk::CommandPoolCreateFlagBits::eTransient)
+                .setQueueFamilyIndex(m_info.QueueFamily));
+
+        cached = pools.get();
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_threads.push_back(std::move(pools));
+        return *(thread_pools*)cached;
+    }
+
+
+    vk::CommandBuffer command_allocator::allocate(vk::CommandBufferLevel level) {
+
+        frame_pool &frame = get_thread_pools().Frames[m_frame_slot];
+
+        bool primary = level == vk::CommandBufferLevel::ePrimary;
+        std::vector<vk::CommandBuffer> &commandBuffers = primary ? frame.Primaries : frame.Secondaries;
+        uint32_t &used = primary ? frame.UsedPrimaries : frame.UsedSecondaries;
+
+        // the command buffers of the slot are reused after the reset of the pool, begin() doesn't need a reset then
+        if (used == commandBuffers.size())
+            commandBuffers.push_back(m_device.allocateCommandBuffers(vk::CommandBufferAllocateInfo()
+                .setCommandPool(frame.Pool)
+                .setLevel(level)
+                .setCommandBufferCount(1))[0]);
+
+        return commandBuffers[used++];
+    }
+
+}
@@ -0,0 +1,487 @@
+
+#include "pch.h"
+
+#include "VkRay/FrameGraph.h"
+
+// FORWARD DECLARATIONS ================================================================================================
+
+namespace vr {
+
+    // CONSTANTS =======================================================================================================
+
+    // MACROS ==========================================================================================================
+
+    // TYPES ===========================================================================================================
+
+    // STATIC VARIABLES ================================================================================================
+
+    // FUNCTION IMPLEMENTATION =========================================================================================
+
+    // combines two accesses of a pass to the same resource, images that need two different layouts use the general one
+    static void merge_access_info(ResourceAccessInfo &dst, const ResourceAccessInfo &src) {
+
+        dst.Stages |= src.Stages;
+        dst.Access |= src.Access;
+        dst.WriteAccess |= src.WriteAccess;
+
+        if (dst.Layout == vk::ImageLayout::eUndefined)
+            dst.Layout = src.Layout;
+        else if (src.Layout != vk::ImageLayout::eUndefined && src.Layout != dst.Layout)
+            dst.Layout = vk::ImageLayout::eGeneral;
+    }
+
+    // CLASS IMPLEMENTATION ============================================================================================
+
+    frame_graph::frame_graph(vk::Device device, const FrameGraphCreateInfo &info)
+        : m_device(device) {
+
+        if (!info.Graphics.Queue)
+            VR_LOG(error, "frame_graph: The graphics queue is required");
+
+        // queues that are the same vk::Queue are one queue for the graph, their passes are ordered with barriers
+        auto addQueue = [this](const FrameGraphQueueInfo &queueInfo) -> uint32_t {
+
+            if (!queueInfo.Queue && !m_queues.empty())
+                return 0;                                                                   // fall back to the graphics queue
+
+            for (uint32_t i = 0; i < m_queues.size(); i++)
+                if (m_queues[i].Queue == queueInfo.Queue)
+                    return i;
+
+            queue_data queue = {};
+            queue.Queue = queueInfo.Queue;
+            queue.Family = queueInfo.Family;
+
+            auto typeInfo = vk::SemaphoreTypeCreateInfo()
+                .setSemaphoreType(vk::SemaphoreType::eTimeline)
+                .setInitialValue(0);
+            queue.Timeline = m_device.createSemaphore(vk::SemaphoreCreateInfo().setPNext(&typeInfo));
+
+            m_queues.push_back(queue);
+            return m_queues.size() - 1;
+        };
+
+        m_queue_index[(uint32_t)FrameGraphQueue::Graphics] = addQueue(info.Graphics);
+        m_queue_index[(uint32_t)FrameGraphQueue::Compute] = addQueue(info.Compute);
+        m_queue_index[(uint32_t)FrameGraphQueue::Transfer] = addQueue(info.Transfer);
+
+        m_frames.resize(std::max(info.FramesInFlight, 1u));
+        for (auto &frame : m_frames)
+            for (uint32_t q = 0; q < m_queues.size(); q++)
+                frame.Pools[q] = m_device.createCommandPool(vk::CommandPoolCreateInfo()
+                    .setFlags(vk::CommandPoolCreateFlagBits::eTransient)
+                    .setQueueFamilyIndex(m_queues[q].Family));
+    }
+
+
+    frame_graph::~frame_graph() {
+
+        WaitIdle();
+
+        for (auto &frame : m_frames)
+            for (uint32_t q = 0; q < m_queues.size(); q++)
+                m_device.destroyCommandPool(frame.Pools[q]);
+
+        for (auto &queue : m_queues)
+            m_device.destroySemaphore(queue.Timeline);
+    }
+
+    // CLASS PUBLIC ====================================================================================================
+
+    uint32_t frame_graph::AddBuffer(vk::Buffer) {
+
+        // buffers are synchronized with global memory barriers, they are cheaper than buffer barriers on all vendors
+        return add_resource({});
+    }
+
+
+    uint32_t frame_graph::AddAccelStruct(vk::AccelerationStructureKHR) {
+
+        return add_resource({});
+    }
+
+
+    uint32_t frame_graph::AddImage(vk::Image image, vk::ImageLayout layout, const vk::ImageSubresourceRange &range) {
+
+        resource_state state = {};
+        state.Image = image;
+        state.Layout = layout;
+        state.Range = range;
+        return add_resource(state);
+    }
+
+
+    void frame_graph::SetImage(uint32_t resource, vk::Image image, vk::ImageLayout layout) {
+
+        resource_state &state = m_resources[resource];
+        state.Image = image;
+        state.Layout = layout;
+    }
+
+
+    void frame_graph::AddPass(const std::string &name, FrameGraphQueue queue, const std::vector<FrameGraphAccess> &accesses,
+        std::function<void(vk::CommandBuffer)> record) {
+
+        pass_data pass = {};
+        pass.Name = name;
+        pass.Queue = m_queue_index[(uint32_t)queue];
+        pass.Accesses = accesses;
+        pass.Record = std::move(record);
+        m_passes.push_back(std::move(pass));
+    }
+
+
+    void frame_graph::AddWait(FrameGraphQueue queue, vk::Semaphore semaphore, uint64_t value, vk::PipelineStageFlags2 stages) {
+
+        m_queues[m_queue_index[(uint32_t)queue]].ExternalWaits.push_back(vk::SemaphoreSubmitInfo(semaphore, value, stages));
+    }
+
+
+    void frame_graph::AddSignal(FrameGraphQueue queue, vk::Semaphore semaphore, uint64_t value, vk::PipelineStageFlags2 stages) {
+
+        m_queues[m_queue_index[(uint32_t)queue]].ExternalSignals.push_back(vk::SemaphoreSubmitInfo(semaphore, value, stages));
+    }
+
+
+    void frame_graph::Execute() {
+
+        // the command buffers of the slot were used FramesInFlight frames ago
+        frame_slot &slot = m_frames[m_frame_count % m_frames.size()];
+        for (uint32_t q = 0; q < m_queues.size(); q++) {
+
+            if (slot.Values[q] > 0) {
+
+                auto waitInfo = vk::SemaphoreWaitInfo()
+                    .setSemaphores(m_queues[q].Timeline)
+                    .setValues(slot.Values[q]);
+                if (m_device.waitSemaphores(waitInfo, UINT64_MAX) != vk::Result::eSuccess)
+                    VR_LOG(error, "frame_graph::Execute: Waiting for the command buffers of an earlier frame failed");
+            }
+
+            m_device.resetCommandPool(slot.Pools[q]);
+            slot.UsedCommandBuffers[q] = 0;
+        }
+
+        for (uint32_t p = 0; p < m_passes.size(); p++)
+            compile_pass(p);
+
+        std::vector<segment_data> segments;
+        build_segments(segments);
+
+        for (auto &segment : segments) {
+
+            if (segment.Passes.empty())
+                continue;
+
+            segment.CommandBuffer = get_command_buffer(slot, segment.Queue);
+            segment.CommandBuffer.begin(vk::CommandBufferBeginInfo().setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+
+            for (uint32_t p : segment.Passes) {
+
+                pass_data &pass = m_passes[p];
+                pass.Barriers.Flush(segment.CommandBuffer);
+                if (pass.Record)
+                    pass.Record(segment.CommandBuffer);
+            }
+
+            segment.CommandBuffer.end();
+        }
+
+        // one submit call per queue, the timeline semaphores allow waiting on values that are submitted later
+        std::vector<vk::CommandBufferSubmitInfo> commandBufferInfos(segments.size());
+        for (uint32_t q = 0; q < m_queues.size(); q++) {
+
+            std::vector<vk::SubmitInfo2> submits;
+            for (uint32_t s = 0; s < segments.size(); s++) {
+
+                segment_data &segment = segments[s];
+                if (segment.Queue != q)
+                    continue;
+
+                auto submit = vk::SubmitInfo2()
+                    .setWaitSemaphoreInfos(segment.Waits)
+                    .setSignalSemaphoreInfos(segment.Signals);
+
+                if (segment.CommandBuffer) {
+
+                    commandBufferInfos[s].setCommandBuffer(segment.CommandBuffer);
+                    submit.setCommandBufferInfoCount(1).setPCommandBufferInfos(&commandBufferInfos[s]);
+                }
+
+                submits.push_back(submit);
+            }
+
+            if (!submits.empty())
+                m_queues[q].Queue.submit2(submits);
+
+            slot.Values[q] = m_queues[q].LastValue;
+            m_queues[q].ExternalWaits.clear();
+            m_queues[q].ExternalSignals.clear();
+        }
+
+        // the passes of this frame become timeline values for the next frames
+        auto toValue = [&](sync_point &point) {
+
+            if (point.Pass != ~0U)
+                point = {~0U, segments[m_passes[point.Pass].Segment].Value};
+        };
+
+        for (auto &resource : m_resources) {
+
+            toValue(resource.Write);
+            for (auto &read : resource.Reads)
+                toValue(read);
+        }
+
+        m_passes.clear();
+        m_frame_count++;
+    }
+
+
+    void frame_graph::WaitIdle() {
+
+        for (auto &queue : m_queues) {
+
+            if (queue.LastValue == 0)
+                continue;
+
+            auto waitInfo = vk::SemaphoreWaitInfo()
+                .setSemaphores(queue.Timeline)
+                .setValues(queue.LastValue);
+            if (m_device.waitSemaphores(waitInfo, UINT64_MAX) != vk::Result::eSuccess)
+                VR_LOG(error, "frame_graph::WaitIdle: Waiting for the queues failed");
+        }
+    }
+
+    // CLASS PROTECTED =================================================================================================
+
+    // CLASS PRIVATE ===================================================================================================
+
+    uint32_t frame_graph::add_resource(const resource_state &state) {
+
+        m_resources.push_back(state);
+        return m_resources.size() - 1;
+    }
+
+
+    void frame_graph::compile_pass(uint32_t passIndex) {
+
+        pass_data &pass = m_passes[passIndex];
+        uint32_t q = pass.Queue;
+
+        // a resource that is listed more than once is one combined access, otherwise the pass would wait on itself
+        std::vector<std::pair<uint32_t, ResourceAccessInfo>> accesses;
+        accesses.reserve(pass.Accesses.size());
+        for (const auto &access : pass.Accesses) {
+
+            if (access.Resource >= m_resources.size()) {
+
+                VR_LOG(error, "frame_graph: Pass {} accesses the unknown resource {}", pass.Name, access.Resource);
+                continue;
+            }
+
+            auto existing = std::find_if(accesses.begin(), accesses.end(), [&](const auto &other) { return other.first == access.Resource; });
+            if (existing != accesses.end())
+                merge_access_info(existing->second, GetAccessInfo(access.Access));
+            else
+                accesses.emplace_back(access.Resource, GetAccessInfo(access.Access));
+        }
+
+        for (const auto &[resourceIndex, info] : accesses) {
+
+            resource_state &resource = m_resources[resourceIndex];
+            bool write = (bool)info.WriteAccess;
+            bool transition = resource.Image && info.Layout != vk::ImageLayout::eUndefined && info.Layout != resource.Layout;
+            bool modifies = write || transition;                                            // layout transitions write the image too
+
+            // other queues are waited on with their timeline semaphore, which makes their writes visible as well
+            bool waited = false;
+            if (resource.Write.IsSet() && resource.WriteQueue != q) {
+
+                add_wait(pass, resource.Write, resource.WriteQueue, info.Stages);
+                waited = true;
+            }
+
+            for (uint32_t other = 0; modifies && other < m_queues.size(); other++) {
+
+                if (other != q && resource.Reads[other].IsSet()) {
+
+                    add_wait(pass, resource.Reads[other], other, info.Stages);
+                    waited = true;
+                }
+            }
+
+            // the own queue only needs a barrier for what isn't visible yet, write after read is an execution dependency
+            vk::PipelineStageFlags2 srcStages = {};
+            vk::AccessFlags2 srcAccess = {};
+            if (resource.Write.IsSet() && resource.WriteQueue == q) {
+
+                bool visible = !(info.Stages & ~resource.VisibleStages) && !(info.Access & ~resource.VisibleAccess);
+                if (modifies || !visible) {
+
+                    srcStages |= resource.WriteStages;
+                    srcAccess |= resource.WriteAccess;
+                }
+            }
+
+            if (modifies)
+                srcStages |= resource.ReadStages[q];
+
+            if (transition) {
+
+                // chained to the semaphore wait through its stage mask
+                if (waited)
+                    srcStages |= info.Stages;
+
+                pass.Barriers.AddImageBarrier(vk::ImageMemoryBarrier2()
+                    .setSrcStageMask(srcStages ? srcStages : vk::PipelineStageFlagBits2::eNone)
+                    .setSrcAccessMask(srcAccess)
+                    .setDstStageMask(info.Stages)
+                    .setDstAccessMask(info.Access)
+                    .setOldLayout(resource.Layout)
+                    .setNewLayout(info.Layout)
+                    .setImage(resource.Image)
+                    .setSubresourceRange(resource.Range));
+
+                resource.Layout = info.Layout;
+            }
+            else if (srcStages)
+                pass.Barriers.AddMemoryBarrier(srcStages, srcAccess, info.Stages, info.Access);
+
+            if (modifies) {
+
+                resource.Write = {passIndex, 0};
+                resource.WriteQueue = q;
+                resource.WriteStages = info.Stages;
+                resource.WriteAccess = info.WriteAccess;
+
+                // a transition is visible to the stages it was made for, a write isn't visible to anything yet
+                resource.VisibleStages = write ? vk::PipelineStageFlags2() : info.Stages;
+                resource.VisibleAccess = write ? vk::AccessFlags2() : info.Access;
+
+                resource.Reads.fill({});
+                resource.ReadStages.fill({});
+            }
+            else if (srcStages || waited) {
+
+                resource.VisibleStages |= info.Stages;
+                resource.VisibleAccess |= info.Access;
+            }
+
+            if (!write) {
+
+                resource.Reads[q] = {passIndex, 0};
+                resource.ReadStages[q] |= info.Stages;
+            }
+        }
+    }
+
+
+    void frame_graph::add_wait(pass_data &pass, const sync_point &point, uint32_t queue, vk::PipelineStageFlags2 stages) {
+
+        if (point.Pass != ~0U) {
+
+            // the submission of the producer has to end after it, so the waiting pass doesn't wait for later passes
+            pass.WaitPasses.push_back({point.Pass, stages});
+            m_passes[point.Pass].EndsSegment = true;
+        }
+        else
+            pass.WaitValues.push_back(vk::SemaphoreSubmitInfo(m_queues[queue].Timeline, point.Value, stages));
+    }
+
+
+    void frame_graph::build_segments(std::vector<segment_data> &segments) {
+
+        // merges waits on the same semaphore into one, waiting for the biggest value with all the stages
+        auto addWait = [](segment_data &segment, const vk::SemaphoreSubmitInfo &wait) {
+
+            for (auto &existing : segment.Waits) {
+
+                if (existing.semaphore == wait.semaphore) {
+
+                    existing.value = std::max(existing.value, wait.value);
+                    existing.stageMask |= wait.stageMask;
+                    return;
+                }
+            }
+            segment.Waits.push_back(wait);
+        };
+
+        auto openSegment = [&](uint32_t q) -> uint32_t {
+
+            segment_data segment = {};
+            segment.Queue = q;
+            segment.Value = ++m_queues[q].LastValue;
+            segment.Signals.push_back(vk::SemaphoreSubmitInfo(m_queues[q].Timeline, segment.Value, vk::PipelineStageFlagBits2::eAllCommands));
+            segments.push_back(segment);
+            return segments.size() - 1;
+        };
+
+        std::array<uint32_t, MAX_QUEUES> openSegments;
+        openSegments.fill(~0U);
+
+        for (uint32_t p = 0; p < m_passes.size(); p++) {
+
+            pass_data &pass = m_passes[p];
+            uint32_t q = pass.Queue;
+
+            // waits are at the start of a submission, so a pass that waits starts a new one
+            bool waits = !pass.WaitPasses.empty() || !pass.WaitValues.empty();
+            if (openSegments[q] == ~0U || (waits && !segments[openSegments[q]].Passes.empty()))
+                openSegments[q] = openSegment(q);
+
+            segment_data &segment = segments[openSegments[q]];
+            segment.Passes.push_back(p);
+            pass.Segment = openSegments[q];
+
+            // the producers were added earlier, so their segments already have their values
+            for (const auto &[producer, stages] : pass.WaitPasses) {
+
+                const segment_data &producerSegment = segments[m_passes[producer].Segment];
+                addWait(segment, vk::SemaphoreSubmitInfo(m_queues[producerSegment.Queue].Timeline, producerSegment.Value, stages));
+            }
+
+            for (const auto &wait : pass.WaitValues)
+                addWait(segment, wait);
+
+            if (pass.EndsSegment)
+                openSegments[q] = ~0U;
+        }
+
+        // the external semaphores go to the first and last submission of the queue
+        for (uint32_t q = 0; q < m_queues.size(); q++) {
+
+            queue_data &queue = m_queues[q];
+            if (queue.ExternalWaits.empty() && queue.ExternalSignals.empty())
+                continue;
+
+            auto first = std::find_if(segments.begin(), segments.end(), [q](const segment_data &s) { return s.Queue == q; });
+            if (first == segments.end()) {
+
+                uint32_t segment = openSegment(q);                                          // invalidates the iterators
+                first = segments.begin() + segment;
+            }
+
+            for (const auto &wait : queue.ExternalWaits)
+                first->Waits.push_back(wait);
+
+            auto last = std::find_if(segments.rbegin(), segments.rend(), [q](const segment_data &s) { return s.Queue == q; });
+            for (const auto &signal : queue.ExternalSignals)
+                last->Signals.push_back(signal);
+        }
+    }
+
+
+    vk::CommandBuffer frame_graph::get_command_buffer(frame_slot &slot, uint32_t queue) {
+
+        std::vector<vk::CommandBuffer> &commandBuffers = slot.CommandBuffers[queue];
+        if (slot.UsedCommandBuffers[queue] == commandBuffers.size())
+            commandBuffers.push_back(m_device.allocateCommandBuffers(vk::CommandBufferAllocateInfo()
+                .setCommandPool(slot.Pools[queue])
+                .setLevel(vk::CommandBufferLevel::ePrimary)
+                .setCommandBufferCount(1))[0]);
+
+        return commandBuffers[slot.UsedCommandBuffers[queue]++];
+    }
+
+}
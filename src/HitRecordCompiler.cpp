@@ -0,0 +1,120 @@
+
+#include "pch.h"
+
+#include "VkRay/HitRecordCompiler.h"
+#include "VkRay/ShaderRecordTable.h"
+
+// FORWARD DECLARATIONS ================================================================================================
+
+namespace vr {
+
+    // CONSTANTS =======================================================================================================
+
+    // MACROS ==========================================================================================================
+
+    // TYPES ===========================================================================================================
+
+    // STATIC VARIABLES ================================================================================================
+
+    // FUNCTION IMPLEMENTATION =========================================================================================
+
+    static uint64_t hash_combine(uint64_t hash, uint64_t value) {
+
+        hash ^= value;
+        hash *= 0xff51afd7ed558ccdull;
+        return hash ^ (hash >> 32);
+    }
+
+    // CLASS IMPLEMENTATION ============================================================================================
+
+    hit_record_compiler::hit_record_compiler(uint32_t recordDataSize)
+        : m_record_data_size(recordDataSize) {}
+
+    // CLASS PUBLIC ====================================================================================================
+
+    uint32_t hit_record_compiler::AddInstance(const uint32_t *hitGroupIndices, const void *data, uint32_t recordCount) {
+
+        if (recordCount == 0)
+            return 0;
+
+        const uint8_t *recordData = (const uint8_t *)data;
+        m_requested_record_count += recordCount;
+
+        // most instances share the records of an instance that was added before
+        const uint64_t hash = hash_records(hitGroupIndices, recordData, recordCount);
+        auto [begin, end] = m_spans.equal_range(hash);
+        for (auto it = begin; it != end; ++it)
+            if (it->second.Count == recordCount && is_same_records(it->second, hitGroupIndices, recordData))
+                return it->second.First;
+
+        const uint32_t first = GetRecordCount();
+        if ((uint64_t)first + recordCount - 1 > MAX_INSTANCE_RECORD_OFFSET) {
+
+            VR_LOG(error, "hit_record_compiler: More than {} records, the instance record offset doesn't fit", MAX_INSTANCE_RECORD_OFFSET + 1);
+            return MAX_INSTANCE_RECORD_OFFSET + 1;
+        }
+
+        m_hit_group_indices.insert(m_hit_group_indices.end(), hitGroupIndices, hitGroupIndices + recordCount);
+        if (m_record_data_size > 0)
+            m_record_data.insert(m_record_data.end(), recordData, recordData + (size_t)recordCount * m_record_data_size);
+
+        m_spans.emplace(hash, record_span{ first, recordCount });
+        return first;
+    }
+
+
+    bool hit_record_compiler::WriteRecords(shader_record_table &table) const {
+
+        if (m_record_data_size == 0)
+            return GetRecordCount() <= table.GetRecordCount();
+
+        return table.WriteRange(0, GetRecordCount(), m_record_data.data(), m_record_data_size, m_record_data_size);
+    }
+
+
+    void hit_record_compiler::Clear() {
+
+        m_hit_group_indices.clear();
+        m_record_data.clear();
+        m_spans.clear();
+        m_requested_record_count = 0;
+    }
+
+    // CLASS PROTECTED =================================================================================================
+
+    // CLASS PRIVATE ===================================================================================================
+
+    uint64_t hit_record_compiler::hash_records(const uint32_t *hitGroupIndices, const uint8_t *data, uint32_t recordCount) const {
+
+        uint64_t hash = hash_combine(0x9e3779b97f4a7c15ull, recordCount);
+        for (uint32_t i = 0; i < recordCount; i++)
+            hash = hash_combine(hash, hitGroupIndices[i]);
+
+        // record data is usually small, e.g. a material index and a few buffer addresses
+        const size_t dataSize = (size_t)recordCount * m_record_data_size;
+        size_t byte = 0;
+        for (; byte + sizeof(uint64_t) <= dataSize; byte += sizeof(uint64_t)) {
+
+            uint64_t word;
+            memcpy(&word, data + byte, sizeof(uint64_t));
+            hash = hash_combine(hash, word);
+        }
+        for (; byte < dataSize; byte++)
+            hash = hash_combine(hash, data[byte]);
+
+        return hash;
+    }
+
+
+    bool hit_record_compiler::is_same_records(const record_span &span, const uint32_t *hitGroupIndices, const uint8_t *data) const {
+
+        if (memcmp(m_hit_group_indices.data() + span.First, hitGroupIndices, span.Count * sizeof(uint32_t)) != 0)
+            return false;
+
+        if (m_record_data_size == 0)
+            return true;
+
+        return memcmp(m_record_data.data() + (size_t)span.First * m_record_data_size, data, (size_t)span.Count * m_record_data_size) == 0;
+    }
+
+}
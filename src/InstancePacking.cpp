@@ -0,0 +1,172 @@
+
+#include "pch.h"
+
+#if defined(VR_SIMD_SSE2)
+#include <emmintrin.h>
+#elif defined(VR_SIMD_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "VkRay/AccelStruct.h"
+
+namespace vr
+{
+    // the kernels write the records as 4 x 16 bytes: 3 transform rows and the packed tail
+    static_assert(sizeof(vk::AccelerationStructureInstanceKHR) == 64, "Unexpected instance record size");
+
+    // first tail word: instanceCustomIndex (24 bit) and mask (8 bit)
+    static inline uint32_t get_index_and_mask(const InstancePackInfo &info, uint32_t i)
+    {
+        uint32_t customIndex = info.CustomIndices ? info.CustomIndices[i] : i;
+        uint32_t mask = info.Masks ? info.Masks[i] : info.DefaultMask;
+        return (customIndex & 0xFFFFFF) | (mask << 24);
+    }
+
+    // second tail word: instanceShaderBindingTableRecordOffset (24 bit) and flags (8 bit)
+    static inline uint32_t get_offset_and_flags(const InstancePackInfo &info, uint32_t i)
+    {
+        uint32_t sbtOffset = info.SBTOffsets ? info.SBTOffsets[i] : info.DefaultSBTOffset;
+        uint32_t flags = info.Flags ? info.Flags[i] : (uint32_t)(VkGeometryInstanceFlagsKHR)info.DefaultFlags;
+        return (sbtOffset & 0xFFFFFF) | (flags << 24);
+    }
+
+    static void pack_instances_scalar(const InstancePackInfo &info, vk::AccelerationStructureInstanceKHR *dst,
+                                      uint32_t first, uint32_t end)
+    {
+        for (uint32_t i = first; i < end; i++)
+        {
+            const float *m = info.Transforms + (size_t)i * 16;
+            vk::AccelerationStructureInstanceKHR &instance = dst[i];
+
+            for (uint32_t row = 0; row < 3; row++)
+                for (uint32_t col = 0; col < 4; col++)
+                    instance.transform.matrix[row][col] = info.ColumnMajorTransforms ? m[col * 4 + row] : m[row * 4 + col];
+
+            uint32_t indexAndMask = get_index_and_mask(info, i);
+            uint32_t offsetAndFlags = get_offset_and_flags(info, i);
+            instance.instanceCustomIndex = indexAndMask & 0xFFFFFF;
+            instance.mask = indexAndMask >> 24;
+            instance.instanceShaderBindingTableRecordOffset = offsetAndFlags & 0xFFFFFF;
+            instance.flags = offsetAndFlags >> 24;
+            instance.accelerationStructureReference = info.BLASReferences[i];
+        }
+    }
+
+#if defined(VR_SIMD_SSE2)
+
+    template <bool NonTemporal>
+    static void pack_instances_sse2(const InstancePackInfo &info, vk::AccelerationStructureInstanceKHR *dst,
+                                    uint32_t first, uint32_t end)
+    {
+        for (uint32_t i = first; i < end; i++)
+        {
+            const float *m = info.Transforms + (size_t)i * 16;
+            float *out = reinterpret_cast<float *>(&dst[i]);
+
+            __m128 row0, row1, row2;
+            if (info.ColumnMajorTransforms)
+            {
+                // transposing the columns gives the rows, the 4th row is dropped
+                __m128 col0 = _mm_loadu_ps(m);
+                __m128 col1 = _mm_loadu_ps(m + 4);
+                __m128 col2 = _mm_loadu_ps(m + 8);
+                __m128 col3 = _mm_loadu_ps(m + 12);
+                _MM_TRANSPOSE4_PS(col0, col1, col2, col3);
+                row0 = col0;
+                row1 = col1;
+                row2 = col2;
+            }
+            else
+            {
+                row0 = _mm_loadu_ps(m);
+                row1 = _mm_loadu_ps(m + 4);
+                row2 = _mm_loadu_ps(m + 8);
+            }
+
+            uint64_t packedWords = ((uint64_t)get_offset_and_flags(info, i) << 32) | get_index_and_mask(info, i);
+            __m128i tail = _mm_set_epi64x((int64_t)info.BLASReferences[i], (int64_t)packedWords);
+
+            if constexpr (NonTemporal)
+            {
+                _mm_stream_ps(out, row0);
+                _mm_stream_ps(out + 4, row1);
+                _mm_stream_ps(out + 8, row2);
+                _mm_stream_si128(reinterpret_cast<__m128i *>(out + 12), tail);
+            }
+            else
+            {
+                _mm_storeu_ps(out, row0);
+                _mm_storeu_ps(out + 4, row1);
+                _mm_storeu_ps(out + 8, row2);
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(out + 12), tail);
+            }
+        }
+
+        // make the non-temporal stores visible before the buffer is flushed or submitted
+        if constexpr (NonTemporal)
+            _mm_sfence();
+    }
+
+#elif defined(VR_SIMD_NEON)
+
+    // NEON has no non-temporal store intrinsic, the full 64 byte lines still combine well in the write buffers
+    static void pack_instances_neon(const InstancePackInfo &info, vk::AccelerationStructureInstanceKHR *dst,
+                                    uint32_t first, uint32_t end)
+    {
+        for (uint32_t i = first; i < end; i++)
+        {
+            const float *m = info.Transforms + (size_t)i * 16;
+            float *out = reinterpret_cast<float *>(&dst[i]);
+
+            if (info.ColumnMajorTransforms)
+            {
+                // the de-interleaving load transposes the column major matrix into rows
+                float32x4x4_t rows = vld4q_f32(m);
+                vst1q_f32(out, rows.val[0]);
+                vst1q_f32(out + 4, rows.val[1]);
+                vst1q_f32(out + 8, rows.val[2]);
+            }
+            else
+            {
+                vst1q_f32(out, vld1q_f32(m));
+                vst1q_f32(out + 4, vld1q_f32(m + 4));
+                vst1q_f32(out + 8, vld1q_f32(m + 8));
+            }
+
+            uint64_t packedWords = ((uint64_t)get_offset_and_flags(info, i) << 32) | get_index_and_mask(info, i);
+            uint64x2_t tail = vcombine_u64(vcreate_u64(packedWords), vcreate_u64(info.BLASReferences[i]));
+            vst1q_u64(reinterpret_cast<uint64_t *>(out + 12), tail);
+        }
+    }
+
+#endif
+
+    void PackInstances(const InstancePackInfo &info, vk::AccelerationStructureInstanceKHR *dst, uint32_t first,
+                       uint32_t count)
+    {
+        if (first >= info.Count)
+            return;
+
+        uint32_t end = first + std::min(count, info.Count - first);
+
+        if (info.ForceScalar)
+        {
+            pack_instances_scalar(info, dst, first, end);
+            return;
+        }
+
+#if defined(VR_SIMD_SSE2)
+        // streaming stores need 16 byte aligned destinations
+        bool aligned = (reinterpret_cast<uintptr_t>(dst) & 15) == 0;
+        if (info.NonTemporalStores && aligned)
+            pack_instances_sse2<true>(info, dst, first, end);
+        else
+            pack_instances_sse2<false>(info, dst, first, end);
+#elif defined(VR_SIMD_NEON)
+        pack_instances_neon(info, dst, first, end);
+#else
+        pack_instances_scalar(info, dst, first, end);
+#endif
+    }
+
+} // namespace vr
@@ -0,0 +1,113 @@
+
+#include "pch.h"
+
+#include "VkRay/AccelStruct.h"
+#include "VkRay/VkRay_device.h"
+
+namespace vr
+{
+
+    //--------------------------------------------------------------------------------------
+    // INSTANCE RING FUNCTIONS
+    //--------------------------------------------------------------------------------------
+
+    InstanceRing vk_ray_device::CreateInstanceRing(uint32_t instancesPerSlice, uint32_t sliceCount)
+    {
+        InstanceRing outRing = {};
+
+        // one slice per frame in flight, the slice of the oldest frame is the one that is written next
+        if (sliceCount == 0)
+            sliceCount = m_frames_in_flight;
+
+        outRing.SliceCount = sliceCount;
+        outRing.SliceCapacity = instancesPerSlice;
+        outRing.Guards.resize(sliceCount);
+
+        // the instances are 64 bytes, so every slice starts at the 16 byte alignment the build needs
+        vk::DeviceSize sliceSize = (vk::DeviceSize)instancesPerSlice * sizeof(vk::AccelerationStructureInstanceKHR);
+        outRing.Buffer = create_buffer(sliceSize * sliceCount, vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR,
+                                       VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT);
+
+        outRing.MappedData = (uint8_t *)outRing.Buffer.MappedData;
+        return outRing;
+    }
+
+    InstanceRingSlice vk_ray_device::AcquireInstanceSlice(InstanceRing &ring, uint64_t timeout)
+    {
+        InstanceRingSlice outSlice = {};
+        InstanceRingGuard &guard = ring.Guards[ring.Cursor];
+
+        // wait until the GPU is done with the submission that read the slice the last time
+        vk::Result result = vk::Result::eSuccess;
+        if (guard.Fence)
+            result = m_device.waitForFences(1, &guard.Fence, VK_TRUE, timeout);
+        else if (guard.TimelineSemaphore)
+        {
+            auto waitInfo = vk::SemaphoreWaitInfo()
+                                .setSemaphoreCount(1)
+                                .setPSemaphores(&guard.TimelineSemaphore)
+                                .setPValues(&guard.TimelineValue);
+            result = m_device.waitSemaphores(&waitInfo, timeout);
+        }
+
+        if (result != vk::Result::eSuccess)
+        {
+            VR_LOG(warning, "AcquireInstanceSlice: Waiting for slice {} failed: {}", ring.Cursor, vk::to_string(result));
+            return outSlice;
+        }
+
+        guard = {};
+
+        vk::DeviceSize sliceSize = (vk::DeviceSize)ring.SliceCapacity * sizeof(vk::AccelerationStructureInstanceKHR);
+
+        outSlice.Index = ring.Cursor;
+        outSlice.Capacity = ring.SliceCapacity;
+        outSlice.Offset = sliceSize * ring.Cursor;
+        outSlice.Instances = (vk::AccelerationStructureInstanceKHR *)(ring.MappedData + outSlice.Offset);
+
+        outSlice.Buffer.Buffer = ring.Buffer.Buffer;
+        outSlice.Buffer.DevAddress = ring.Buffer.DevAddress + outSlice.Offset;
+        outSlice.Buffer.Size = sliceSize;
+        outSlice.Buffer.MappedData = outSlice.Instances;
+        outSlice.Buffer.HostCoherent = ring.Buffer.HostCoherent;
+        outSlice.RingAllocation = ring.Buffer.Allocation;
+
+        ring.Cursor = (ring.Cursor + 1) % ring.SliceCount;
+        return outSlice;
+    }
+
+    void vk_ray_device::GuardInstanceSlice(InstanceRing &ring, const InstanceRingSlice &slice, vk::Fence fence)
+    {
+        ring.Guards[slice.Index] = {};
+        ring.Guards[slice.Index].Fence = fence;
+    }
+
+    void vk_ray_device::GuardInstanceSlice(InstanceRing &ring, const InstanceRingSlice &slice,
+                                           vk::Semaphore timelineSemaphore, uint64_t value)
+    {
+        ring.Guards[slice.Index] = {};
+        ring.Guards[slice.Index].TimelineSemaphore = timelineSemaphore;
+        ring.Guards[slice.Index].TimelineValue = value;
+    }
+
+    void vk_ray_device::DestroyInstanceRing(InstanceRing &ring)
+    {
+        DestroyBuffer(ring.Buffer);
+        ring.MappedData = nullptr;
+        ring.Guards.clear();
+    }
+
+    void vk_ray_device::BuildTLAS(TLASBuildInfo &buildInfo, const InstanceRingSlice &slice, uint32_t instanceCount,
+                                  vk::CommandBuffer cmdBuf)
+    {
+        assert(instanceCount <= slice.Capacity && "More instances than the slice can hold");
+
+        // only the written instances are flushed, and only if the memory isn't host coherent
+        if (slice.RingAllocation && !slice.Buffer.HostCoherent && instanceCount > 0)
+            vmaFlushAllocation(m_vma_allocator, slice.RingAllocation, slice.Offset,
+                               (vk::DeviceSize)instanceCount * sizeof(vk::AccelerationStructureInstanceKHR));
+
+        BuildTLAS(buildInfo, slice.Buffer, instanceCount, cmdBuf);
+    }
+
+} // namespace vr
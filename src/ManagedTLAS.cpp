@@ -0,0 +1,226 @@
+
+#include "pch.h"
+
+#include "VkRay/AccelStruct.h"
+#include "VkRay/VkRay_device.h"
+
+namespace vr
+{
+    // dirty instances that are at most this many instances apart are uploaded with a single copy region
+    static constexpr uint64_t INSTANCE_MERGE_GAP = 4;
+
+    // biggest absolute difference of the matrix elements, a cheap measure of how far an instance moved
+    static float get_transform_delta(const vk::TransformMatrixKHR &a, const vk::TransformMatrixKHR &b)
+    {
+        float delta = 0.0f;
+        for (uint32_t row = 0; row < 3; row++)
+            for (uint32_t col = 0; col < 4; col++)
+                delta = std::max(delta, std::abs(a.matrix[row][col] - b.matrix[row][col]));
+        return delta;
+    }
+
+    //--------------------------------------------------------------------------------------
+    // MANAGED TLAS FUNCTIONS
+    //--------------------------------------------------------------------------------------
+
+    ManagedTLAS vk_ray_device::CreateManagedTLAS(const ManagedTLASCreateInfo &info)
+    {
+        ManagedTLAS outTLAS = {};
+        outTLAS.Settings = info;
+
+        // refits need the update flag
+        outTLAS.Settings.Flags |= vk::BuildAccelerationStructureFlagBitsKHR::eAllowUpdate;
+
+        resize_managed_tlas(outTLAS, std::max(info.InitialCapacity, 1u));
+        return outTLAS;
+    }
+
+    uint32_t vk_ray_device::AddTLASInstance(ManagedTLAS &tlas, const vk::AccelerationStructureInstanceKHR &instance)
+    {
+        uint32_t instanceID = 0;
+        if (!tlas.FreeIDs.empty())
+        {
+            // reusing a slot keeps the instance count the same, so the TLAS can still be refit
+            instanceID = tlas.FreeIDs.back();
+            tlas.FreeIDs.pop_back();
+            tlas.Instances[instanceID] = instance;
+        }
+        else
+        {
+            instanceID = tlas.Instances.size();
+            tlas.Instances.push_back(instance);
+        }
+
+        tlas.DirtyInstances.Add(instanceID, 1);
+        tlas.ChangesSinceRebuild++;
+        return instanceID;
+    }
+
+    void vk_ray_device::RemoveTLASInstance(ManagedTLAS &tlas, uint32_t instanceID)
+    {
+        assert(instanceID < tlas.Instances.size() && "Invalid instance ID");
+
+        // the slot stays in the TLAS, but no ray can hit it anymore
+        tlas.Instances[instanceID].mask = 0;
+        tlas.FreeIDs.push_back(instanceID);
+
+        tlas.DirtyInstances.Add(instanceID, 1);
+        tlas.ChangesSinceRebuild++;
+    }
+
+    void vk_ray_device::SetTLASInstance(ManagedTLAS &tlas, uint32_t instanceID,
+                                        const vk::AccelerationStructureInstanceKHR &instance)
+    {
+        assert(instanceID < tlas.Instances.size() && "Invalid instance ID");
+
+        tlas.TransformDeltaSinceRebuild += get_transform_delta(tlas.Instances[instanceID].transform, instance.transform);
+        tlas.Instances[instanceID] = instance;
+
+        tlas.DirtyInstances.Add(instanceID, 1);
+        tlas.ChangesSinceRebuild++;
+    }
+
+    void vk_ray_device::SetTLASInstanceTransform(ManagedTLAS &tlas, uint32_t instanceID,
+                                                 const vk::TransformMatrixKHR &transform)
+    {
+        assert(instanceID < tlas.Instances.size() && "Invalid instance ID");
+
+        tlas.TransformDeltaSinceRebuild += get_transform_delta(tlas.Instances[instanceID].transform, transform);
+        tlas.Instances[instanceID].transform = transform;
+
+        tlas.DirtyInstances.Add(instanceID, 1);
+        tlas.ChangesSinceRebuild++;
+    }
+
+    TLASBuildMode vk_ray_device::BuildManagedTLAS(ManagedTLAS &tlas, vk::CommandBuffer cmdBuf)
+    {
+        if (tlas.DirtyInstances.IsEmpty() && !tlas.NeedsRebuild)
+            return TLASBuildMode::None;
+
+        uint32_t instanceCount = tlas.Instances.size();
+
+        // grow geometrically, so adding instances one by one doesn't recreate the TLAS all the time
+        if (instanceCount > tlas.BuildInfo.MaxInstanceCount)
+            resize_managed_tlas(tlas, std::max(instanceCount, tlas.BuildInfo.MaxInstanceCount * 2));
+
+        // a refit keeps the topology of the last rebuild, so the quality drops the more the instances change
+        const ManagedTLASCreateInfo &settings = tlas.Settings;
+        bool rebuild = tlas.NeedsRebuild || instanceCount != tlas.BuiltInstanceCount ||
+                       tlas.RefitsSinceRebuild >= settings.MaxRefits ||
+                       tlas.ChangesSinceRebuild > settings.RebuildChangedFraction * instanceCount ||
+                       (settings.RebuildMeanTransformDelta > 0.0f &&
+                        tlas.TransformDeltaSinceRebuild > (double)settings.RebuildMeanTransformDelta * instanceCount);
+
+        // upload only the dirty instances through a staging buffer
+        const auto &dirtyRanges = tlas.DirtyInstances.GetRanges(INSTANCE_MERGE_GAP);
+        if (!dirtyRanges.empty())
+        {
+            constexpr vk::DeviceSize instanceSize = sizeof(vk::AccelerationStructureInstanceKHR);
+
+            allocated_buffer stagingBuffer =
+                create_buffer(tlas.DirtyInstances.GetTotalSize(INSTANCE_MERGE_GAP) * instanceSize,
+                              vk::BufferUsageFlagBits::eTransferSrc,
+                              VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT);
+
+            std::vector<vk::BufferCopy> copyRegions;
+            copyRegions.reserve(dirtyRanges.size());
+
+            uint8_t *stagingData = (uint8_t *)stagingBuffer.MappedData;
+            vk::DeviceSize stagingOffset = 0;
+            for (const auto &range : dirtyRanges)
+            {
+                memcpy(stagingData + stagingOffset, &tlas.Instances[range.Offset], range.Size * instanceSize);
+                copyRegions.push_back(vk::BufferCopy()
+                                          .setSrcOffset(stagingOffset)
+                                          .setDstOffset(range.Offset * instanceSize)
+                                          .setSize(range.Size * instanceSize));
+                stagingOffset += range.Size * instanceSize;
+            }
+            FlushBuffer(stagingBuffer);
+
+            // the build of the previous frame may still read the instances
+            barrier_batch barriers;
+            barriers.AddMemoryBarrier(ResourceAccess::AccelStructBuildInput, ResourceAccess::TransferWrite);
+            barriers.Flush(cmdBuf);
+
+            cmdBuf.copyBuffer(stagingBuffer.Buffer, tlas.InstanceBuffer.Buffer, copyRegions);
+
+            barriers.AddMemoryBarrier(ResourceAccess::TransferWrite, ResourceAccess::AccelStructBuildInput);
+            barriers.Flush(cmdBuf);
+
+            RetireBuffer(stagingBuffer);
+        }
+
+        if (rebuild)
+        {
+            tlas.BuildInfo.BuildGeometryInfo.setMode(vk::BuildAccelerationStructureModeKHR::eBuild)
+                .setSrcAccelerationStructure(nullptr);
+
+            tlas.BuiltInstanceCount = instanceCount;
+            tlas.ChangesSinceRebuild = 0;
+            tlas.TransformDeltaSinceRebuild = 0.0;
+            tlas.RefitsSinceRebuild = 0;
+            tlas.NeedsRebuild = false;
+        }
+        else
+        {
+            tlas.BuildInfo.BuildGeometryInfo.setMode(vk::BuildAccelerationStructureModeKHR::eUpdate)
+                .setSrcAccelerationStructure(tlas.TLAS.AccelerationStructure);
+
+            tlas.RefitsSinceRebuild++;
+        }
+
+        // the scratch buffer is reused every frame
+        add_scratch_reuse_barrier(cmdBuf);
+        BuildTLAS(tlas.BuildInfo, tlas.InstanceBuffer, instanceCount, cmdBuf);
+
+        tlas.DirtyInstances.Clear();
+        return rebuild ? TLASBuildMode::Rebuild : TLASBuildMode::Refit;
+    }
+
+    void vk_ray_device::DestroyManagedTLAS(ManagedTLAS &tlas)
+    {
+        DestroyTLAS(tlas.TLAS);
+        DestroyBuffer(tlas.InstanceBuffer);
+        DestroyBuffer(tlas.ScratchBuffer);
+
+        tlas.Instances.clear();
+        tlas.FreeIDs.clear();
+        tlas.DirtyInstances.Clear();
+    }
+
+    void vk_ray_device::resize_managed_tlas(ManagedTLAS &tlas, uint32_t capacity)
+    {
+        // the old resources may still be used by frames in flight
+        if (tlas.TLAS.AccelerationStructure)
+        {
+            RetireResource([this, oldTLAS = tlas.TLAS]() mutable { DestroyTLAS(oldTLAS); });
+            RetireBuffer(tlas.InstanceBuffer);
+            RetireBuffer(tlas.ScratchBuffer);
+        }
+
+        TLASCreateInfo createInfo = {};
+        createInfo.MaxInstanceCount = capacity;
+        createInfo.Flags = tlas.Settings.Flags;
+
+        std::tie(tlas.TLAS, tlas.BuildInfo) = CreateTLAS(createInfo);
+
+        tlas.InstanceBuffer = create_buffer(capacity * sizeof(vk::AccelerationStructureInstanceKHR),
+                                            vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR |
+                                                vk::BufferUsageFlagBits::eTransferDst,
+                                            0);
+
+        // one scratch buffer for both refits and rebuilds
+        tlas.ScratchBuffer = CreateScratchBuffer(
+            std::max(tlas.BuildInfo.BuildSizes.buildScratchSize, tlas.BuildInfo.BuildSizes.updateScratchSize));
+        BindScratchAdressToBuildInfo(tlas.ScratchBuffer.DevAddress, tlas.BuildInfo);
+
+        // the new instance buffer is empty, so everything has to be uploaded again
+        tlas.DirtyInstances.Clear();
+        if (!tlas.Instances.empty())
+            tlas.DirtyInstances.Add(0, tlas.Instances.size());
+
+        tlas.NeedsRebuild = true;
+    }
+
+} // namespace vr
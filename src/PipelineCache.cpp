@@ -0,0 +1,317 @@
+
+#include "pch.h"
+
+#include "VkRay/PipelineCache.h"
+#include "VkRay/VkRay_device.h"
+
+#if defined(_WIN32)
+    #define WIN32_LEAN_AND_MEAN
+    #define NOMINMAX
+    #include <windows.h>
+#elif defined(__unix__) || defined(__APPLE__)
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+// FORWARD DECLARATIONS ================================================================================================
+
+namespace vr {
+
+    // CONSTANTS =======================================================================================================
+
+    static constexpr uint32_t CACHE_FILE_MAGIC = 0x43505256;                // "VRPC"
+    static constexpr uint32_t CACHE_FILE_VERSION = 1;
+
+    // MACROS ==========================================================================================================
+
+    // TYPES ===========================================================================================================
+
+    // a read only view of a whole file, memory mapped where the platform allows it
+    struct mapped_file {
+
+        const uint8_t*                          Data = nullptr;
+        size_t                                  Size = 0;
+        std::vector<uint8_t>                    Fallback;               // the file content if it couldn't be mapped
+
+    #if defined(_WIN32)
+        HANDLE                                  File = INVALID_HANDLE_VALUE;
+        HANDLE                                  Mapping = nullptr;
+    #elif defined(__unix__) || defined(__APPLE__)
+        void*                                   View = nullptr;
+    #endif
+
+        mapped_file() = default;
+        mapped_file(const mapped_file&) = delete;
+        mapped_file& operator=(const mapped_file&) = delete;
+
+        ~mapped_file() {
+
+        #if defined(_WIN32)
+            if (Mapping) {
+
+                UnmapViewOfFile(Data);
+                CloseHandle(Mapping);
+            }
+            if (File != INVALID_HANDLE_VALUE)
+                CloseHandle(File);
+        #elif defined(__unix__) || defined(__APPLE__)
+            if (View)
+                munmap(View, Size);
+        #endif
+        }
+    };
+
+    // STATIC VARIABLES ================================================================================================
+
+    // FUNCTION IMPLEMENTATION =========================================================================================
+
+    static bool map_file(const std::string &path, mapped_file &outFile) {
+
+    #if defined(_WIN32)
+        outFile.File = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (outFile.File == INVALID_HANDLE_VALUE)
+            return false;
+
+        LARGE_INTEGER fileSize = {};
+        if (GetFileSizeEx(outFile.File, &fileSize) && fileSize.QuadPart > 0) {
+
+            outFile.Mapping = CreateFileMappingA(outFile.File, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (outFile.Mapping) {
+
+                outFile.Data = (const uint8_t *)MapViewOfFile(outFile.Mapping, FILE_MAP_READ, 0, 0, 0);
+                outFile.Size = (size_t)fileSize.QuadPart;
+                if (outFile.Data)
+                    return true;
+
+                CloseHandle(outFile.Mapping);
+                outFile.Mapping = nullptr;
+            }
+        }
+    #elif defined(__unix__) || defined(__APPLE__)
+        int fileDescriptor = open(path.c_str(), O_RDONLY);
+        if (fileDescriptor < 0)
+            return false;
+
+        struct stat fileStat = {};
+        if (fstat(fileDescriptor, &fileStat) == 0 && fileStat.st_size > 0) {
+
+            void *view = mmap(nullptr, (size_t)fileStat.st_size, PROT_READ, MAP_PRIVATE, fileDescriptor, 0);
+            if (view != MAP_FAILED) {
+
+                outFile.View = view;
+                outFile.Data = (const uint8_t *)view;
+                outFile.Size = (size_t)fileStat.st_size;
+            }
+        }
+
+        close(fileDescriptor);                                                              // the mapping stays valid
+        if (outFile.Data)
+            return true;
+    #endif
+
+        // no mapping on this platform, or it failed
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (!file)
+            return false;
+
+        outFile.Fallback.resize((size_t)file.tellg());
+        file.seekg(0);
+        file.read((char *)outFile.Fallback.data(), outFile.Fallback.size());
+        if (!file)
+            return false;
+
+        outFile.Data = outFile.Fallback.data();
+        outFile.Size = outFile.Fallback.size();
+        return true;
+    }
+
+
+    // FNV-1a, detects truncated and corrupted files, which some drivers crash on instead of rejecting them
+    static uint64_t hash_data(const uint8_t *data, size_t size) {
+
+        uint64_t hash = 0xcbf29ce484222325ull;
+        for (size_t i = 0; i < size; i++) {
+
+            hash ^= data[i];
+            hash *= 0x100000001b3ull;
+        }
+
+        return hash;
+    }
+
+    // CLASS IMPLEMENTATION ============================================================================================
+
+    pipeline_cache::pipeline_cache(vk_ray_device &device, const std::string &path)
+        : m_device(device.GetDevice()), m_path(path) {
+
+        auto properties = device.GetPhysicalDevice().getProperties2<vk::PhysicalDeviceProperties2, vk::PhysicalDeviceIDProperties>();
+        m_properties = properties.get<vk::PhysicalDeviceProperties2>().properties;
+        std::copy_n(properties.get<vk::PhysicalDeviceIDProperties>().driverUUID.data(), VK_UUID_SIZE, m_driver_uuid.begin());
+
+        mapped_file file;
+        auto cacheInfo = vk::PipelineCacheCreateInfo();
+        if (map_file(m_path, file) && validate(file.Data, file.Size)) {
+
+            cacheInfo.setInitialDataSize(file.Size - sizeof(file_header))
+                .setPInitialData(file.Data + sizeof(file_header));
+            m_loaded = true;
+        }
+
+        m_cache = m_device.createPipelineCache(cacheInfo);
+
+        if (m_loaded)
+            VR_LOG(info, "pipeline_cache: Loaded {} bytes from {}", cacheInfo.initialDataSize, m_path);
+    }
+
+
+    pipeline_cache::~pipeline_cache() {
+
+        Save();
+        m_device.destroyPipelineCache(m_cache);
+    }
+
+    // CLASS PUBLIC ====================================================================================================
+
+    vk::PipelineCache pipeline_cache::CreateThreadCache() {
+
+        return m_device.createPipelineCache(vk::PipelineCacheCreateInfo().setFlags(vk::PipelineCacheCreateFlagBits::eExternallySynchronized));
+    }
+
+
+    void pipeline_cache::Merge(vk::PipelineCache threadCache) {
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_thread_caches.push_back(threadCache);
+    }
+
+
+    void pipeline_cache::MergeThreadCaches() {
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        merge_thread_caches();
+    }
+
+
+    bool pipeline_cache::Save() {
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        merge_thread_caches();
+
+        std::vector<uint8_t> data = m_device.getPipelineCacheData(m_cache);
+
+        file_header header = get_expected_header();
+        header.DataSize = data.size();
+        header.DataHash = hash_data(data.data(), data.size());
+
+        // the old file is only replaced once the new one is complete
+        std::string tempPath = m_path + ".tmp";
+        {
+            std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+            file.write((const char *)&header, sizeof(header));
+            file.write((const char *)data.data(), data.size());
+            file.flush();
+
+            if (!file) {
+
+                VR_LOG(error, "pipeline_cache::Save: Failed to write {}", tempPath);
+                file.close();
+                std::error_code ignored;
+                std::filesystem::remove(tempPath, ignored);
+                return false;
+            }
+        }
+
+        std::error_code error;
+        std::filesystem::rename(tempPath, m_path, error);
+        if (error) {
+
+            VR_LOG(error, "pipeline_cache::Save: Failed to replace {}: {}", m_path, error.message());
+            std::filesystem::remove(tempPath, error);
+            return false;
+        }
+
+        return true;
+    }
+
+    // CLASS PROTECTED =================================================================================================
+
+    // CLASS PRIVATE ===================================================================================================
+
+    pipeline_cache::file_header pipeline_cache::get_expected_header() const {
+
+        file_header header = {};
+        header.Magic = CACHE_FILE_MAGIC;
+        header.Version = CACHE_FILE_VERSION;
+        header.VendorID = m_properties.vendorID;
+        header.DeviceID = m_properties.deviceID;
+        header.DriverVersion = m_properties.driverVersion;
+        std::copy_n(m_driver_uuid.begin(), VK_UUID_SIZE, header.DriverUUID);
+        std::copy_n(m_properties.pipelineCacheUUID.data(), VK_UUID_SIZE, header.PipelineCacheUUID);
+
+        return header;
+    }
+
+
+    bool pipeline_cache::validate(const uint8_t *fileData, size_t fileSize) const {
+
+        if (fileSize < sizeof(file_header) + sizeof(vk::PipelineCacheHeaderVersionOne)) {
+
+            VR_LOG(warning, "pipeline_cache: {} is too small, starting with an empty cache", m_path);
+            return false;
+        }
+
+        file_header header = {};
+        memcpy(&header, fileData, sizeof(header));
+
+        file_header expected = get_expected_header();
+        if (header.Magic != expected.Magic || header.Version != expected.Version) {
+
+            VR_LOG(warning, "pipeline_cache: {} is not a VkRay pipeline cache, starting with an empty cache", m_path);
+            return false;
+        }
+
+        // any driver update can change the compiled code, so the cache of another driver is useless
+        if (header.VendorID != expected.VendorID || header.DeviceID != expected.DeviceID || header.DriverVersion != expected.DriverVersion ||
+            memcmp(header.DriverUUID, expected.DriverUUID, VK_UUID_SIZE) != 0 ||
+            memcmp(header.PipelineCacheUUID, expected.PipelineCacheUUID, VK_UUID_SIZE) != 0) {
+
+            VR_LOG(info, "pipeline_cache: {} was written by another device or driver, starting with an empty cache", m_path);
+            return false;
+        }
+
+        const uint8_t *data = fileData + sizeof(file_header);
+        if (header.DataSize != fileSize - sizeof(file_header) || header.DataHash != hash_data(data, header.DataSize)) {
+
+            VR_LOG(warning, "pipeline_cache: {} is corrupted, starting with an empty cache", m_path);
+            return false;
+        }
+
+        // the header of the driver must agree with ours too
+        vk::PipelineCacheHeaderVersionOne driverHeader = {};
+        memcpy(&driverHeader, data, sizeof(driverHeader));
+        if (driverHeader.headerVersion != vk::PipelineCacheHeaderVersion::eOne || driverHeader.vendorID != expected.VendorID ||
+            driverHeader.deviceID != expected.DeviceID || memcmp(driverHeader.pipelineCacheUUID.data(), expected.PipelineCacheUUID, VK_UUID_SIZE) != 0) {
+
+            VR_LOG(warning, "pipeline_cache: The driver header of {} doesn't match, starting with an empty cache", m_path);
+            return false;
+        }
+
+        return true;
+    }
+
+
+    void pipeline_cache::merge_thread_caches() {
+
+        if (m_thread_caches.empty())
+            return;
+
+        m_device.mergePipelineCaches(m_cache, m_thread_caches);
+
+        for (auto threadCache : m_thread_caches)
+            m_device.destroyPipelineCache(threadCache);
+        m_thread_caches.clear();
+    }
+
+}
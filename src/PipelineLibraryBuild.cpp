@@ -0,0 +1,147 @@
+#include "pch.h"
+
+#include "VkRay/Shader.h"
+#include "VkRay/VkRay_device.h"
+
+namespace vr
+{
+    /// @brief Everything a deferred pipeline library creation reads, it is kept alive until the operation is finished
+    struct library_compile_state
+    {
+        vk::DeferredOperationKHR Operation = nullptr;
+
+        ShaderStagesAndGroups Stages = {};
+        vk::RayTracingPipelineInterfaceCreateInfoKHR InterfaceInfo = {};
+        vk::RayTracingPipelineCreateInfoKHR PipelineInfo = {};
+
+        /// @brief The library, it is only usable once the operation is finished
+        vk::Pipeline Pipeline = nullptr;
+
+        /// @brief The collection that gets the library
+        RayTracingShaderCollection *Collection = nullptr;
+
+        /// @brief Number of worker threads that are still joining the deferred operation
+        std::atomic<uint32_t> ActiveJoiners = 0;
+
+        std::promise<vk::Result> Promise;
+    };
+
+    //--------------------------------------------------------------------------------------
+    // PARALLEL PIPELINE FUNCTIONS
+    //--------------------------------------------------------------------------------------
+
+    vk::Result vk_ray_device::CreatePipelineLibraries(std::vector<RayTracingShaderCollection> &shaderCollections,
+                                                    PipelineSettings &settings, vk::PipelineCreateFlags flags,
+                                                    vk::PipelineCache cache)
+    {
+        // all the libraries are started before the first one is waited for, so the worker threads always have work
+        std::vector<std::future<vk::Result>> futures;
+        futures.reserve(shaderCollections.size());
+
+        for (auto &collection : shaderCollections)
+        {
+            auto state = std::make_shared<library_compile_state>();
+            state->Collection = &collection;
+
+            state->Stages = GetShaderStagesAndRayTracingGroups(collection);
+
+            state->InterfaceInfo = vk::RayTracingPipelineInterfaceCreateInfoKHR()
+                                       .setMaxPipelineRayHitAttributeSize(settings.MaxHitAttributeSize)
+                                       .setMaxPipelineRayPayloadSize(settings.MaxPayloadSize);
+
+            state->PipelineInfo = vk::RayTracingPipelineCreateInfoKHR()
+                                      .setFlags(flags | vk::PipelineCreateFlagBits::eLibraryKHR)
+                                      .setMaxPipelineRayRecursionDepth(settings.MaxRecursionDepth)
+                                      .setPLibraryInterface(&state->InterfaceInfo)
+                                      .setLayout(settings.PipelineLayout)
+                                      .setGroups(state->Stages.Groups)
+                                      .setStages(state->Stages.Stages);
+
+            futures.push_back(launch_library_compile(state, cache ? cache : m_pipeline_cache));
+        }
+
+        vk::Result outResult = vk::Result::eSuccess;
+        for (auto &future : futures)
+        {
+            vk::Result result = future.get();
+            if (result != vk::Result::eSuccess && outResult == vk::Result::eSuccess)
+                outResult = result;
+        }
+
+        return outResult;
+    }
+
+    std::pair<vk::Pipeline, SBTInfo> vk_ray_device::CompileRayTracingPipeline(
+        std::vector<RayTracingShaderCollection> &shaderCollections, PipelineSettings &settings,
+        vk::PipelineCreateFlags flags, vk::PipelineCache cache)
+    {
+        if (CreatePipelineLibraries(shaderCollections, settings, flags, cache) != vk::Result::eSuccess)
+        {
+            VR_LOG(error, "CompileRayTracingPipeline: Failed to create the pipeline libraries, the pipeline is not linked");
+            return std::make_pair(vk::Pipeline(), SBTInfo());
+        }
+
+        // linking only combines the compiled libraries, it is cheap compared to compiling them
+        return CreateRayTracingPipeline(shaderCollections, settings, flags, cache);
+    }
+
+    std::future<vk::Result> vk_ray_device::launch_library_compile(std::shared_ptr<library_compile_state> state,
+                                                                  vk::PipelineCache cache)
+    {
+        std::future<vk::Result> outFuture = state->Promise.get_future();
+
+        state->Operation = m_device.createDeferredOperationKHR(nullptr, m_dyn_loader);
+
+        auto res = m_device.createRayTracingPipelineKHR(state->Operation, cache, state->PipelineInfo, nullptr, m_dyn_loader);
+        state->Pipeline = res.value;
+
+        // the implementation may create the library right away, or fail before deferring it
+        if (res.result != vk::Result::eOperationDeferredKHR)
+        {
+            m_device.destroyDeferredOperationKHR(state->Operation, nullptr, m_dyn_loader);
+            state->Operation = nullptr;
+            finish_library_compile(*state, res.result == vk::Result::eOperationNotDeferredKHR ? vk::Result::eSuccess
+                                                                                            : res.result);
+            return outFuture;
+        }
+
+        // no point in starting more joiners than the operation can use
+        thread_pool &pool = GetThreadPool();
+        uint32_t maxConcurrency = m_device.getDeferredOperationMaxConcurrencyKHR(state->Operation, m_dyn_loader);
+        uint32_t joinerCount = std::clamp(maxConcurrency, 1u, pool.GetThreadCount());
+
+        state->ActiveJoiners = joinerCount;
+        for (uint32_t i = 0; i < joinerCount; i++)
+            pool.Submit([this, state]() { join_library_compile(state); });
+
+        return outFuture;
+    }
+
+    void vk_ray_device::join_library_compile(std::shared_ptr<library_compile_state> state)
+    {
+        // the last joiner that leaves finishes the library
+        vk::Result result;
+        if (!join_deferred_operation(state->Operation, state->ActiveJoiners, result))
+            return;
+
+        state->Operation = nullptr;
+
+        finish_library_compile(*state, result);
+    }
+
+    void vk_ray_device::finish_library_compile(library_compile_state &state, vk::Result result)
+    {
+        if (result != vk::Result::eSuccess)
+        {
+            VR_LOG(error, "CreatePipelineLibraries: Failed to create a pipeline library, result {}", vk::to_string(result));
+
+            if (state.Pipeline)
+                m_device.destroyPipeline(state.Pipeline);
+            state.Pipeline = nullptr;
+        }
+
+        state.Collection->CollectionPipeline = state.Pipeline;
+        state.Promise.set_value(result);
+    }
+
+} // namespace vr
@@ -0,0 +1,232 @@
+
+#include "pch.h"
+
+#include "VkRay/PipelineRelinker.h"
+#include "VkRay/VkRay_device.h"
+
+// FORWARD DECLARATIONS ================================================================================================
+
+namespace vr {
+
+    // CONSTANTS =======================================================================================================
+
+    // MACROS ==========================================================================================================
+
+    // TYPES ===========================================================================================================
+
+    // STATIC VARIABLES ================================================================================================
+
+    // FUNCTION IMPLEMENTATION =========================================================================================
+
+    // CLASS IMPLEMENTATION ============================================================================================
+
+    pipeline_relinker::pipeline_relinker(vk_ray_device &device, const PipelineSettings &settings, const SBTInfo &sbtInfo,
+        vk::PipelineCreateFlags flags)
+        : m_vr_device(device), m_settings(settings), m_sbt_info(sbtInfo), m_flags(flags) {
+
+        // only the record sizes and the reserves are used, the indices come from the linked pipeline
+        m_sbt_info.RayGenIndices.clear();
+        m_sbt_info.MissIndices.clear();
+        m_sbt_info.HitGroupIndices.clear();
+        m_sbt_info.CallableIndices.clear();
+    }
+
+
+    pipeline_relinker::~pipeline_relinker() {
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_queued.reset();
+        }
+
+        WaitIdle();
+
+        // the ready pipeline was never used by a frame
+        if (m_ready)
+            destroy(*m_ready);
+
+        retire(m_active);
+
+        vk::Device device = m_vr_device.GetDevice();
+        for (auto library : m_libraries)
+            m_vr_device.RetireResource([device, library]() { device.destroyPipeline(library); });
+    }
+
+    // CLASS PUBLIC ====================================================================================================
+
+    uint64_t pipeline_relinker::Relink(std::vector<RayTracingShaderCollection> collections, WriteRecordsFunc writeRecords) {
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        // a queued request that didn't start yet is replaced, it would be outdated before it is swapped in
+        relink_request request = {};
+        request.Collections = std::move(collections);
+        request.WriteRecords = std::move(writeRecords);
+        request.Generation = m_next_generation++;
+        m_queued = std::move(request);
+
+        if (!m_running) {
+
+            m_running = true;
+            m_vr_device.GetThreadPool().Submit([this]() { relink_loop(); });
+        }
+
+        return m_next_generation - 1;
+    }
+
+
+    bool pipeline_relinker::BeginFrame() {
+
+        std::optional<linked_pipeline> ready;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            ready.swap(m_ready);
+        }
+
+        if (!ready)
+            return false;
+
+        // the frames in flight still use the old pipeline, it is destroyed once they are done
+        retire(m_active);
+        m_active = std::move(*ready);
+
+        m_libraries.insert(m_libraries.end(), m_active.CreatedLibraries.begin(), m_active.CreatedLibraries.end());
+        m_active.CreatedLibraries.clear();
+
+        return true;
+    }
+
+
+    bool pipeline_relinker::IsRelinking() const {
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_running;
+    }
+
+
+    void pipeline_relinker::WaitIdle() {
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_idle.wait(lock, [this]() { return !m_running; });
+    }
+
+    // CLASS PROTECTED =================================================================================================
+
+    // CLASS PRIVATE ===================================================================================================
+
+    void pipeline_relinker::relink_loop() {
+
+        while (true) {
+
+            relink_request request;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (!m_queued) {
+
+                    m_running = false;
+                    m_idle.notify_all();
+                    return;
+                }
+
+                request = std::move(*m_queued);
+                m_queued.reset();
+            }
+
+            // compiling and linking happen without the lock, Relink(...) and BeginFrame() never wait on them
+            linked_pipeline pipeline = {};
+            if (!link(request, pipeline))
+                continue;
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            // a newer request came in while linking, this pipeline would only be replaced by it
+            if (m_queued) {
+
+                destroy(pipeline);
+                continue;
+            }
+
+            // the previous pipeline was finished but BeginFrame() wasn't called since, so no frame used it
+            if (m_ready)
+                destroy(*m_ready);
+
+            m_ready = std::move(pipeline);
+        }
+    }
+
+
+    bool pipeline_relinker::link(relink_request &request, linked_pipeline &outPipeline) {
+
+        outPipeline.Generation = request.Generation;
+        outPipeline.Collections = std::move(request.Collections);
+
+        // new materials come without a library, compile them here instead of on the frame thread
+        for (auto &collection : outPipeline.Collections) {
+
+            if (collection.CollectionPipeline)
+                continue;
+
+            m_vr_device.CreatePipelineLibrary(collection, m_settings, m_flags);
+            if (!collection.CollectionPipeline) {
+
+                VR_LOG(error, "pipeline_relinker: Failed to create a pipeline library, generation {} is dropped", request.Generation);
+                destroy(outPipeline);
+                return false;
+            }
+
+            outPipeline.CreatedLibraries.push_back(collection.CollectionPipeline);
+        }
+
+        std::tie(outPipeline.Pipeline, outPipeline.Info) =
+            m_vr_device.CreateRayTracingPipeline(outPipeline.Collections, m_settings, m_sbt_info, m_flags);
+
+        if (!outPipeline.Pipeline) {
+
+            VR_LOG(error, "pipeline_relinker: Failed to link the pipeline, generation {} is dropped", request.Generation);
+            destroy(outPipeline);
+            return false;
+        }
+
+        outPipeline.Info.ReserveRayGenGroups = m_sbt_info.ReserveRayGenGroups;
+        outPipeline.Info.ReserveMissGroups = m_sbt_info.ReserveMissGroups;
+        outPipeline.Info.ReserveHitGroups = m_sbt_info.ReserveHitGroups;
+        outPipeline.Info.ReserveCallableGroups = m_sbt_info.ReserveCallableGroups;
+        outPipeline.Info.Placement = m_sbt_info.Placement;
+
+        // a fresh SBT buffer, the one of the current pipeline may still be read by the GPU
+        outPipeline.SBT = m_vr_device.CreateSBT(outPipeline.Pipeline, outPipeline.Info);
+        if (request.WriteRecords)
+            request.WriteRecords(outPipeline.SBT, outPipeline.Info);
+
+        return true;
+    }
+
+
+    void pipeline_relinker::destroy(linked_pipeline &pipeline) {
+
+        vk::Device device = m_vr_device.GetDevice();
+
+        if (pipeline.Pipeline)
+            device.destroyPipeline(pipeline.Pipeline);
+        m_vr_device.DestroySBTBuffer(pipeline.SBT);
+
+        for (auto library : pipeline.CreatedLibraries)
+            device.destroyPipeline(library);
+
+        pipeline = {};
+    }
+
+
+    void pipeline_relinker::retire(linked_pipeline &pipeline) {
+
+        if (!pipeline.Pipeline)
+            return;
+
+        vk::Device device = m_vr_device.GetDevice();
+        m_vr_device.RetireResource([device, oldPipeline = pipeline.Pipeline]() { device.destroyPipeline(oldPipeline); });
+        m_vr_device.RetireResource([&vrDevice = m_vr_device, oldSBT = pipeline.SBT]() mutable { vrDevice.DestroySBTBuffer(oldSBT); });
+
+        pipeline = {};
+    }
+
+}
@@ -8,23 +8,24 @@
 namespace vr
 {
 
-    std::pair<std::vector<vk::PipelineShaderStageCreateInfo>, std::vector<vk::RayTracingShaderGroupCreateInfoKHR>>
-    vk_ray_device::GetShaderStagesAndRayTracingGroups(const RayTracingShaderCollection &info)
+    ShaderStagesAndGroups vk_ray_device::GetShaderStagesAndRayTracingGroups(const RayTracingShaderCollection &info,
+                                                                            bool useModuleIdentifiers)
     {
-        std::vector<vk::PipelineShaderStageCreateInfo> shaderStages;
-        std::vector<vk::RayTracingShaderGroupCreateInfoKHR> shaderGroups;
-        shaderStages.reserve(1 + info.MissShaders.size() + info.HitGroups.size() + info.CallableShaders.size());
-        shaderGroups.reserve(1 + info.MissShaders.size() + info.HitGroups.size() + info.CallableShaders.size());
+        ShaderStagesAndGroups outStages;
+        auto &shaderGroups = outStages.Groups;
+
+        const size_t groupCount = info.RayGenShaders.size() + info.MissShaders.size() + info.HitGroups.size() + info.CallableShaders.size();
+        outStages.Stages.reserve(groupCount);
+        shaderGroups.reserve(groupCount);
+
+        // finds the stages that were already added, permutations of the same module are told apart by their constants
+        std::unordered_multimap<uint64_t, uint32_t> stageLookup;
 
         // create ray gen shader groups
         for (auto &shader : info.RayGenShaders)
         {
-            shaderStages.push_back(vk::PipelineShaderStageCreateInfo()
-                                       .setStage(vk::ShaderStageFlagBits::eRaygenKHR)
-                                       .setModule(shader.Module)
-                                       .setPName(shader.EntryPoint));
-
-            uint32_t rayGenIndex = static_cast<uint32_t>(shaderStages.size() - 1);
+            uint32_t rayGenIndex = add_shader_stage(outStages, stageLookup, shader, vk::ShaderStageFlagBits::eRaygenKHR,
+                                                    nullptr, useModuleIdentifiers);
 
             shaderGroups.push_back(vk::RayTracingShaderGroupCreateInfoKHR()
                                        .setType(vk::RayTracingShaderGroupTypeKHR::eGeneral)
@@ -36,12 +37,8 @@ namespace vr
         // create miss shader groups
         for (auto &shader : info.MissShaders)
         {
-            shaderStages.push_back(vk::PipelineShaderStageCreateInfo()
-                                       .setStage(vk::ShaderStageFlagBits::eMissKHR)
-                                       .setModule(shader.Module)
-                                       .setPName(shader.EntryPoint));
-
-            uint32_t missIndex = static_cast<uint32_t>(shaderStages.size() - 1);
+            uint32_t missIndex = add_shader_stage(outStages, stageLookup, shader, vk::ShaderStageFlagBits::eMissKHR,
+                                                  nullptr, useModuleIdentifiers);
 
             shaderGroups.push_back(vk::RayTracingShaderGroupCreateInfoKHR()
                                        .setType(vk::RayTracingShaderGroupTypeKHR::eGeneral)
@@ -63,45 +60,32 @@ namespace vr
                                 .setIntersectionShader(VK_SHADER_UNUSED_KHR);
 
             // check if both shaders are null
-            if (!hg.ClosestHitShader.Module && !hg.AnyHitShader.Module && !hg.IntersectionShader.Module)
+            if (!hg.ClosestHitShader.IsValid() && !hg.AnyHitShader.IsValid() && !hg.IntersectionShader.IsValid())
             {
                 VR_LOG(error, "CreateRayTracingPipeline: Hit group must have at least one shader");
             }
 
             // add closest hit shader if it exists
-            if (hg.ClosestHitShader.Module)
+            if (hg.ClosestHitShader.IsValid())
             {
-
-                shaderStages.push_back(vk::PipelineShaderStageCreateInfo()
-                                           .setStage(vk::ShaderStageFlagBits::eClosestHitKHR)
-                                           .setModule(hg.ClosestHitShader.Module)
-                                           .setPName(hg.ClosestHitShader.EntryPoint));
-
-                uint32_t closestHitIndex = static_cast<uint32_t>(shaderStages.size() - 1);
-                hitGroup.setClosestHitShader(closestHitIndex);
+                hitGroup.setClosestHitShader(add_shader_stage(outStages, stageLookup, hg.ClosestHitShader,
+                                                              vk::ShaderStageFlagBits::eClosestHitKHR, &hg.Specialization,
+                                                              useModuleIdentifiers));
             }
             // add any hit shader if it exists
-            if (hg.AnyHitShader.Module)
+            if (hg.AnyHitShader.IsValid())
             {
-                shaderStages.push_back(vk::PipelineShaderStageCreateInfo()
-                                           .setStage(vk::ShaderStageFlagBits::eAnyHitKHR)
-                                           .setModule(hg.AnyHitShader.Module)
-                                           .setPName(hg.AnyHitShader.EntryPoint));
-
-                uint32_t anyHitIndex = static_cast<uint32_t>(shaderStages.size() - 1);
-                hitGroup.setAnyHitShader(anyHitIndex);
+                hitGroup.setAnyHitShader(add_shader_stage(outStages, stageLookup, hg.AnyHitShader,
+                                                          vk::ShaderStageFlagBits::eAnyHitKHR, &hg.Specialization,
+                                                          useModuleIdentifiers));
             }
             // add intersection shader if it exists
-            if (hg.IntersectionShader.Module)
+            if (hg.IntersectionShader.IsValid())
             {
-                shaderStages.push_back(vk::PipelineShaderStageCreateInfo()
-                                           .setStage(vk::ShaderStageFlagBits::eIntersectionKHR)
-                                           .setModule(hg.IntersectionShader.Module)
-                                           .setPName(hg.IntersectionShader.EntryPoint));
-
-                uint32_t intersectionIndex = static_cast<uint32_t>(shaderStages.size() - 1);
                 hitGroup.setType(vk::RayTracingShaderGroupTypeKHR::eProceduralHitGroup);
-                hitGroup.setIntersectionShader(intersectionIndex);
+                hitGroup.setIntersectionShader(add_shader_stage(outStages, stageLookup, hg.IntersectionShader,
+                                                                vk::ShaderStageFlagBits::eIntersectionKHR, &hg.Specialization,
+                                                                useModuleIdentifiers));
             }
 
             shaderGroups.push_back(hitGroup);
@@ -109,12 +93,8 @@ namespace vr
         // create callable shader groups
         for (auto &shader : info.CallableShaders)
         {
-            shaderStages.push_back(vk::PipelineShaderStageCreateInfo()
-                                       .setStage(vk::ShaderStageFlagBits::eCallableKHR)
-                                       .setModule(shader.Module)
-                                       .setPName(shader.EntryPoint));
-
-            uint32_t callIndex = static_cast<uint32_t>(shaderStages.size() - 1);
+            uint32_t callIndex = add_shader_stage(outStages, stageLookup, shader, vk::ShaderStageFlagBits::eCallableKHR,
+                                                  nullptr, useModuleIdentifiers);
 
             shaderGroups.push_back(vk::RayTracingShaderGroupCreateInfoKHR()
                                        .setType(vk::RayTracingShaderGroupTypeKHR::eGeneral)
@@ -123,7 +103,66 @@ namespace vr
                                        .setAnyHitShader(VK_SHADER_UNUSED_KHR)
                                        .setIntersectionShader(VK_SHADER_UNUSED_KHR));
         }
-        return std::make_pair(std::move(shaderStages), std::move(shaderGroups));
+        return outStages;
+    }
+
+    uint32_t vk_ray_device::add_shader_stage(ShaderStagesAndGroups &outStages, std::unordered_multimap<uint64_t, uint32_t> &stageLookup,
+                                             const Shader &shader, vk::ShaderStageFlagBits stage,
+                                             const SpecializationConstants *groupConstants, bool useModuleIdentifiers)
+    {
+        // the constants of the group apply to all its shaders, the constants of the shader take precedence
+        const SpecializationConstants *constants = &shader.Specialization;
+        SpecializationConstants merged;
+        if (groupConstants && !groupConstants->IsEmpty())
+        {
+            merged = *groupConstants;
+            merged.Merge(shader.Specialization);
+            constants = &merged;
+        }
+
+        vk::PipelineShaderStageCreateInfo stageInfo = make_shader_stage(shader, stage, useModuleIdentifiers);
+        const void *moduleKey = stageInfo.module ? (const void *)(VkShaderModule)stageInfo.module : (const void *)shader.Identifier;
+
+        uint64_t key = std::hash<const void *>()(moduleKey);
+        key = key * 31 + static_cast<uint64_t>(stage);
+        key = key * 31 + std::hash<std::string_view>()(shader.EntryPoint);
+        key = key * 31 + std::hash<std::string_view>()(std::string_view((const char *)constants->Data.data(), constants->Data.size()));
+
+        auto [begin, end] = stageLookup.equal_range(key);
+        for (auto it = begin; it != end; ++it)
+        {
+            const vk::PipelineShaderStageCreateInfo &other = outStages.Stages[it->second];
+            if (other.stage != stage || other.module != stageInfo.module || other.pNext != stageInfo.pNext ||
+                strcmp(other.pName, stageInfo.pName) != 0)
+                continue;
+
+            const vk::SpecializationInfo *otherInfo = other.pSpecializationInfo;
+            if (!otherInfo)
+            {
+                if (constants->IsEmpty())
+                    return it->second;
+                continue;
+            }
+
+            if (otherInfo->mapEntryCount == constants->Entries.size() && otherInfo->dataSize == constants->Data.size() &&
+                std::equal(constants->Entries.begin(), constants->Entries.end(), otherInfo->pMapEntries) &&
+                memcmp(otherInfo->pData, constants->Data.data(), constants->Data.size()) == 0)
+                return it->second;
+        }
+
+        if (!constants->IsEmpty())
+        {
+            // the stages outlive the hit group, so the constants are copied into storage that lives with the stages
+            const SpecializationConstants &stored = outStages.SpecializationStorage.emplace_back(*constants);
+            stageInfo.setPSpecializationInfo(&outStages.SpecializationInfos.emplace_back(
+                vk::SpecializationInfo().setMapEntries(stored.Entries).setDataSize(stored.Data.size()).setPData(stored.Data.data())));
+        }
+
+        uint32_t outIndex = static_cast<uint32_t>(outStages.Stages.size());
+        outStages.Stages.push_back(stageInfo);
+        stageLookup.emplace(key, outIndex);
+
+        return outIndex;
     }
 
     std::pair<vk::Pipeline, SBTInfo> vk_ray_device::CreateRayTracingPipeline(
@@ -146,8 +185,6 @@ namespace vr
         for ([[maybe_unused]] auto &shader : shaderCollection.CallableShaders)
             sbtInfo.CallableIndices.push_back(pipelineIndex++);
 
-        auto [shaderStages, shderGroups] = GetShaderStagesAndRayTracingGroups(shaderCollection);
-
         vk::RayTracingPipelineInterfaceCreateInfoKHR interfaceInfo =
             vk::RayTracingPipelineInterfaceCreateInfoKHR()
                 .setMaxPipelineRayHitAttributeSize(settings.MaxHitAttributeSize)
@@ -157,11 +194,16 @@ namespace vr
                                 .setFlags(flags)
                                 .setMaxPipelineRayRecursionDepth(settings.MaxRecursionDepth)
                                 .setPLibraryInterface(&interfaceInfo)
-                                .setLayout(settings.PipelineLayout)
-                                .setGroups(shderGroups)
-                                .setStages(shaderStages);
+                                .setLayout(settings.PipelineLayout);
+
+        // the stack size is set by DispatchRays(...) instead of using the worst case of the driver
+        const bool computeStackSize = settings.ComputeStackSize && !deferredOp;
+        const vk::DynamicState stackSizeState = vk::DynamicState::eRayTracingPipelineStackSizeKHR;
+        auto dynamicState = vk::PipelineDynamicStateCreateInfo().setDynamicStates(stackSizeState);
+        if (computeStackSize)
+            pipelineInfo.setPDynamicState(&dynamicState);
 
-        auto res = m_device.createRayTracingPipelineKHR(deferredOp, nullptr, pipelineInfo, nullptr, m_dyn_loader);
+        auto res = create_pipeline_from_collection(shaderCollection, pipelineInfo, m_pipeline_cache, deferredOp);
 
         // when deferredOp is not null, the pipeline is created asynchronously, so it doesn't return success or failure
         if (res.result != vk::Result::eSuccess && res.result != vk::Result::eOperationDeferredKHR)
@@ -170,6 +212,9 @@ namespace vr
             res.value = nullptr;
         }
 
+        if (res.value && computeStackSize)
+            sbtInfo.PipelineStackSize = compute_stack_size(res.value, sbtInfo, settings);
+
         return std::make_pair(res.value, sbtInfo);
     }
     std::pair<vk::Pipeline, SBTInfo> vk_ray_device::CreateRayTracingPipeline(
@@ -216,7 +261,15 @@ namespace vr
                                 .setPLibraryInfo(&libraryInfo)
                                 .setLayout(settings.PipelineLayout);
 
-        auto res = m_device.createRayTracingPipelineKHR(deferredOp, cache, pipelineInfo, nullptr, m_dyn_loader);
+        // the stack size is set by DispatchRays(...) instead of using the worst case of the driver
+        const bool computeStackSize = settings.ComputeStackSize && !deferredOp;
+        const vk::DynamicState stackSizeState = vk::DynamicState::eRayTracingPipelineStackSizeKHR;
+        auto dynamicState = vk::PipelineDynamicStateCreateInfo().setDynamicStates(stackSizeState);
+        if (computeStackSize)
+            pipelineInfo.setPDynamicState(&dynamicState);
+
+        auto res = m_device.createRayTracingPipelineKHR(deferredOp, cache ? cache : m_pipeline_cache, pipelineInfo, nullptr,
+                                                        m_dyn_loader);
         // when deferredOp is not null, the pipeline is created asynchronously, so it doesn't return success or failure
         if (res.result != vk::Result::eSuccess && res.result != vk::Result::eOperationDeferredKHR)
         {
@@ -224,6 +277,9 @@ namespace vr
             res.value = nullptr;
         }
 
+        if (res.value && computeStackSize)
+            sbtInfo.PipelineStackSize = compute_stack_size(res.value, sbtInfo, settings);
+
         return std::make_pair(res.value, sbtInfo);
     }
 
@@ -238,6 +294,7 @@ namespace vr
         pipelineInfo.second.MissShaderRecordSize = sbtInfoOld.MissShaderRecordSize;
         pipelineInfo.second.HitGroupRecordSize = sbtInfoOld.HitGroupRecordSize;
         pipelineInfo.second.CallableShaderRecordSize = sbtInfoOld.CallableShaderRecordSize;
+        pipelineInfo.second.Placement = sbtInfoOld.Placement;
 
         return pipelineInfo;
     }
@@ -251,17 +308,13 @@ namespace vr
                 .setMaxPipelineRayHitAttributeSize(settings.MaxHitAttributeSize)
                 .setMaxPipelineRayPayloadSize(settings.MaxPayloadSize);
 
-        auto [shaderStages, shderGroups] = GetShaderStagesAndRayTracingGroups(shaderCollection);
-
         auto pipelineInfo = vk::RayTracingPipelineCreateInfoKHR()
                                 .setFlags(flags | vk::PipelineCreateFlagBits::eLibraryKHR)
                                 .setMaxPipelineRayRecursionDepth(settings.MaxRecursionDepth)
                                 .setPLibraryInterface(&interfaceInfo)
-                                .setLayout(settings.PipelineLayout)
-                                .setGroups(shderGroups)
-                                .setStages(shaderStages);
+                                .setLayout(settings.PipelineLayout);
 
-        auto res = m_device.createRayTracingPipelineKHR(deferredOp, cache, pipelineInfo, nullptr, m_dyn_loader);
+        auto res = create_pipeline_from_collection(shaderCollection, pipelineInfo, cache ? cache : m_pipeline_cache, deferredOp);
 
         // when deferredOp is not null, the pipeline is created asynchronously, so it doesn't return success or failure
         if (res.result != vk::Result::eSuccess && res.result != vk::Result::eOperationDeferredKHR)
@@ -273,11 +326,78 @@ namespace vr
         shaderCollection.CollectionPipeline = res.value;
     }
 
-    void vk_ray_device::DispatchRays(const vk::Pipeline rtPipeline, const SBTBuffer &buffer, uint32_t width,
+    vk::ResultValue<vk::Pipeline> vk_ray_device::create_pipeline_from_collection(const RayTracingShaderCollection &collection,
+                                                                               vk::RayTracingPipelineCreateInfoKHR pipelineInfo,
+                                                                               vk::PipelineCache cache,
+                                                                               vk::DeferredOperationKHR deferredOp)
+    {
+        // identifiers only work if the pipeline cache has the pipeline, deferred creations always use the modules,
+        // because the fallback would have to wait for the operation
+        if (m_use_module_identifiers && !deferredOp)
+        {
+            ShaderStagesAndGroups identifierStages = GetShaderStagesAndRayTracingGroups(collection, true);
+
+            auto identifierInfo = vk::RayTracingPipelineCreateInfoKHR(pipelineInfo)
+                                      .setFlags(pipelineInfo.flags | vk::PipelineCreateFlagBits::eFailOnPipelineCompileRequired)
+                                      .setGroups(identifierStages.Groups)
+                                      .setStages(identifierStages.Stages);
+
+            auto res = m_device.createRayTracingPipelineKHR(nullptr, cache, identifierInfo, nullptr, m_dyn_loader);
+            if (res.result != vk::Result::ePipelineCompileRequired)
+                return res;
+        }
+
+        // the modules of identifier only shaders are created here, so the driver can compile them
+        ShaderStagesAndGroups stages = GetShaderStagesAndRayTracingGroups(collection);
+        pipelineInfo.setGroups(stages.Groups).setStages(stages.Stages);
+
+        return m_device.createRayTracingPipelineKHR(deferredOp, cache, pipelineInfo, nullptr, m_dyn_loader);
+    }
+
+    uint32_t vk_ray_device::compute_stack_size(vk::Pipeline pipeline, const SBTInfo &sbtInfo, const PipelineSettings &settings)
+    {
+        auto groupStackSize = [&](uint32_t group, vk::ShaderGroupShaderKHR shader) -> vk::DeviceSize
+        { return m_device.getRayTracingShaderGroupStackSizeKHR(pipeline, group, shader, m_dyn_loader); };
+
+        vk::DeviceSize rayGenMax = 0, missMax = 0, closestHitMax = 0, anyHitMax = 0, intersectionMax = 0, callableMax = 0;
+
+        for (uint32_t group : sbtInfo.RayGenIndices)
+            rayGenMax = std::max(rayGenMax, groupStackSize(group, vk::ShaderGroupShaderKHR::eGeneral));
+
+        for (uint32_t group : sbtInfo.MissIndices)
+            missMax = std::max(missMax, groupStackSize(group, vk::ShaderGroupShaderKHR::eGeneral));
+
+        // unused shaders of a hit group report 0
+        for (uint32_t group : sbtInfo.HitGroupIndices)
+        {
+            closestHitMax = std::max(closestHitMax, groupStackSize(group, vk::ShaderGroupShaderKHR::eClosestHit));
+            anyHitMax = std::max(anyHitMax, groupStackSize(group, vk::ShaderGroupShaderKHR::eAnyHit));
+            intersectionMax = std::max(intersectionMax, groupStackSize(group, vk::ShaderGroupShaderKHR::eIntersection));
+        }
+
+        for (uint32_t group : sbtInfo.CallableIndices)
+            callableMax = std::max(callableMax, groupStackSize(group, vk::ShaderGroupShaderKHR::eGeneral));
+
+        // the formula of the spec: the first trace can reach every hit shader, deeper traces only the closest hit and
+        // miss shaders, any hit and intersection shaders can't trace rays
+        const vk::DeviceSize recursion = settings.MaxRecursionDepth;
+        vk::DeviceSize stackSize = rayGenMax +
+                                   std::min<vk::DeviceSize>(1, recursion) * std::max({closestHitMax, missMax, intersectionMax + anyHitMax}) +
+                                   (recursion > 1 ? recursion - 1 : 0) * std::max(closestHitMax, missMax) +
+                                   settings.MaxCallableDepth * callableMax;
+
+        return static_cast<uint32_t>(stackSize);
+    }
+
+    void vk_ray_device::DispatchRays(const vk::Pipeline rtPipeline, uint32_t stackSize, const SBTBuffer &buffer, uint32_t width,
                                    uint32_t height, uint32_t depth, vk::CommandBuffer cmdBuf)
     {
         // dispatch rays
         cmdBuf.bindPipeline(vk::PipelineBindPoint::eRayTracingKHR, rtPipeline);
+
+        // the pipeline has the stack size as dynamic state if it was computed, a computed size can also be 0
+        if (stackSize != DEFAULT_PIPELINE_STACK_SIZE)
+            cmdBuf.setRayTracingPipelineStackSizeKHR(stackSize, m_dyn_loader);
         cmdBuf.traceRaysKHR(&buffer.RayGenRegion, &buffer.MissRegion, &buffer.HitGroupRegion, &buffer.CallableRegion,
                             width, height, depth, m_dyn_loader);
     }
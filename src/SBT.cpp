@@ -4,6 +4,7 @@
 #include "VkRay/SBT.h"
 #include "VkRay/VkRay_device.h"
 #include "VkRay/Buffer.h"
+#include "VkRay/Barriers.h"
 
 // FORWARD DECLARATIONS ================================================================================================
 
@@ -12,14 +13,111 @@ namespace vr {
 
     // CONSTANTS =======================================================================================================
 
+    static constexpr uint32_t SHADER_GROUP_COUNT = 4;
+    static constexpr uint64_t RECORD_MERGE_GAP = 64;                        // bytes, neighbouring records are uploaded in one copy
+    static constexpr uint64_t SBT_GROWTH_FACTOR = 2;                        // regions that don't fit grow at least by this factor
+    static constexpr uint64_t STAGING_SLICE_ALIGNMENT = 256;                // bytes, the staging slices of the frames don't share cache lines
+
     // MACROS ==========================================================================================================
 
     // TYPES ===========================================================================================================
 
+    // where the regions of an SBT live in its buffer, indexed by ShaderGroup
+    struct sbt_layout {
+
+        std::array<uint32_t, SHADER_GROUP_COUNT>        Counts = {};        // groups that are in the pipeline
+        std::array<vk::DeviceSize, SHADER_GROUP_COUNT>  Strides = {};
+        std::array<vk::DeviceSize, SHADER_GROUP_COUNT>  Offsets = {};
+        std::array<vk::DeviceSize, SHADER_GROUP_COUNT>  Capacities = {};    // including the reserved groups
+        vk::DeviceSize                                  TotalSize = 0;
+    };
+
     // STATIC VARIABLES ================================================================================================
 
     // FUNCTION IMPLEMENTATION =========================================================================================
 
+    static std::array<const std::vector<uint32_t>*, SHADER_GROUP_COUNT> get_indices(const SBTInfo &sbt) {
+
+        return { &sbt.RayGenIndices, &sbt.MissIndices, &sbt.HitGroupIndices, &sbt.CallableIndices };
+    }
+
+
+    static std::array<vk::StridedDeviceAddressRegionKHR*, SHADER_GROUP_COUNT> get_regions(SBTBuffer &buffer) {
+
+        return { &buffer.RayGenRegion, &buffer.MissRegion, &buffer.HitGroupRegion, &buffer.CallableRegion };
+    }
+
+
+    static sbt_layout compute_sbt_layout(const vk::PhysicalDeviceRayTracingPipelinePropertiesKHR &properties, const SBTInfo &sbt) {
+
+        const std::array<uint32_t, SHADER_GROUP_COUNT> recordSizes = { sbt.RayGenShaderRecordSize, sbt.MissShaderRecordSize, sbt.HitGroupRecordSize, sbt.CallableShaderRecordSize };
+        const std::array<uint32_t, SHADER_GROUP_COUNT> reserves = { sbt.ReserveRayGenGroups, sbt.ReserveMissGroups, sbt.ReserveHitGroups, sbt.ReserveCallableGroups };
+        const auto indices = get_indices(sbt);
+
+        sbt_layout outLayout = {};
+        for (uint32_t group = 0; group < SHADER_GROUP_COUNT; group++) {
+
+            outLayout.Counts[group] = static_cast<uint32_t>(indices[group]->size());
+            outLayout.Strides[group] = AlignUp(recordSizes[group] + properties.shaderGroupHandleSize, properties.shaderGroupHandleAlignment);
+
+            // every region has to start at the base alignment, so the regions are packed with padding in between
+            outLayout.Offsets[group] = AlignUp(outLayout.TotalSize, (vk::DeviceSize)properties.shaderGroupBaseAlignment);
+            outLayout.Capacities[group] = outLayout.Strides[group] * (outLayout.Counts[group] + reserves[group]);
+            outLayout.TotalSize = outLayout.Offsets[group] + outLayout.Capacities[group];
+        }
+
+        return outLayout;
+    }
+
+
+    // where the records are written on the host, device local buffers can't be mapped so they have a host copy
+    static uint8_t *get_record_data(SBTBuffer &buffer) {
+
+        if (buffer.Placement == SBTPlacement::DeviceLocal)
+            return buffer.HostData.data();
+
+        return (uint8_t *)buffer.Buffer.MappedData;
+    }
+
+
+    // copies the handle of every group to the start of its record, the rest of the records is left untouched
+    static void write_group_handles(SBTBuffer &buffer, const SBTInfo &sbt, const sbt_layout &layout, const std::vector<uint8_t> &handles,
+        uint32_t handleSize) {
+
+        uint8_t *mappedData = get_record_data(buffer);
+        const auto indices = get_indices(sbt);
+
+        for (uint32_t group = 0; group < SHADER_GROUP_COUNT; group++) {
+
+            uint8_t *record = mappedData + buffer.Offsets[group];
+            for (uint32_t shaderIndex : *indices[group]) {
+
+                memcpy(record, handles.data() + (size_t)shaderIndex * handleSize, handleSize);
+                record += layout.Strides[group];
+            }
+        }
+    }
+
+
+    // we don't want to set stride when there is no shader of that type
+    static void set_regions(SBTBuffer &buffer, const sbt_layout &layout) {
+
+        auto regions = get_regions(buffer);
+        for (uint32_t group = 0; group < SHADER_GROUP_COUNT; group++) {
+
+            if (layout.Counts[group] == 0) {
+
+                *regions[group] = vk::StridedDeviceAddressRegionKHR();
+                continue;
+            }
+
+            *regions[group] = vk::StridedDeviceAddressRegionKHR()
+                .setDeviceAddress(buffer.Buffer.DevAddress + buffer.Offsets[group])
+                .setStride(layout.Strides[group])
+                .setSize(layout.Strides[group] * layout.Counts[group]);
+        }
+    }
+
     // CLASS IMPLEMENTATION ============================================================================================
 
     // CLASS PUBLIC ====================================================================================================
@@ -48,35 +146,16 @@ namespace vr {
     }
 
 
-    void vk_ray_device::WriteToSBT(SBTBuffer sbtBuf, ShaderGroup group, uint32_t groupIndex, void *data, uint32_t dataSize, void *mappedData) {
-
-        allocated_buffer* buffer = nullptr;
-        vk::StridedDeviceAddressRegionKHR *addressRegion;
-        switch (group) {
-
-            case ShaderGroup::RayGen:
-                buffer = &sbtBuf.RayGenBuffer;
-                addressRegion = &sbtBuf.RayGenRegion;
-                break;
-            case ShaderGroup::Miss:
-                buffer = &sbtBuf.MissBuffer;
-                addressRegion = &sbtBuf.MissRegion;
-                break;
-            case ShaderGroup::HitGroup:
-                buffer = &sbtBuf.HitGroupBuffer;
-                addressRegion = &sbtBuf.HitGroupRegion;
-                break;
-            case ShaderGroup::Callable:
-                buffer = &sbtBuf.CallableBuffer;
-                addressRegion = &sbtBuf.CallableRegion;
-                break;
-        }
-        if (!buffer) {
+    void vk_ray_device::WriteToSBT(SBTBuffer &sbtBuf, ShaderGroup group, uint32_t groupIndex, void *data, uint32_t dataSize, void *mappedData) {
+
+        if ((uint32_t)group >= SHADER_GROUP_COUNT) {
 
             VR_LOG(error, "WriteToSBT: Invalid shader group");
             return;
         }
 
+        const vk::StridedDeviceAddressRegionKHR *addressRegion = get_regions(sbtBuf)[(uint32_t)group];
+
         // Offset to the start of the requested group and apply the opaque handle size for the SBT
         uint32_t offset = (groupIndex * addressRegion->stride) + m_ray_tracing_properties.shaderGroupHandleSize;
 
@@ -87,306 +166,332 @@ namespace vr {
             return;
         }
 
-        if (mappedData)
-            memcpy((uint8_t *)mappedData + offset, data, dataSize);     // if we have a mapped buffer, just copy the data
+        // all the regions share one buffer
+        offset += static_cast<uint32_t>(sbtBuf.Offsets[(uint32_t)group]);
+
+        if (sbtBuf.Placement == SBTPlacement::DeviceLocal) {
+
+            // the upload of the record is recorded by the next UploadSBT(...)
+            memcpy(sbtBuf.HostData.data() + offset, data, dataSize);
+            sbtBuf.DirtyRanges.Add(offset, dataSize);
+        }
+        else if (mappedData) {
+
+            // the caller's mapping is of the same allocation, so the record is flushed like UpdateBuffer(...) does
+            memcpy((uint8_t *)mappedData + offset, data, dataSize);
+            FlushBuffer(sbtBuf.Buffer, offset, dataSize);
+        }
         else
-            UpdateBuffer(*buffer, data, dataSize, offset);              // else we update the buffer with the data
+            UpdateBuffer(sbtBuf.Buffer, data, dataSize, offset);        // else we update the buffer with the data
     }
 
 
-    SBTBuffer vk_ray_device::CreateSBT(vk::Pipeline pipeline, const SBTInfo &sbt) {
-        SBTBuffer outSBT;
+    bool vk_ray_device::UploadSBT(SBTBuffer &buffer, vk::CommandBuffer cmdBuf) {
 
-        const uint32_t rgen_count = sbt.RayGenIndices.size();
-        const uint32_t miss_count = sbt.MissIndices.size();
-        const uint32_t hit_count = sbt.HitGroupIndices.size();
-        const uint32_t call_count = sbt.CallableIndices.size();
-        // const uint32_t groupsCount = rgen_count + miss_count + hit_count + call_count;
-        const uint32_t handleSize = m_ray_tracing_properties.shaderGroupHandleSize;
+        if (buffer.DirtyRanges.IsEmpty())
+            return false;
 
-        uint32_t rgen_size = AlignUp(sbt.RayGenShaderRecordSize + handleSize, m_ray_tracing_properties.shaderGroupHandleAlignment);
-        uint32_t miss_size = AlignUp(sbt.MissShaderRecordSize + handleSize, m_ray_tracing_properties.shaderGroupHandleAlignment);
-        uint32_t hit_size = AlignUp(sbt.HitGroupRecordSize + handleSize, m_ray_tracing_properties.shaderGroupHandleAlignment);
-        uint32_t call_size = AlignUp(sbt.CallableShaderRecordSize + handleSize, m_ray_tracing_properties.shaderGroupHandleAlignment);
+        const auto &dirtyRanges = buffer.DirtyRanges.GetRanges(RECORD_MERGE_GAP);
 
-        // Create all buffers for the SBT
-        if (sbt.RayGenIndices.size() || sbt.ReserveRayGenGroups)
-            outSBT.RayGenBuffer = create_buffer(
-                rgen_size * (rgen_count + sbt.ReserveRayGenGroups),
-                vk::BufferUsageFlagBits::eShaderDeviceAddressKHR | vk::BufferUsageFlagBits::eShaderBindingTableKHR,
-                VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT, m_ray_tracing_properties.shaderGroupBaseAlignment);
+        // the records were written straight into the buffer, they only have to be made visible to the device
+        if (buffer.Placement == SBTPlacement::HostVisible) {
 
-        if (sbt.MissIndices.size() || sbt.ReserveMissGroups)
-            outSBT.MissBuffer = create_buffer(
-                miss_size * (miss_count + sbt.ReserveMissGroups),
-                vk::BufferUsageFlagBits::eShaderDeviceAddressKHR | vk::BufferUsageFlagBits::eShaderBindingTableKHR,
-                VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT, m_ray_tracing_properties.shaderGroupBaseAlignment);
+            for (const auto &range : dirtyRanges)
+                FlushBuffer(buffer.Buffer, range.Offset, range.Size);
 
-        if (sbt.HitGroupIndices.size() || sbt.ReserveHitGroups)
-            outSBT.HitGroupBuffer = create_buffer(
-                hit_size * (hit_count + sbt.ReserveHitGroups),
-                vk::BufferUsageFlagBits::eShaderDeviceAddressKHR | vk::BufferUsageFlagBits::eShaderBindingTableKHR,
-                VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT, m_ray_tracing_properties.shaderGroupBaseAlignment);
+            buffer.DirtyRanges.Clear();
+            return false;
+        }
 
-        if (sbt.CallableIndices.size() || sbt.ReserveCallableGroups)
-            outSBT.CallableBuffer = create_buffer(
-                call_size * (call_count + sbt.ReserveCallableGroups),
-                vk::BufferUsageFlagBits::eShaderDeviceAddressKHR | vk::BufferUsageFlagBits::eShaderBindingTableKHR,
-                VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT, m_ray_tracing_properties.shaderGroupBaseAlignment);
-
-        // For filling the stride and size of the regions, we don't want to set stride when there is no shader of that
-        // type. We didn't do this earlier because we needed to know the size of the shader group handles to reserve
-        // space for them.
-        if (rgen_count == 0)        rgen_size = 0;
-        if (miss_count == 0)        miss_size = 0;
-        if (hit_count == 0)         hit_size = 0;
-        if (call_count == 0)        call_size = 0;
-
-        // fill in offsets for all shader groups
-        if (rgen_count > 0)
-            outSBT.RayGenRegion = vk::StridedDeviceAddressRegionKHR()
-                .setDeviceAddress(outSBT.RayGenBuffer.DevAddress)
-                .setStride(rgen_size)
-                .setSize(rgen_size * rgen_count);
-
-        if (miss_count > 0)
-            outSBT.MissRegion = vk::StridedDeviceAddressRegionKHR()
-                .setDeviceAddress(outSBT.MissBuffer.DevAddress)
-                .setStride(miss_size)
-                .setSize(miss_size * miss_count);
-
-        if (hit_count > 0)
-            outSBT.HitGroupRegion = vk::StridedDeviceAddressRegionKHR()
-                .setDeviceAddress(outSBT.HitGroupBuffer.DevAddress)
-                .setStride(hit_size)
-                .setSize(hit_size * hit_count);
-
-        if (call_count > 0)
-            outSBT.CallableRegion = vk::StridedDeviceAddressRegionKHR()
-                .setDeviceAddress(outSBT.CallableBuffer.DevAddress)
-                .setStride(call_size)
-                .setSize(call_size * call_count);
-
-        // const uint8_t* opaqueHandle = new uint8_t[handleSize];
-
-        // copy records and shader handles into the SBT buffer
-        uint8_t *rgenData = rgen_size > 0 ? (uint8_t *)MapBuffer(outSBT.RayGenBuffer) : nullptr;
-        for (uint32_t i = 0; rgenData && i < rgen_count; i++)
-        {
-            uint32_t shaderIndex = sbt.RayGenIndices[i];
-            const uint8_t *dest = rgenData + (i * rgen_size);
-            get_handles_for_sbtbuffer(pipeline, shaderIndex, 1, (void *)dest);
-            rgenData += rgen_size; // advance to the next record
+        const vk::DeviceSize uploadSize = buffer.DirtyRanges.GetTotalSize(RECORD_MERGE_GAP);
+        const vk::DeviceSize sliceSize = AlignUp((uint64_t)buffer.Buffer.Size, STAGING_SLICE_ALIGNMENT);
+
+        // one persistent staging slice per frame in flight, a slice is reused when its frame is done on the GPU
+        if (!buffer.Staging.Buffer || buffer.Staging.Size < sliceSize * m_frames_in_flight) {
+
+            if (buffer.Staging.Buffer)
+                RetireBuffer(buffer.Staging);
+
+            buffer.Staging = create_buffer(sliceSize * m_frames_in_flight, vk::BufferUsageFlagBits::eTransferSrc,
+                VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT);
+            buffer.StagingUsed = 0;
+        }
+
+        const uint64_t frameIndex = m_frame_index;
+        if (buffer.StagingFrame != frameIndex) {
+
+            buffer.StagingFrame = frameIndex;
+            buffer.StagingUsed = 0;
         }
-        uint8_t *missData = miss_size > 0 ? (uint8_t *)MapBuffer(outSBT.MissBuffer) : nullptr;
-        for (uint32_t i = 0; missData && i < miss_count; i++)
-        {
-            uint32_t shaderIndex = sbt.MissIndices[i];
-            const uint8_t *dest = missData + (i * miss_size);
-            get_handles_for_sbtbuffer(pipeline, shaderIndex, 1, (void *)dest);
+
+        // several uploads in one frame can fill the slice, the overflow gets a staging buffer of its own
+        allocated_buffer stagingBuffer = buffer.Staging;
+        vk::DeviceSize stagingOffset = 0;
+        const bool ownStaging = !buffer.Staging.MappedData || buffer.StagingUsed + uploadSize > sliceSize;
+        if (ownStaging) {
+
+            stagingBuffer = create_buffer(uploadSize, vk::BufferUsageFlagBits::eTransferSrc,
+                VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT);
         }
-        uint8_t *hitData = hit_size > 0 ? (uint8_t *)MapBuffer(outSBT.HitGroupBuffer) : nullptr;
-        for (uint32_t i = 0; hitData && i < hit_count; i++)
-        {
-            uint32_t shaderIndex = sbt.HitGroupIndices[i];
-            const uint8_t *dest = hitData + (i * hit_size);
-            get_handles_for_sbtbuffer(pipeline, shaderIndex, 1, (void *)dest);
+        else {
+
+            stagingOffset = (frameIndex % (buffer.Staging.Size / sliceSize)) * sliceSize + buffer.StagingUsed;
+            buffer.StagingUsed += uploadSize;
         }
-        uint8_t *callData = call_size > 0 ? (uint8_t *)MapBuffer(outSBT.CallableBuffer) : nullptr;
-        for (uint32_t i = 0; callData && i < call_count; i++)
-        {
-            uint32_t shaderIndex = sbt.CallableIndices[i];
-            const uint8_t *dest = callData + (i * call_size);
-            get_handles_for_sbtbuffer(pipeline, shaderIndex, 1, (void *)dest);
+
+        std::vector<vk::BufferCopy> copyRegions;
+        copyRegions.reserve(dirtyRanges.size());
+
+        uint8_t *stagingData = (uint8_t *)stagingBuffer.MappedData;
+        const vk::DeviceSize firstStagingOffset = stagingOffset;
+        for (const auto &range : dirtyRanges) {
+
+            memcpy(stagingData + stagingOffset, buffer.HostData.data() + range.Offset, range.Size);
+            copyRegions.push_back(vk::BufferCopy()
+                .setSrcOffset(stagingOffset)
+                .setDstOffset(range.Offset)
+                .setSize(range.Size));
+            stagingOffset += range.Size;
         }
+        FlushBuffer(stagingBuffer, firstStagingOffset, uploadSize);
+
+        // the dispatches of the previous frame may still read the records
+        barrier_batch barriers;
+        barriers.AddMemoryBarrier(ResourceAccess::ShaderBindingTableRead, ResourceAccess::TransferWrite);
+        barriers.Flush(cmdBuf);
+
+        CopyData(stagingBuffer, buffer.Buffer, copyRegions, cmdBuf);
+
+        barriers.AddMemoryBarrier(ResourceAccess::TransferWrite, ResourceAccess::ShaderBindingTableRead);
+        barriers.Flush(cmdBuf);
 
-        // unmap all the buffers
-        if (rgenData)
-            UnmapBuffer(outSBT.RayGenBuffer);
-        if (missData)
-            UnmapBuffer(outSBT.MissBuffer);
-        if (hitData)
-            UnmapBuffer(outSBT.HitGroupBuffer);
-        if (callData)
-            UnmapBuffer(outSBT.CallableBuffer);
+        if (ownStaging)
+            RetireBuffer(stagingBuffer);
+        buffer.DirtyRanges.Clear();
+
+        return true;
+    }
+
+
+    SBTBuffer vk_ray_device::CreateSBT(vk::Pipeline pipeline, const SBTInfo &sbt) {
+
+        SBTBuffer outSBT;
+
+        const sbt_layout layout = compute_sbt_layout(m_ray_tracing_properties, sbt);
+        if (layout.TotalSize == 0)
+            return outSBT;
+
+        // one allocation for all the shader types, aligned so that the first region is at the base alignment too
+        outSBT.Placement = sbt.Placement;
+        if (sbt.Placement == SBTPlacement::DeviceLocal) {
+
+            // the records are built in the host copy, the whole buffer is uploaded by the first UploadSBT(...)
+            outSBT.Buffer = create_buffer(
+                layout.TotalSize,
+                vk::BufferUsageFlagBits::eShaderDeviceAddressKHR | vk::BufferUsageFlagBits::eShaderBindingTableKHR | vk::BufferUsageFlagBits::eTransferDst,
+                0, m_ray_tracing_properties.shaderGroupBaseAlignment);
+            outSBT.HostData.resize(layout.TotalSize);
+            outSBT.DirtyRanges.Add(0, layout.TotalSize);
+        }
+        else {
+
+            outSBT.Buffer = create_buffer(
+                layout.TotalSize,
+                vk::BufferUsageFlagBits::eShaderDeviceAddressKHR | vk::BufferUsageFlagBits::eShaderBindingTableKHR,
+                VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT, m_ray_tracing_properties.shaderGroupBaseAlignment);
+        }
+        outSBT.Offsets = layout.Offsets;
+        outSBT.Capacities = layout.Capacities;
+
+        set_regions(outSBT, layout);
+
+        // copy the shader handles into the SBT buffer
+        write_group_handles(outSBT, sbt, layout, get_group_handles(pipeline, sbt), m_ray_tracing_properties.shaderGroupHandleSize);
+        if (outSBT.Placement == SBTPlacement::HostVisible)
+            FlushBuffer(outSBT.Buffer);
 
         return outSBT;
     }
 
-    bool vk_ray_device::RebuildSBT(vk::Pipeline pipeline, SBTBuffer &buffer, const SBTInfo &sbt)
-    {
-        if (!CanSBTFitShaders(buffer, sbt))
-            return false;
 
-        const uint32_t rgen_count = sbt.RayGenIndices.size();
-        const uint32_t miss_count = sbt.MissIndices.size();
-        const uint32_t hit_count = sbt.HitGroupIndices.size();
-        const uint32_t call_count = sbt.CallableIndices.size();
-        // const uint32_t groupsCount = rgen_count + miss_count + hit_count + call_count;
+    bool vk_ray_device::RebuildSBT(vk::Pipeline pipeline, SBTBuffer &buffer, const SBTInfo &sbt) {
 
-        const uint32_t handleSize = AlignUp(m_ray_tracing_properties.shaderGroupHandleSize, m_ray_tracing_properties.shaderGroupHandleAlignment);
-        const uint32_t rgen_size = AlignUp(sbt.RayGenShaderRecordSize + handleSize, m_ray_tracing_properties.shaderGroupHandleAlignment);
-        const uint32_t miss_size = AlignUp(sbt.MissShaderRecordSize + handleSize, m_ray_tracing_properties.shaderGroupHandleAlignment);
-        const uint32_t hit_size = AlignUp(sbt.HitGroupRecordSize + handleSize, m_ray_tracing_properties.shaderGroupHandleAlignment);
-        const uint32_t call_size = AlignUp(sbt.CallableShaderRecordSize + handleSize, m_ray_tracing_properties.shaderGroupHandleAlignment);
+        if (!CanSBTFitShaders(buffer, sbt))
+            return false;
 
         // we have to rewrite opaque handles to all the groups in the SBT, because on some implementations just keeping
         // the old opaque handles and adding new opaque handles to the new added groups doesn't work
+        const sbt_layout layout = compute_sbt_layout(m_ray_tracing_properties, sbt);
+        write_group_handles(buffer, sbt, layout, get_group_handles(pipeline, sbt), m_ray_tracing_properties.shaderGroupHandleSize);
+        if (buffer.Placement == SBTPlacement::DeviceLocal) {
 
-        // const uint8_t* opaqueHandle = new uint8_t[handleSize];
-
-        // copy records and shader handles into the SBT buffer
-        uint8_t *rgenData = rgen_size > 0 ? (uint8_t *)MapBuffer(buffer.RayGenBuffer) : nullptr;
-        for (uint32_t i = 0; rgenData && i < rgen_count; i++)
-        {
-            uint32_t shaderIndex = sbt.RayGenIndices[i];
-            const uint8_t *dest = rgenData + (i * rgen_size);
-            get_handles_for_sbtbuffer(pipeline, shaderIndex, 1, (void *)dest);
-            rgenData += rgen_size; // advance to the next record
-        }
-        uint8_t *missData = miss_size > 0 ? (uint8_t *)MapBuffer(buffer.MissBuffer) : nullptr;
-        for (uint32_t i = 0; missData && i < miss_count; i++)
-        {
-            uint32_t shaderIndex = sbt.MissIndices[i];
-            const uint8_t *dest = missData + (i * miss_size);
-            get_handles_for_sbtbuffer(pipeline, shaderIndex, 1, (void *)dest);
-        }
-        uint8_t *hitData = hit_size > 0 ? (uint8_t *)MapBuffer(buffer.HitGroupBuffer) : nullptr;
-        for (uint32_t i = 0; hitData && i < hit_count; i++)
-        {
-            uint32_t shaderIndex = sbt.HitGroupIndices[i];
-            const uint8_t *dest = hitData + (i * hit_size);
-            get_handles_for_sbtbuffer(pipeline, shaderIndex, 1, (void *)dest);
-        }
-        uint8_t *callData = call_size > 0 ? (uint8_t *)MapBuffer(buffer.CallableBuffer) : nullptr;
-        for (uint32_t i = 0; callData && i < call_count; i++)
-        {
-            uint32_t shaderIndex = sbt.CallableIndices[i];
-            const uint8_t *dest = callData + (i * call_size);
-            get_handles_for_sbtbuffer(pipeline, shaderIndex, 1, (void *)dest);
+            for (uint32_t group = 0; group < SHADER_GROUP_COUNT; group++)
+                buffer.DirtyRanges.Add(buffer.Offsets[group], layout.Strides[group] * layout.Counts[group]);
         }
-
-        // unmap all the buffers
-        if (rgenData)
-            UnmapBuffer(buffer.RayGenBuffer);
-        if (missData)
-            UnmapBuffer(buffer.MissBuffer);
-        if (hitData)
-            UnmapBuffer(buffer.HitGroupBuffer);
-        if (callData)
-            UnmapBuffer(buffer.CallableBuffer);
+        else
+            FlushBuffer(buffer.Buffer);
 
         // Some groups may have gotten additional shaders, so we need to update the stride and size of the regions
         // We don't have to worry about the buffer sizes if they don't fit as it is already checked at the beginning of
         // this function
-
-        if (rgen_count > 0)
-            buffer.RayGenRegion = vk::StridedDeviceAddressRegionKHR()
-                                      .setDeviceAddress(buffer.RayGenBuffer.DevAddress)
-                                      .setStride(rgen_size)
-                                      .setSize(rgen_size * rgen_count);
-        if (miss_count > 0)
-            buffer.MissRegion = vk::StridedDeviceAddressRegionKHR()
-                                    .setDeviceAddress(buffer.MissBuffer.DevAddress)
-                                    .setStride(miss_size)
-                                    .setSize(miss_size * miss_count);
-        if (hit_count > 0)
-            buffer.HitGroupRegion = vk::StridedDeviceAddressRegionKHR()
-                                        .setDeviceAddress(buffer.HitGroupBuffer.DevAddress)
-                                        .setStride(hit_size)
-                                        .setSize(hit_size * hit_count);
-        if (call_count > 0)
-            buffer.CallableRegion = vk::StridedDeviceAddressRegionKHR()
-                                        .setDeviceAddress(buffer.CallableBuffer.DevAddress)
-                                        .setStride(call_size)
-                                        .setSize(call_size * call_count);
+        set_regions(buffer, layout);
 
         return true;
     }
 
-    void vk_ray_device::CopySBT(SBTBuffer &src, SBTBuffer &dst)
-    {
-        uint8_t *dstRgenData = dst.RayGenRegion.size > 0 ? (uint8_t *)MapBuffer(dst.RayGenBuffer) : nullptr;
-        uint8_t *dstMissData = dst.MissRegion.size > 0 ? (uint8_t *)MapBuffer(dst.MissBuffer) : nullptr;
-        uint8_t *dstHitData = dst.HitGroupRegion.size > 0 ? (uint8_t *)MapBuffer(dst.HitGroupBuffer) : nullptr;
-        uint8_t *dstCallData = dst.CallableRegion.size > 0 ? (uint8_t *)MapBuffer(dst.CallableBuffer) : nullptr;
-
-        uint8_t *srcRgenData = src.RayGenRegion.size > 0 ? (uint8_t *)MapBuffer(src.RayGenBuffer) : nullptr;
-        uint8_t *srcMissData = src.MissRegion.size > 0 ? (uint8_t *)MapBuffer(src.MissBuffer) : nullptr;
-        uint8_t *srcHitData = src.HitGroupRegion.size > 0 ? (uint8_t *)MapBuffer(src.HitGroupBuffer) : nullptr;
-        uint8_t *srcCallData = src.CallableRegion.size > 0 ? (uint8_t *)MapBuffer(src.CallableBuffer) : nullptr;
-
-        if (dstRgenData && srcRgenData)
-            memcpy(dstRgenData, srcRgenData, src.RayGenRegion.size);
-        if (dstMissData && srcMissData)
-            memcpy(dstMissData, srcMissData, src.MissRegion.size);
-        if (dstHitData && srcHitData)
-            memcpy(dstHitData, srcHitData, src.HitGroupRegion.size);
-        if (dstCallData && srcCallData)
-            memcpy(dstCallData, srcCallData, src.CallableRegion.size);
-
-        if (dstRgenData)
-            UnmapBuffer(dst.RayGenBuffer);
-        if (dstMissData)
-            UnmapBuffer(dst.MissBuffer);
-        if (dstHitData)
-            UnmapBuffer(dst.HitGroupBuffer);
-        if (dstCallData)
-            UnmapBuffer(dst.CallableBuffer);
-
-        if (srcRgenData)
-            UnmapBuffer(src.RayGenBuffer);
-        if (srcMissData)
-            UnmapBuffer(src.MissBuffer);
-        if (srcHitData)
-            UnmapBuffer(src.HitGroupBuffer);
-        if (srcCallData)
-            UnmapBuffer(src.CallableBuffer);
+
+    bool vk_ray_device::GrowSBT(vk::Pipeline pipeline, SBTBuffer &buffer, const SBTInfo &sbt) {
+
+        if (buffer.Buffer.Buffer && buffer.Placement == sbt.Placement && RebuildSBT(pipeline, buffer, sbt))
+            return false;
+
+        // the regions that don't fit grow geometrically, the others keep their capacity
+        const sbt_layout layout = compute_sbt_layout(m_ray_tracing_properties, sbt);
+        SBTInfo grownInfo = sbt;
+        const std::array<uint32_t*, SHADER_GROUP_COUNT> reserves = { &grownInfo.ReserveRayGenGroups, &grownInfo.ReserveMissGroups,
+            &grownInfo.ReserveHitGroups, &grownInfo.ReserveCallableGroups };
+
+        for (uint32_t group = 0; group < SHADER_GROUP_COUNT; group++) {
+
+            const uint64_t oldCapacity = layout.Strides[group] > 0 ? buffer.Capacities[group] / layout.Strides[group] : 0;
+            uint64_t capacity = oldCapacity;
+            if (layout.Counts[group] > oldCapacity)
+                capacity = std::max<uint64_t>(layout.Counts[group] + *reserves[group], oldCapacity * SBT_GROWTH_FACTOR);
+
+            *reserves[group] = static_cast<uint32_t>(capacity - layout.Counts[group]);
+        }
+
+        SBTBuffer grownSBT = CreateSBT(pipeline, grownInfo);
+        if (!grownSBT.Buffer.Buffer) {
+
+            VR_LOG(error, "GrowSBT: Failed to create the new SBT buffer, the old one is kept");
+            return false;
+        }
+
+        // the old buffer may still be read by the frames in flight
+        if (buffer.Buffer.Buffer) {
+
+            copy_sbt_records(buffer, grownSBT);
+            RetireBuffer(buffer.Buffer);
+            if (buffer.Staging.Buffer)
+                RetireBuffer(buffer.Staging);                           // the grown buffer needs bigger slices
+        }
+
+        buffer = std::move(grownSBT);
+        return true;
     }
 
 
-    bool vk_ray_device::CanSBTFitShaders(SBTBuffer &buffer, const SBTInfo &sbtInfo) {
+    void vk_ray_device::CopySBT(SBTBuffer &src, SBTBuffer &dst) {
+
+        if (!src.Buffer.Buffer || !dst.Buffer.Buffer)
+            return;
+
+        // device local buffers are copied from and to their host copy
+        uint8_t *srcData = src.Placement == SBTPlacement::DeviceLocal ? src.HostData.data() : (uint8_t *)MapBuffer(src.Buffer);
+        uint8_t *dstData = dst.Placement == SBTPlacement::DeviceLocal ? dst.HostData.data() : (uint8_t *)MapBuffer(dst.Buffer);
+
+        // the regions may start at different offsets in the two buffers
+        auto srcRegions = get_regions(src);
+        for (uint32_t group = 0; group < SHADER_GROUP_COUNT; group++) {
 
-        bool extendable = true;
+            vk::DeviceSize size = std::min(srcRegions[group]->size, dst.Capacities[group]);
+            if (size == 0)
+                continue;
+
+            memcpy(dstData + dst.Offsets[group], srcData + src.Offsets[group], size);
+            if (dst.Placement == SBTPlacement::DeviceLocal)
+                dst.DirtyRanges.Add(dst.Offsets[group], size);
+        }
+
+        if (dst.Placement == SBTPlacement::HostVisible) {
+
+            FlushBuffer(dst.Buffer);
+            UnmapBuffer(dst.Buffer);
+        }
+        if (src.Placement == SBTPlacement::HostVisible)
+            UnmapBuffer(src.Buffer);
+    }
 
-        const uint32_t rgen_size = AlignUp(sbtInfo.RayGenShaderRecordSize + m_ray_tracing_properties.shaderGroupHandleSize, m_ray_tracing_properties.shaderGroupHandleAlignment);
-        const uint32_t miss_size = AlignUp(sbtInfo.MissShaderRecordSize + m_ray_tracing_properties.shaderGroupHandleSize, m_ray_tracing_properties.shaderGroupHandleAlignment);
-        const uint32_t hit_size = AlignUp(sbtInfo.HitGroupRecordSize + m_ray_tracing_properties.shaderGroupHandleSize, m_ray_tracing_properties.shaderGroupHandleAlignment);
-        const uint32_t call_size = AlignUp(sbtInfo.CallableShaderRecordSize + m_ray_tracing_properties.shaderGroupHandleSize, m_ray_tracing_properties.shaderGroupHandleAlignment);
 
-        const uint32_t rgen_bytes_needed = sbtInfo.RayGenIndices.size() * rgen_size;
-        const uint32_t miss_bytes_needed = sbtInfo.MissIndices.size() * miss_size;
-        const uint32_t hit_bytes_needed = sbtInfo.HitGroupIndices.size() * hit_size;
-        const uint32_t call_bytes_needed = sbtInfo.CallableIndices.size() * call_size;
+    bool vk_ray_device::CanSBTFitShaders(SBTBuffer &buffer, const SBTInfo &sbtInfo) {
 
-        if (rgen_bytes_needed > buffer.RayGenBuffer.Size)       return false;
-        if (miss_bytes_needed > buffer.MissBuffer.Size)         return false;
-        if (hit_bytes_needed > buffer.HitGroupBuffer.Size)      return false;
-        if (call_bytes_needed > buffer.CallableBuffer.Size)     return false;
+        const sbt_layout layout = compute_sbt_layout(m_ray_tracing_properties, sbtInfo);
+        for (uint32_t group = 0; group < SHADER_GROUP_COUNT; group++)
+            if (layout.Counts[group] * layout.Strides[group] > buffer.Capacities[group])
+                return false;
 
-        return extendable;
+        return true;
     }
 
 
     void vk_ray_device::DestroySBTBuffer(SBTBuffer &buffer){
 
-        // destroy all the buffers if they were created
-        if (buffer.RayGenBuffer.Buffer)
-            DestroyBuffer(buffer.RayGenBuffer);
-        if (buffer.MissBuffer.Buffer)
-            DestroyBuffer(buffer.MissBuffer);
-        if (buffer.HitGroupBuffer.Buffer)
-            DestroyBuffer(buffer.HitGroupBuffer);
-        if (buffer.CallableBuffer.Buffer)
-            DestroyBuffer(buffer.CallableBuffer);
-        buffer.RayGenRegion = vk::StridedDeviceAddressRegionKHR();
-        buffer.MissRegion = vk::StridedDeviceAddressRegionKHR();
-        buffer.HitGroupRegion = vk::StridedDeviceAddressRegionKHR();
-        buffer.CallableRegion = vk::StridedDeviceAddressRegionKHR();
+        // destroy the buffer if it was created
+        if (buffer.Buffer.Buffer)
+            DestroyBuffer(buffer.Buffer);
+        if (buffer.Staging.Buffer)
+            DestroyBuffer(buffer.Staging);
+
+        buffer = SBTBuffer();
     }
 
     // CLASS PROTECTED =================================================================================================
 
     // CLASS PRIVATE ===================================================================================================
 
+    std::vector<uint8_t> vk_ray_device::get_group_handles(vk::Pipeline pipeline, const SBTInfo &sbt) {
+
+        uint32_t groupCount = 0;
+        for (auto *indices : get_indices(sbt))
+            for (uint32_t index : *indices)
+                groupCount = std::max(groupCount, index + 1);
+
+        // one driver call for all the groups, the handles are tightly packed
+        const uint32_t handleSize = m_ray_tracing_properties.shaderGroupHandleSize;
+        std::vector<uint8_t> outHandles((size_t)groupCount * handleSize);
+        if (groupCount == 0)
+            return outHandles;
+
+        auto result = m_device.getRayTracingShaderGroupHandlesKHR(pipeline, 0, groupCount, outHandles.size(), outHandles.data(), m_dyn_loader);
+        if (result != vk::Result::eSuccess)
+            VR_LOG(error, "get_group_handles: Failed to get ray tracing shader group handles");
+
+        return outHandles;
+    }
+
+
+    void vk_ray_device::copy_sbt_records(SBTBuffer &src, SBTBuffer &dst) {
+
+        const uint32_t handleSize = m_ray_tracing_properties.shaderGroupHandleSize;
+
+        // copied on the host, so the records are in dst as soon as GrowSBT(...) returns and later writes can't be
+        // overwritten by a copy that is still pending
+        uint8_t *srcData = get_record_data(src);
+        uint8_t *dstData = get_record_data(dst);
+
+        // the handles of dst belong to the new pipeline, so only the data after the handles is copied
+        auto srcRegions = get_regions(src);
+        auto dstRegions = get_regions(dst);
+        for (uint32_t group = 0; group < SHADER_GROUP_COUNT; group++) {
+
+            const vk::DeviceSize srcStride = srcRegions[group]->stride;
+            const vk::DeviceSize dstStride = dstRegions[group]->stride;
+            if (srcStride == 0 || dstStride == 0 || std::min(srcStride, dstStride) <= handleSize)
+                continue;
+
+            const vk::DeviceSize dataSize = std::min(srcStride, dstStride) - handleSize;
+            const vk::DeviceSize recordCount = std::min(srcRegions[group]->size / srcStride, dst.Capacities[group] / dstStride);
+            for (vk::DeviceSize record = 0; record < recordCount; record++) {
+
+                const vk::DeviceSize srcOffset = src.Offsets[group] + record * srcStride + handleSize;
+                const vk::DeviceSize dstOffset = dst.Offsets[group] + record * dstStride + handleSize;
+                memcpy(dstData + dstOffset, srcData + srcOffset, dataSize);
+            }
+        }
+
+        // device local buffers were created fully dirty, so the next UploadSBT(...) uploads the copied records
+        if (dst.Placement == SBTPlacement::HostVisible)
+            FlushBuffer(dst.Buffer);
+    }
 }
@@ -14,10 +14,34 @@ namespace vr {
 
     // TYPES ===========================================================================================================
 
+    // a module of the shader module cache, shared by all the shaders with the same SPIR-V
+    struct shader_module_entry {
+
+        std::vector<uint32_t>                                   Code;                       // compared on hash collisions
+        vk::ShaderModule                                        Module = nullptr;           // created lazily if identifiers are used
+        vk::ShaderModuleIdentifierEXT                           IdentifierData = {};
+        vk::PipelineShaderStageModuleIdentifierCreateInfoEXT    IdentifierInfo = {};
+        uint32_t                                                RefCount = 0;
+    };
+
     // STATIC VARIABLES ================================================================================================
 
     // FUNCTION IMPLEMENTATION =========================================================================================
 
+    // hashes whole words, SPIR-V is always a multiple of 4 bytes
+    static uint64_t hash_spirv(const std::vector<uint32_t> &spv) {
+
+        uint64_t hash = 0x9e3779b97f4a7c15ull ^ spv.size();
+        for (uint32_t word : spv) {
+
+            hash ^= word;
+            hash *= 0xff51afd7ed558ccdull;
+            hash ^= hash >> 32;
+        }
+
+        return hash != 0 ? hash : 1;                                        // 0 marks shaders that aren't cached
+    }
+
     // CLASS IMPLEMENTATION ============================================================================================
 
     Shader vk_ray_device::CreateShaderFromSPV(const std::vector<uint32_t>& spv) {
@@ -29,12 +53,82 @@ namespace vr {
             return outShader; // return empty shader, because no shader was created
         }
 
-        outShader.Module = CreateShaderModule(spv);
+        outShader.Hash = hash_spirv(spv);
+
+        std::lock_guard<std::mutex> lock(m_shader_module_mutex);
+
+        // material systems pass the same SPIR-V many times, so most calls end here
+        auto [begin, end] = m_shader_modules.equal_range(outShader.Hash);
+        for (auto it = begin; it != end; ++it) {
+
+            shader_module_entry &entry = *it->second;
+            if (entry.Code != spv)
+                continue;
+
+            entry.RefCount++;
+            outShader.Module = entry.Module;
+            outShader.Identifier = entry.Module ? nullptr : &entry.IdentifierInfo;
+            return outShader;
+        }
+
+        auto entry = std::make_shared<shader_module_entry>();
+        entry->Code = spv;
+        entry->RefCount = 1;
+
+        if (m_use_module_identifiers) {
+
+            // the identifier is computed from the code, no module is created until a pipeline has to be compiled
+            auto moduleInfo = vk::ShaderModuleCreateInfo().setCode(entry->Code);
+            entry->IdentifierData = m_device.getShaderModuleCreateInfoIdentifierEXT(moduleInfo, m_dyn_loader);
+            entry->IdentifierInfo = vk::PipelineShaderStageModuleIdentifierCreateInfoEXT()
+                .setIdentifierSize(entry->IdentifierData.identifierSize)
+                .setPIdentifier(entry->IdentifierData.identifier);
+
+            outShader.Identifier = &entry->IdentifierInfo;
+        }
+        else {
+
+            entry->Module = CreateShaderModule(spv);
+            outShader.Module = entry->Module;
+        }
+
+        m_shader_modules.emplace(outShader.Hash, std::move(entry));
         return outShader;
     }
 
 
-    void vk_ray_device::DestroyShader(Shader &shader) { m_device.destroyShaderModule(shader.Module); }
+    void vk_ray_device::DestroyShader(Shader &shader) {
+
+        // modules of CreateShaderModule(...) are owned by the shader
+        if (shader.Hash == 0) {
+
+            m_device.destroyShaderModule(shader.Module);
+            shader = {};
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(m_shader_module_mutex);
+
+        auto [begin, end] = m_shader_modules.equal_range(shader.Hash);
+        for (auto it = begin; it != end; ++it) {
+
+            shader_module_entry &entry = *it->second;
+            if (shader.Identifier != &entry.IdentifierInfo && (!shader.Module || shader.Module != entry.Module))
+                continue;
+
+            if (--entry.RefCount == 0) {
+
+                m_device.destroyShaderModule(entry.Module);
+                m_shader_modules.erase(it);
+            }
+
+            shader = {};
+            return;
+        }
+
+        VR_LOG(warning, "DestroyShader: The shader is not in the shader module cache, it was already destroyed");
+        shader = {};
+    }
 
 
     vk::ShaderModule vk_ray_device::CreateShaderModule(const std::vector<uint32_t> &spvCode) {
@@ -51,4 +145,57 @@ namespace vr {
 
     // CLASS PRIVATE ===================================================================================================
 
+    vk::PipelineShaderStageCreateInfo vk_ray_device::make_shader_stage(const Shader &shader, vk::ShaderStageFlagBits stage, bool useModuleIdentifiers) {
+
+        auto outStage = vk::PipelineShaderStageCreateInfo()
+            .setStage(stage)
+            .setPName(shader.EntryPoint);
+
+        if (shader.Module)
+            outStage.setModule(shader.Module);
+        else if (useModuleIdentifiers)
+            outStage.setPNext(shader.Identifier);
+        else
+            outStage.setModule(get_cached_module(shader));
+
+        return outStage;
+    }
+
+
+    vk::ShaderModule vk_ray_device::get_cached_module(const Shader &shader) {
+
+        std::lock_guard<std::mutex> lock(m_shader_module_mutex);
+
+        auto [begin, end] = m_shader_modules.equal_range(shader.Hash);
+        for (auto it = begin; it != end; ++it) {
+
+            shader_module_entry &entry = *it->second;
+            if (shader.Identifier != &entry.IdentifierInfo)
+                continue;
+
+            // the pipeline cache missed, so the driver needs the code after all
+            if (!entry.Module)
+                entry.Module = CreateShaderModule(entry.Code);
+
+            return entry.Module;
+        }
+
+        VR_LOG(error, "get_cached_module: The shader is not in the shader module cache");
+        return nullptr;
+    }
+
+
+    void vk_ray_device::destroy_shader_modules() {
+
+        std::lock_guard<std::mutex> lock(m_shader_module_mutex);
+
+        if (!m_shader_modules.empty())
+            VR_LOG(warning, "vk_ray_device: {} cached shader modules were never destroyed", m_shader_modules.size());
+
+        for (auto &[hash, entry] : m_shader_modules)
+            m_device.destroyShaderModule(entry->Module);
+
+        m_shader_modules.clear();
+    }
+
 }
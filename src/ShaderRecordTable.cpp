@@ -0,0 +1,96 @@
+
+#include "pch.h"
+
+#include "VkRay/ShaderRecordTable.h"
+#include "VkRay/VkRay_device.h"
+
+// FORWARD DECLARATIONS ================================================================================================
+
+namespace vr {
+
+    // CONSTANTS =======================================================================================================
+
+    // MACROS ==========================================================================================================
+
+    // TYPES ===========================================================================================================
+
+    // STATIC VARIABLES ================================================================================================
+
+    // FUNCTION IMPLEMENTATION =========================================================================================
+
+    // CLASS IMPLEMENTATION ============================================================================================
+
+    shader_record_table::shader_record_table(vk_ray_device &device, SBTBuffer &sbt, ShaderGroup group, bool perFrameWrites)
+        : m_vr_device(device), m_sbt(sbt) {
+
+        // the frames in flight trace with the mapped memory, so the writes would race with them
+        if (perFrameWrites && sbt.Placement != SBTPlacement::DeviceLocal) {
+
+            VR_LOG(error, "shader_record_table: Per frame writes need an SBT buffer with SBTPlacement::DeviceLocal");
+            return;                                                         // no records to write, every write fails
+        }
+
+        const std::array<const vk::StridedDeviceAddressRegionKHR*, 4> regions = { &sbt.RayGenRegion, &sbt.MissRegion, &sbt.HitGroupRegion, &sbt.CallableRegion };
+        const vk::StridedDeviceAddressRegionKHR &region = *regions[(uint32_t)group];
+
+        uint8_t *bufferData = sbt.Placement == SBTPlacement::DeviceLocal ? sbt.HostData.data() : (uint8_t *)sbt.Buffer.MappedData;
+        if (region.stride == 0 || !bufferData)
+            return;                                                         // no records to write, every write fails
+
+        const uint32_t handleSize = device.GetRayTracingProperties().shaderGroupHandleSize;
+
+        m_records_offset = sbt.Offsets[(uint32_t)group] + handleSize;
+        m_records = bufferData + m_records_offset;
+        m_stride = region.stride;
+        m_record_count = static_cast<uint32_t>(region.size / region.stride);
+        m_record_data_size = static_cast<uint32_t>(region.stride) - handleSize;
+    }
+
+    // CLASS PUBLIC ====================================================================================================
+
+    bool shader_record_table::Write(uint32_t recordIndex, const void *data, uint32_t size, uint32_t offset) {
+
+        if (recordIndex >= m_record_count || (uint64_t)offset + size > m_record_data_size) {
+
+            VR_LOG(error, "shader_record_table: Write to record {} is out of bounds", recordIndex);
+            return false;
+        }
+
+        memcpy(get_record(recordIndex) + offset, data, size);
+        m_sbt.DirtyRanges.Add(m_records_offset + (vk::DeviceSize)recordIndex * m_stride + offset, size);
+        return true;
+    }
+
+
+    bool shader_record_table::WriteRange(uint32_t firstRecord, uint32_t recordCount, const void *data, uint32_t dataSize, uint32_t dataStride) {
+
+        if (recordCount == 0)
+            return true;
+
+        if ((uint64_t)firstRecord + recordCount > m_record_count || dataSize > m_record_data_size) {
+
+            VR_LOG(error, "shader_record_table: Write to records {} - {} is out of bounds", firstRecord, firstRecord + recordCount - 1);
+            return false;
+        }
+
+        const uint8_t *src = (const uint8_t *)data;
+        for (uint32_t i = 0; i < recordCount; i++)
+            memcpy(get_record(firstRecord + i), src + (size_t)i * dataStride, dataSize);
+
+        // the handles in between are clean, but one range is cheaper to track and upload than one per record
+        const vk::DeviceSize start = m_records_offset + (vk::DeviceSize)firstRecord * m_stride;
+        m_sbt.DirtyRanges.Add(start, (vk::DeviceSize)(recordCount - 1) * m_stride + dataSize);
+        return true;
+    }
+
+
+    bool shader_record_table::Flush(vk::CommandBuffer cmdBuf) {
+
+        return m_vr_device.UploadSBT(m_sbt, cmdBuf);
+    }
+
+    // CLASS PROTECTED =================================================================================================
+
+    // CLASS PRIVATE ===================================================================================================
+
+}
@@ -0,0 +1,96 @@
+
+#include "pch.h"
+
+#include "VkRay/ThreadPool.h"
+
+// FORWARD DECLARATIONS ================================================================================================
+
+namespace vr {
+
+    // CONSTANTS =======================================================================================================
+
+    // MACROS ==========================================================================================================
+
+    // TYPES ===========================================================================================================
+
+    // STATIC VARIABLES ================================================================================================
+
+    // FUNCTION IMPLEMENTATION =========================================================================================
+
+    // CLASS IMPLEMENTATION ============================================================================================
+
+    thread_pool::thread_pool(uint32_t threadCount) {
+
+        if (threadCount == 0)
+            threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+        m_threads.reserve(threadCount);
+        for (uint32_t i = 0; i < threadCount; i++)
+            m_threads.emplace_back(&thread_pool::worker_loop, this);
+    }
+
+
+    thread_pool::~thread_pool() {
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_job_available.notify_all();
+
+        for (auto &thread : m_threads)
+            thread.join();
+    }
+
+    // CLASS PUBLIC ====================================================================================================
+
+    void thread_pool::Submit(std::function<void()> job) {
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_jobs.push_back(std::move(job));
+        }
+        m_job_available.notify_one();
+    }
+
+
+    void thread_pool::WaitIdle() {
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_idle.wait(lock, [this]() { return m_jobs.empty() && m_active_jobs == 0; });
+    }
+
+    // CLASS PROTECTED =================================================================================================
+
+    // CLASS PRIVATE ===================================================================================================
+
+    void thread_pool::worker_loop() {
+
+        while (true) {
+
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_job_available.wait(lock, [this]() { return m_stop || !m_jobs.empty(); });
+
+                // the queued jobs are still finished when stopping
+                if (m_jobs.empty())
+                    return;
+
+                job = std::move(m_jobs.front());
+                m_jobs.pop_front();
+                m_active_jobs++;
+            }
+
+            job();
+
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_active_jobs--;
+                if (m_jobs.empty() && m_active_jobs == 0)
+                    m_idle.notify_all();
+            }
+        }
+    }
+
+}
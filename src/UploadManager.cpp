@@ -0,0 +1,283 @@
+
+#include "pch.h"
+
+#include "VkRay/UploadManager.h"
+#include "VkRay/VkRay_device.h"
+
+// FORWARD DECLARATIONS ================================================================================================
+
+namespace vr {
+
+    // CONSTANTS =======================================================================================================
+
+    // staging allocations are aligned, so the memcpys into the write-combined memory start on a vector boundary
+    static constexpr vk::DeviceSize STAGING_ALIGNMENT = 16;
+
+    // MACROS ==========================================================================================================
+
+    // TYPES ===========================================================================================================
+
+    // STATIC VARIABLES ================================================================================================
+
+    // FUNCTION IMPLEMENTATION =========================================================================================
+
+    // CLASS IMPLEMENTATION ============================================================================================
+
+    upload_manager::upload_manager(vk_ray_device &device, const UploadManagerCreateInfo &info)
+        : m_vr_device(device), m_info(info) {
+
+        if (!info.TransferQueue || info.TransferFamily == ~0U)
+            VR_LOG(error, "upload_manager: No transfer queue was supplied");
+
+        m_staging = device.create_buffer(AlignUp((uint64_t)info.StagingSize, (uint64_t)STAGING_ALIGNMENT), vk::BufferUsageFlagBits::eTransferSrc,
+            VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT);
+
+        if (!m_staging.MappedData)
+            VR_LOG(error, "upload_manager: Failed to create the staging buffer");
+
+        m_command_pool = device.GetDevice().createCommandPool(vk::CommandPoolCreateInfo()
+            .setFlags(vk::CommandPoolCreateFlagBits::eResetCommandBuffer | vk::CommandPoolCreateFlagBits::eTransient)
+            .setQueueFamilyIndex(info.TransferFamily));
+
+        auto typeInfo = vk::SemaphoreTypeCreateInfo()
+            .setSemaphoreType(vk::SemaphoreType::eTimeline)
+            .setInitialValue(0);
+        m_timeline = device.GetDevice().createSemaphore(vk::SemaphoreCreateInfo().setPNext(&typeInfo));
+    }
+
+
+    upload_manager::~upload_manager() {
+
+        if (!m_pending.empty())
+            VR_LOG(warning, "upload_manager: Destroyed with uploads that were never submitted");
+
+        Wait(m_next_value - 1);
+
+        vk::Device device = m_vr_device.GetDevice();
+        device.destroyCommandPool(m_command_pool);
+        device.destroySemaphore(m_timeline);
+        m_vr_device.DestroyBuffer(m_staging);
+    }
+
+    // CLASS PUBLIC ====================================================================================================
+
+    bool upload_manager::Upload(const allocated_buffer &dst, vk::DeviceSize dstOffset, const void *data, vk::DeviceSize size) {
+
+        if (dstOffset + size > dst.Size) {
+
+            VR_LOG(error, "upload_manager::Upload: The range [{}, {}) is out of bounds of the {} byte buffer", dstOffset, dstOffset + size, dst.Size);
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        const uint8_t *src = (const uint8_t *)data;
+        while (size > 0) {
+
+            // uploads bigger than the ring are split, each part is submitted on its own when the ring runs full
+            vk::DeviceSize chunkSize = std::min(size, m_staging.Size);
+            vk::DeviceSize stagingOffset = 0;
+            while (!allocate_staging(chunkSize, stagingOffset)) {
+
+                // queued uploads can only free their staging memory once they are submitted
+                if (!m_pending.empty())
+                    submit_locked();
+                reclaim_finished(true);
+            }
+
+            memcpy((uint8_t *)m_staging.MappedData + stagingOffset, src, chunkSize);
+
+            // uploads to the same buffer share one copy command, and consecutive ones even share the region
+            auto pending = std::find_if(m_pending.rbegin(), m_pending.rend(), [&dst](const pending_copy &copy) { return copy.Dst == dst.Buffer; });
+            if (pending == m_pending.rend()) {
+
+                m_pending.push_back({dst.Buffer, {}});
+                pending = m_pending.rbegin();
+            }
+
+            std::vector<vk::BufferCopy> &regions = pending->Regions;
+            if (!regions.empty() && regions.back().srcOffset + regions.back().size == stagingOffset &&
+                regions.back().dstOffset + regions.back().size == dstOffset)
+                regions.back().size += chunkSize;
+            else
+                regions.push_back(vk::BufferCopy(stagingOffset, dstOffset, chunkSize));
+
+            src += chunkSize;
+            dstOffset += chunkSize;
+            size -= chunkSize;
+        }
+
+        return true;
+    }
+
+
+    UploadBatch upload_manager::Submit() {
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return submit_locked();
+    }
+
+
+    void upload_manager::RecordAcquireBarriers(const UploadBatch &batch, vk::CommandBuffer cmdBuf, vk::PipelineStageFlags dstStage,
+        vk::AccessFlags dstAccess) {
+
+        if (batch.AcquireBarriers.empty())
+            return;
+
+        std::vector<vk::BufferMemoryBarrier> barriers = batch.AcquireBarriers;
+        for (auto &barrier : barriers)
+            barrier.setDstAccessMask(dstAccess);
+
+        cmdBuf.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, dstStage, (vk::DependencyFlagBits)0, nullptr, barriers, nullptr);
+    }
+
+
+    uint64_t upload_manager::GetCompletedValue() const                 { return m_vr_device.GetDevice().getSemaphoreCounterValue(m_timeline); }
+
+
+    bool upload_manager::Wait(uint64_t value, uint64_t timeout) {
+
+        if (value == 0)
+            return true;
+
+        auto waitInfo = vk::SemaphoreWaitInfo()
+            .setSemaphores(m_timeline)
+            .setValues(value);
+
+        return m_vr_device.GetDevice().waitSemaphores(waitInfo, timeout) == vk::Result::eSuccess;
+    }
+
+    // CLASS PROTECTED =================================================================================================
+
+    // CLASS PRIVATE ===================================================================================================
+
+    UploadBatch upload_manager::submit_locked() {
+
+        UploadBatch outBatch = {};
+        if (m_pending.empty())
+            return outBatch;
+
+        m_vr_device.FlushBuffer(m_staging);
+
+        vk::CommandBuffer cmdBuf = get_command_buffer();
+        cmdBuf.begin(vk::CommandBufferBeginInfo().setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+
+        // exclusive buffers have to be released by the transfer queue family and acquired by the family that uses them
+        bool transferOwnership = m_info.DstFamily != ~0U && m_info.DstFamily != m_info.TransferFamily;
+
+        std::vector<vk::BufferMemoryBarrier> releaseBarriers;
+        for (const auto &copy : m_pending) {
+
+            cmdBuf.copyBuffer(m_staging.Buffer, copy.Dst, copy.Regions);
+            if (!transferOwnership)
+                continue;
+
+            for (const auto &region : copy.Regions) {
+
+                auto barrier = vk::BufferMemoryBarrier()
+                    .setSrcAccessMask(vk::AccessFlagBits::eTransferWrite)
+                    .setSrcQueueFamilyIndex(m_info.TransferFamily)
+                    .setDstQueueFamilyIndex(m_info.DstFamily)
+                    .setBuffer(copy.Dst)
+                    .setOffset(region.dstOffset)
+                    .setSize(region.size);
+                releaseBarriers.push_back(barrier);
+
+                // the acquire has to use the same range, the access masks of the other queue are ignored
+                outBatch.AcquireBarriers.push_back(barrier.setSrcAccessMask({}));
+            }
+        }
+
+        if (!releaseBarriers.empty())
+            cmdBuf.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eBottomOfPipe, (vk::DependencyFlagBits)0,
+                nullptr, releaseBarriers, nullptr);
+
+        cmdBuf.end();
+
+        uint64_t value = m_next_value++;
+        auto timelineInfo = vk::TimelineSemaphoreSubmitInfo().setSignalSemaphoreValues(value);
+        auto submitInfo = vk::SubmitInfo()
+            .setCommandBuffers(cmdBuf)
+            .setSignalSemaphores(m_timeline)
+            .setPNext(&timelineInfo);
+
+        m_info.TransferQueue.submit(submitInfo);
+
+        m_in_flight.push_back({cmdBuf, value, m_head, m_pending_bytes});
+        m_pending.clear();
+        m_pending_bytes = 0;
+
+        outBatch.TimelineValue = value;
+        return outBatch;
+    }
+
+
+    bool upload_manager::allocate_staging(vk::DeviceSize size, vk::DeviceSize &outOffset) {
+
+        size = AlignUp((uint64_t)size, (uint64_t)STAGING_ALIGNMENT);
+        vk::DeviceSize capacity = m_staging.Size;
+
+        if (m_used == 0)
+            m_head = m_tail = 0;
+
+        // the free space is [head, capacity) + [0, tail) unless the head has wrapped around behind the tail
+        bool wrapped = m_head < m_tail || (m_head == m_tail && m_used > 0);
+        vk::DeviceSize usedBytes = size;
+        if (!wrapped && m_head + size <= capacity)
+            outOffset = m_head;
+        else if (!wrapped && size <= m_tail) {
+
+            // the end of the ring is too small, it is skipped and freed together with this allocation
+            usedBytes += capacity - m_head;
+            outOffset = 0;
+        }
+        else if (wrapped && m_head + size <= m_tail)
+            outOffset = m_head;
+        else
+            return false;
+
+        m_head = outOffset + size;
+        m_used += usedBytes;
+        m_pending_bytes += usedBytes;
+        return true;
+    }
+
+
+    void upload_manager::reclaim_finished(bool waitForOldest) {
+
+        if (m_in_flight.empty())
+            return;
+
+        if (waitForOldest)
+            Wait(m_in_flight.front().TimelineValue);
+
+        uint64_t completed = GetCompletedValue();
+        while (!m_in_flight.empty() && m_in_flight.front().TimelineValue <= completed) {
+
+            const in_flight_batch &batch = m_in_flight.front();
+            m_tail = batch.RingHead;
+            m_used -= batch.RingBytes;
+            m_free_command_buffers.push_back(batch.CommandBuffer);
+            m_in_flight.pop_front();
+        }
+    }
+
+
+    vk::CommandBuffer upload_manager::get_command_buffer() {
+
+        reclaim_finished(false);
+
+        if (!m_free_command_buffers.empty()) {
+
+            vk::CommandBuffer cmdBuf = m_free_command_buffers.back();
+            m_free_command_buffers.pop_back();
+            return cmdBuf;                                                                  // reset implicitly by begin()
+        }
+
+        return m_vr_device.GetDevice().allocateCommandBuffers(vk::CommandBufferAllocateInfo()
+            .setCommandPool(m_command_pool)
+            .setLevel(vk::CommandBufferLevel::ePrimary)
+            .setCommandBufferCount(1))[0];
+    }
+
+}
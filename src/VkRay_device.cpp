@@ -39,6 +39,12 @@ namespace vr {
         m_physical_device.getProperties2KHR(&deviceProperties, m_dyn_loader);
         m_device_properties = m_physical_device.getProperties();
 
+        // Get the acceleration structure features, to know if host builds are supported
+        auto deviceFeatures = vk::PhysicalDeviceFeatures2();
+        deviceFeatures.pNext = &m_accel_features;
+        m_accel_features.pNext = nullptr;
+        m_physical_device.getFeatures2(&deviceFeatures, m_dyn_loader);
+
         // If the supplied allocator isn't null then return, because we don't need to create a new one
         if (m_vma_allocator != nullptr) {
 
@@ -59,14 +65,125 @@ namespace vr {
 
     vk_ray_device::~vk_ray_device() {
 
+        // finish the jobs first, they may still use the device
+        m_thread_pool.reset();
+        FlushRetiredResources();
+        destroy_shader_modules();
+
         if (!m_user_supplied_allocator)
             vmaDestroyAllocator(m_vma_allocator);
     }
 
     // CLASS PUBLIC ====================================================================================================
 
+    thread_pool& vk_ray_device::GetThreadPool() {
+
+        std::call_once(m_thread_pool_once, [this]() { m_thread_pool = std::make_unique<thread_pool>(); });
+        return *m_thread_pool;
+    }
+
+
+    void vk_ray_device::SetAccelStructQueueFamilies(const std::vector<uint32_t> &families) {
+
+        m_accel_struct_families.clear();
+        for (uint32_t family : families)
+            if (family != ~0U && std::find(m_accel_struct_families.begin(), m_accel_struct_families.end(), family) == m_accel_struct_families.end())
+                m_accel_struct_families.push_back(family);
+
+        // one family needs no sharing
+        if (m_accel_struct_families.size() < 2)
+            m_accel_struct_families.clear();
+    }
+
+
+    void vk_ray_device::AdvanceFrame() {
+
+        std::vector<std::function<void()>> destroyFuncs;
+        {
+            std::lock_guard<std::mutex> lock(m_retire_mutex);
+            uint64_t frameIndex = ++m_frame_index;
+
+            // resources are retired in frame order, so stop at the first one that may still be in use
+            while (!m_retired_resources.empty() && m_retired_resources.front().first + m_frames_in_flight <= frameIndex) {
+
+                destroyFuncs.push_back(std::move(m_retired_resources.front().second));
+                m_retired_resources.pop_front();
+            }
+        }
+
+        // destroy outside of the lock, so the destroy functions can retire other resources
+        for (auto &destroyFunc : destroyFuncs)
+            destroyFunc();
+    }
+
+
+    void vk_ray_device::RetireResource(std::function<void()> destroyFunc) {
+
+        std::lock_guard<std::mutex> lock(m_retire_mutex);
+        m_retired_resources.emplace_back(m_frame_index.load(), std::move(destroyFunc));
+    }
+
+
+    void vk_ray_device::RetireBuffer(const allocated_buffer &buffer) {
+
+        RetireResource([this, buffer]() mutable { DestroyBuffer(buffer); });
+    }
+
+
+    void vk_ray_device::RetireBLAS(const BLASHandle &blas) {
+
+        RetireResource([this, blas]() mutable { DestroyBLAS(blas); });
+    }
+
+
+    void vk_ray_device::FlushRetiredResources() {
+
+        // destroy functions may retire other resources, so keep going until the queue is empty
+        while (true) {
+
+            std::deque<std::pair<uint64_t, std::function<void()>>> retired;
+            {
+                std::lock_guard<std::mutex> lock(m_retire_mutex);
+                retired.swap(m_retired_resources);
+            }
+            if (retired.empty())
+                break;
+
+            for (auto &[frame, destroyFunc] : retired)
+                destroyFunc();
+        }
+    }
+
     // CLASS PROTECTED =================================================================================================
 
     // CLASS PRIVATE ===================================================================================================
 
+    bool vk_ray_device::join_deferred_operation(vk::DeferredOperationKHR operation, std::atomic<uint32_t> &activeJoiners,
+        vk::Result &outResult) {
+
+        while (true) {
+
+            // called through the dispatcher directly, so errors are returned instead of thrown on a worker thread
+            auto result = (vk::Result)m_dyn_loader.vkDeferredOperationJoinKHR(m_device, operation);
+
+            // eThreadIdleKHR means the operation waits for work of other threads, that this thread can help with later
+            if (result != vk::Result::eThreadIdleKHR)
+                break;
+
+            std::this_thread::yield();
+        }
+
+        // any other result means that this thread can't do any more work, the last joiner that leaves finishes the operation
+        if (--activeJoiners > 0)
+            return false;
+
+        // eThreadDoneKHR only means that the remaining work is taken, the implementation may still be running it on
+        // other threads, so the operation is only destroyed once it reports a result
+        while ((outResult = m_device.getDeferredOperationResultKHR(operation, m_dyn_loader)) == vk::Result::eNotReady)
+            std::this_thread::yield();
+
+        m_device.destroyDeferredOperationKHR(operation, nullptr, m_dyn_loader);
+        return true;
+    }
+
 }
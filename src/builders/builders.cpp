@@ -23,7 +23,8 @@ namespace vr
         VK_KHR_PIPELINE_LIBRARY_EXTENSION_NAME,
         VK_KHR_BUFFER_DEVICE_ADDRESS_EXTENSION_NAME,     // Required by VkRay if using Descriptors that VkRay creates
         VK_EXT_GRAPHICS_PIPELINE_LIBRARY_EXTENSION_NAME, // for independent sets
-        VK_KHR_RAY_TRACING_POSITION_FETCH_EXTENSION_NAME // for ray tracing position fet
+        VK_KHR_RAY_TRACING_POSITION_FETCH_EXTENSION_NAME, // for ray tracing position fet
+        VK_KHR_RAY_TRACING_MAINTENANCE_1_EXTENSION_NAME  // for the shader binding table read access flag
     };
 
     // MACROS ==========================================================================================================
@@ -91,6 +92,8 @@ namespace vr
         // required extensions by VkRay
         inst_builder.enable_extension(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
 
+        inst_builder.set_headless(Headless);
+
         if (EnableDebug)
         {
             inst_builder.request_validation_layers()
@@ -132,15 +135,17 @@ namespace vr
                                  .add_required_extensions(RayTracingExtensions)
                                  .prefer_gpu_device_type(vkb::PreferredDeviceType::discrete)
                                  .set_surface(surface)
-                                 .require_present();
+                                 .require_present(!Headless);
 
         // Enable needed features
         auto raytracing_features = vk::PhysicalDeviceRayTracingPipelineFeaturesKHR().setRayTracingPipeline(true);
         auto ray_query_features = vk::PhysicalDeviceRayQueryFeaturesKHR().setRayQuery(true);
         auto ray_tracing_position_fetch_features = vk::PhysicalDeviceRayTracingPositionFetchFeaturesKHR().setRayTracingPositionFetch(true);
+        auto ray_tracing_maintenance_features = vk::PhysicalDeviceRayTracingMaintenance1FeaturesKHR().setRayTracingMaintenance1(true);
 
         auto accelFeatures = vk::PhysicalDeviceAccelerationStructureFeaturesKHR()
                                  .setAccelerationStructure(true)
+                                 .setAccelerationStructureHostCommands(HostAccelerationStructureCommands)
                                  .setDescriptorBindingAccelerationStructureUpdateAfterBind(true);
 
         auto descbufferFeatures = vk::PhysicalDeviceDescriptorBufferFeaturesEXT()
@@ -150,10 +155,19 @@ namespace vr
         phys_selector.add_required_extension_features(raytracing_features);
         phys_selector.add_required_extension_features(ray_query_features);
         phys_selector.add_required_extension_features(ray_tracing_position_fetch_features);
+        phys_selector.add_required_extension_features(ray_tracing_maintenance_features);
         phys_selector.add_required_extension_features(accelFeatures);
         phys_selector.add_required_extension_features(descbufferFeatures);
 
+        if (ShaderModuleIdentifiers)
+        {
+            phys_selector.add_required_extension(VK_EXT_SHADER_MODULE_IDENTIFIER_EXTENSION_NAME);
+            phys_selector.add_required_extension_features(vk::PhysicalDeviceShaderModuleIdentifierFeaturesEXT().setShaderModuleIdentifier(true));
+        }
+
         PhysicalDeviceFeatures12.bufferDeviceAddress = true;
+        PhysicalDeviceFeatures12.timelineSemaphore = true;
+        PhysicalDeviceFeatures12.hostQueryReset = true;
         PhysicalDeviceFeatures12.descriptorIndexing = true;
         PhysicalDeviceFeatures12.descriptorBindingVariableDescriptorCount = true;
         PhysicalDeviceFeatures12.descriptorBindingPartiallyBound = true;
@@ -165,12 +179,15 @@ namespace vr
         PhysicalDeviceFeatures12.shaderUniformTexelBufferArrayNonUniformIndexing = true;
         PhysicalDeviceFeatures12.shaderStorageTexelBufferArrayNonUniformIndexing = true;
 
+        PhysicalDeviceFeatures13.synchronization2 = true;
+        PhysicalDeviceFeatures13.pipelineCreationCacheControl = true;
+
         phys_selector.set_required_features(PhysicalDeviceFeatures10);
         phys_selector.set_required_features_11(PhysicalDeviceFeatures11);
         phys_selector.set_required_features_12(PhysicalDeviceFeatures12);
         phys_selector.set_required_features_13(PhysicalDeviceFeatures13);
 
-        phys_selector.set_minimum_version(1, 2);
+        phys_selector.set_minimum_version(1, 3);
         auto phys_result = phys_selector.select();
         if (!phys_result.has_value())
         {
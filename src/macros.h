@@ -32,6 +32,17 @@ namespace vr {
 
     #endif
 
+    // SIMD instruction set of the bulk kernels, SSE2 is part of every x86-64 target and NEON of every ARM64 target
+    #if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+
+        #define VR_SIMD_SSE2                            1
+
+    #elif defined(__ARM_NEON) || defined(_M_ARM64)
+
+        #define VR_SIMD_NEON                            1
+
+    #endif
+
     // TYPES ===========================================================================================================
 
     // STATIC VARIABLES ================================================================================================
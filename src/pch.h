@@ -1,12 +1,26 @@
 
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <future>
 #include <iostream>
+#include <latch>
 #include <memory>
+#include <mutex>
 #include <numeric>
+#include <optional>
 #include <set>
 #include <vector>
 #include <thread>
+#include <unordered_map>
 #include <vk_mem_alloc.h>
 #include <vulkan/vulkan.hpp>
 
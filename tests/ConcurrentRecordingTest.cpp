@@ -0,0 +1,321 @@
+
+#include "VkRay/VkRay.h"
+#include "VkRay/builders/builders.h"
+
+#include <atomic>
+#include <barrier>
+#include <cstdio>
+#include <thread>
+
+// FORWARD DECLARATIONS ================================================================================================
+
+namespace vr::test {
+
+    // CONSTANTS =======================================================================================================
+
+    static constexpr uint32_t THREAD_COUNT = 8;
+    static constexpr uint32_t BLAS_PER_THREAD = 4;
+    static constexpr uint32_t AABB_COUNT = 64;
+    static constexpr uint32_t FRAME_COUNT = 3;                      // the frame slot of the allocator is reused
+    static constexpr uint64_t FENCE_TIMEOUT = 10'000'000'000ull;    // 10 seconds
+
+    // MACROS ==========================================================================================================
+
+    // TYPES ===========================================================================================================
+
+    // what all the threads read, created once by the main thread
+    struct shared_resources {
+
+        allocated_buffer                                        AABBs = {};
+        vk::DescriptorSetLayout                                 SetLayout = nullptr;    // the TLAS at binding 0
+        vk::PipelineLayout                                      PipelineLayout = nullptr;
+    };
+
+    // what a thread created for its command buffer, destroyed after the GPU is done with it
+    struct thread_resources {
+
+        std::vector<BLASHandle>                                 BLAS;
+        TLASHandle                                              TLAS = {};
+        std::vector<allocated_buffer>                           Buffers;
+        vk::CommandBuffer                                       CmdBuf = nullptr;
+        const char*                                             Error = nullptr;
+    };
+
+    // STATIC VARIABLES ================================================================================================
+
+    static std::atomic<uint32_t> s_validation_errors = 0;
+
+    // FUNCTION IMPLEMENTATION =========================================================================================
+
+    static VKAPI_ATTR VkBool32 VKAPI_CALL count_validation_errors(VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity,
+        VkDebugUtilsMessageTypeFlagsEXT messageType, const VkDebugUtilsMessengerCallbackDataEXT *pCallbackData, void *pUserData) {
+
+        if (messageSeverity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT) {
+
+            static_cast<std::atomic<uint32_t> *>(pUserData)->fetch_add(1);
+            std::printf("Validation error: %s\n", pCallbackData->pMessage);
+        }
+
+        return VK_FALSE;
+    }
+
+
+    // records the builds of a few BLASes and a TLAS over them into a command buffer of the calling thread, and binds
+    // a descriptor buffer with the TLAS for the ray tracing bind point
+    static void record_builds(vk_ray_device &device, command_allocator &allocator, const shared_resources &shared, thread_resources &res) {
+
+        GeometryData geometry = {};
+        geometry.Type = vk::GeometryTypeKHR::eAabbs;
+        geometry.DataAddresses.AABBDevAddress = shared.AABBs.DevAddress;
+        geometry.Stride = sizeof(vk::AabbPositionsKHR);
+        geometry.PrimitiveCount = AABB_COUNT;
+
+        BLASCreateInfo blasInfo = {};
+        blasInfo.Geometries = { geometry };
+
+        std::vector<BLASBuildInfo> blasBuildInfos;
+        for (uint32_t i = 0; i < BLAS_PER_THREAD; i++) {
+
+            auto [blas, buildInfo] = device.CreateBLAS(blasInfo);
+            res.BLAS.push_back(blas);
+            blasBuildInfos.push_back(buildInfo);
+        }
+
+        res.Buffers.push_back(device.CreateScratchBufferFromBuildInfos(blasBuildInfos));
+
+        allocated_buffer instanceBuffer = device.CreateInstanceBuffer(BLAS_PER_THREAD);
+        res.Buffers.push_back(instanceBuffer);
+        if (!instanceBuffer.MappedData) {
+
+            res.Error = "the instance buffer isn't mapped";
+            return;
+        }
+
+        auto *instances = static_cast<vk::AccelerationStructureInstanceKHR *>(instanceBuffer.MappedData);
+        for (uint32_t i = 0; i < BLAS_PER_THREAD; i++) {
+
+            vk::AccelerationStructureInstanceKHR instance = {};
+            instance.transform.matrix[0][0] = instance.transform.matrix[1][1] = instance.transform.matrix[2][2] = 1.0f;
+            instance.transform.matrix[0][3] = (float)i * 4.0f;
+            instance.mask = 0xFF;
+            instance.accelerationStructureReference = res.BLAS[i].Buffer.DevAddress;
+            instances[i] = instance;
+        }
+        device.FlushBuffer(instanceBuffer);
+
+        auto [tlas, tlasBuildInfo] = device.CreateTLAS({ BLAS_PER_THREAD, instanceBuffer.DevAddress });
+        res.TLAS = tlas;
+        res.Buffers.push_back(device.CreateScratchBufferFromBuildInfo(tlasBuildInfo));
+
+        vk::DeviceAddress tlasAddress = tlas.Buffer.DevAddress;
+        std::vector<DescriptorItem> items = { DescriptorItem(0, vk::DescriptorType::eAccelerationStructureKHR,
+            vk::ShaderStageFlagBits::eRaygenKHR, 1, &tlasAddress) };
+        DescriptorBuffer descriptorBuffer = device.CreateDescriptorBuffer(shared.SetLayout, items, DescriptorBufferType::Resource);
+        res.Buffers.push_back(descriptorBuffer.Buffer);
+        device.UpdateDescriptorBuffer(descriptorBuffer, items, DescriptorBufferType::Resource);
+        device.FlushBuffer(descriptorBuffer.Buffer);
+
+        res.CmdBuf = allocator.AllocatePrimary();
+        res.CmdBuf.begin(vk::CommandBufferBeginInfo().setFlags(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+        device.BuildBLAS(blasBuildInfos, res.CmdBuf);
+        device.AddAccelerationBuildBarrier(res.CmdBuf);
+        device.BuildTLAS(tlasBuildInfo, instanceBuffer, BLAS_PER_THREAD, res.CmdBuf);
+        device.BindDescriptorBuffer({ descriptorBuffer }, res.CmdBuf);
+        device.BindDescriptorSet(shared.PipelineLayout, 0, 0, 0, res.CmdBuf);
+        res.CmdBuf.end();
+
+        allocator.Enqueue(res.CmdBuf);
+    }
+
+
+    static void destroy_thread_resources(vk_ray_device &device, thread_resources &res) {
+
+        device.DestroyBLAS(res.BLAS);
+        if (res.TLAS.AccelerationStructure)
+            device.DestroyTLAS(res.TLAS);
+        for (auto &buffer : res.Buffers)
+            device.DestroyBuffer(buffer);
+
+        res = {};
+    }
+
+
+    // checks the recordings of one frame, firstCmdBufs are the command buffers the threads got in the first frame
+    static bool check_frame(const std::vector<thread_resources> &resources, std::vector<vk::CommandBuffer> &firstCmdBufs, uint32_t frame) {
+
+        bool passed = true;
+        for (uint32_t t = 0; t < THREAD_COUNT; t++) {
+
+            if (resources[t].Error) {
+
+                std::printf("Thread %u failed: %s\n", t, resources[t].Error);
+                passed = false;
+            }
+            for (uint32_t other = 0; other < t; other++)
+                if (resources[t].CmdBuf && resources[t].CmdBuf == resources[other].CmdBuf) {
+
+                    std::printf("Threads %u and %u recorded into the same command buffer\n", other, t);
+                    passed = false;
+                }
+
+            // with one frame slot, a thread that finds its pool again gets the same command buffer back after the reset,
+            // new pools would hand out new command buffers
+            if (frame == 0)
+                firstCmdBufs[t] = resources[t].CmdBuf;
+            else if (resources[t].CmdBuf != firstCmdBufs[t]) {
+
+                std::printf("Thread %u got another command pool in frame %u\n", t, frame);
+                passed = false;
+            }
+        }
+
+        return passed;
+    }
+
+
+    // the worker threads are started once and record every frame, like the workers of a job system
+    static bool run_frames(vk_ray_device &device, vk::Device dev, const CommandQueues &queues, command_allocator &allocator,
+        const shared_resources &shared) {
+
+        std::vector<thread_resources> resources(THREAD_COUNT);
+        std::barrier<> sync(THREAD_COUNT + 1);                      // the workers and the main thread
+        std::atomic<bool> stop = false;
+
+        std::vector<std::thread> workers;
+        for (uint32_t t = 0; t < THREAD_COUNT; t++) {
+
+            workers.emplace_back([&, t]() {
+
+                while (true) {
+
+                    sync.arrive_and_wait();                         // the main thread began the frame
+                    if (stop)
+                        break;
+
+                    try {
+                        record_builds(device, allocator, shared, resources[t]);
+                    }
+                    catch (const std::exception &e) {
+                        std::printf("Thread %u: %s\n", t, e.what());
+                        resources[t].Error = "recording threw an exception";
+                    }
+
+                    sync.arrive_and_wait();                         // the recordings are done
+                }
+            });
+        }
+
+        bool passed = true;
+        vk::Fence fence = dev.createFence(vk::FenceCreateInfo());
+        std::vector<vk::CommandBuffer> firstCmdBufs(THREAD_COUNT);
+        for (uint32_t frame = 0; frame < FRAME_COUNT && passed; frame++) {
+
+            allocator.BeginFrame();
+            sync.arrive_and_wait();
+            sync.arrive_and_wait();
+
+            passed = check_frame(resources, firstCmdBufs, frame);
+
+            allocator.Submit(queues.GraphicsQueue, {}, {}, fence);
+            if (dev.waitForFences(fence, VK_TRUE, FENCE_TIMEOUT) != vk::Result::eSuccess) {
+
+                std::printf("The builds didn't finish in time\n");
+                passed = false;
+                break;                                              // the GPU may still use the resources, leak them
+            }
+            dev.resetFences(fence);
+
+            for (auto &res : resources)
+                destroy_thread_resources(device, res);
+        }
+
+        stop = true;
+        sync.arrive_and_wait();
+        for (auto &worker : workers)
+            worker.join();
+
+        dev.destroyFence(fence);
+        return passed;
+    }
+
+
+    static bool run_test(vk_ray_device &device, vk::Device dev, const CommandQueues &queues) {
+
+        shared_resources shared = {};
+        shared.AABBs = device.create_buffer(AABB_COUNT * sizeof(vk::AabbPositionsKHR),
+            vk::BufferUsageFlagBits::eAccelerationStructureBuildInputReadOnlyKHR,
+            VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT | VMA_ALLOCATION_CREATE_MAPPED_BIT);
+
+        auto *aabbs = static_cast<vk::AabbPositionsKHR *>(shared.AABBs.MappedData);
+        for (uint32_t i = 0; i < AABB_COUNT; i++)
+            aabbs[i] = vk::AabbPositionsKHR((float)i, 0.0f, 0.0f, (float)i + 0.5f, 1.0f, 1.0f);
+        device.FlushBuffer(shared.AABBs);
+
+        shared.SetLayout = device.CreateDescriptorSetLayout({ DescriptorItem(0, vk::DescriptorType::eAccelerationStructureKHR,
+            vk::ShaderStageFlagBits::eRaygenKHR, 1) });
+        shared.PipelineLayout = device.CreatePipelineLayout(std::vector<vk::DescriptorSetLayout>{ shared.SetLayout });
+
+        bool passed;
+        {
+            command_allocator allocator(dev, { queues.GraphicsIndex, 1 });
+            passed = run_frames(device, dev, queues, allocator, shared);
+
+            // the main thread never allocates, so there is exactly one pool per worker
+            if (passed && allocator.GetThreadCount() != THREAD_COUNT) {
+
+                std::printf("Expected command pools for %u threads, got %u\n", THREAD_COUNT, allocator.GetThreadCount());
+                passed = false;
+            }
+        }
+
+        dev.destroyPipelineLayout(shared.PipelineLayout);
+        dev.destroyDescriptorSetLayout(shared.SetLayout);
+        device.DestroyBuffer(shared.AABBs);
+        return passed;
+    }
+
+}
+
+
+int main() {
+
+    using namespace vr::test;
+
+    vr::vulkan_builder builder;
+    builder.Headless = true;
+    builder.EnableDebug = true;
+    builder.DebugCallback = count_validation_errors;
+    builder.DebugCallbackUserData = &s_validation_errors;
+
+    vr::InstanceWrapper instance;
+    vk::PhysicalDevice physDev;
+    vk::Device dev;
+    try {
+        instance = builder.CreateInstance();
+        physDev = builder.PickPhysicalDevice(nullptr);
+        dev = builder.CreateDevice();
+    }
+    catch (const std::exception &e) {
+        std::printf("No ray tracing device: %s\n", e.what());
+        return 1;
+    }
+
+    bool passed;
+    {
+        vr::vk_ray_device device(instance.InstanceHandle, dev, physDev);
+        passed = run_test(device, dev, builder.GetQueues());
+        device.FlushRetiredResources();
+    }
+
+    dev.destroy();
+    vr::InstanceWrapper::DestroyInstance(instance);
+
+    if (s_validation_errors > 0) {
+
+        std::printf("%u validation errors\n", s_validation_errors.load());
+        passed = false;
+    }
+
+    std::printf("Concurrent recording of %u threads, %u frames: %s\n", THREAD_COUNT, FRAME_COUNT, passed ? "passed" : "FAILED");
+    return passed ? 0 : 1;
+}